@@ -1,9 +1,8 @@
 #include "bvh.h"
 
+#include <algorithm>
 #include <iostream>
 #include <numeric>
-#include <queue>
-#include <unordered_map>
 
 #include "glm/common.hpp"
 #include "glm/geometric.hpp"
@@ -66,20 +65,23 @@ float bvh_builder::calculate_surface_area(const glm::vec3& min, const glm::vec3&
     return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
 }
 
-std::vector<scene_data::bvh_node> bvh_builder::build_bvh(
+std::pmr::vector<scene_data::bvh_node> bvh_builder::build_bvh(
     const std::array<scene_data::sphere_data, MAX_SPHERES>& spheres, const int num_spheres,
     const std::array<scene_data::plane_data, MAX_PLANES>& planes, const int num_planes,
     const std::array<scene_data::triangle_data, MAX_TRIANGLES>& triangles, const int num_triangles,
-    const std::array<scene_data::csg_sphere_data, MAX_CSG_SPHERES>& csg_spheres)
+    const std::array<scene_data::csg_sphere_data, MAX_CSG_SPHERES>& csg_spheres,
+    const std::vector<mesh_storage::mesh_info>& meshes,
+    std::pmr::memory_resource* scratch)
 {
-    std::vector<object_ref> objects;
-    objects.reserve(num_spheres + num_planes + num_triangles + MAX_CSG_SPHERES);
+    std::pmr::vector<object_ref> objects(scratch);
+    objects.reserve(num_spheres + num_planes + num_triangles + MAX_CSG_SPHERES + meshes.size());
 
     std::cout << "Building BVH with:" << std::endl;
     std::cout << "- " << num_spheres << " spheres" << std::endl;
     std::cout << "- " << num_planes << " planes" << std::endl;
     std::cout << "- " << num_triangles << " triangles" << std::endl;
     std::cout << "- " << MAX_CSG_SPHERES << " CSG spheres" << std::endl;
+    std::cout << "- " << meshes.size() << " meshes" << std::endl;
 
     // Add spheres to the object list
     for (int i = 0; i < num_spheres; i++)
@@ -129,10 +131,24 @@ std::vector<scene_data::bvh_node> bvh_builder::build_bvh(
         objects.push_back(ref);
     }
 
+    // Add meshes to the object list
+    for (int i = 0; i < static_cast<int>(meshes.size()); i++)
+    {
+        object_ref ref{i, 4}; // type 4 = mesh
+
+        // Padded by half a quantization step, like the nodes of the mesh bvh
+        const glm::vec3 padding = (meshes[i].aabb_max - meshes[i].aabb_min) * (0.5f / 65535.0f);
+        ref.aabb_min = meshes[i].aabb_min - padding;
+        ref.aabb_max = meshes[i].aabb_max + padding;
+        ref.centroid = (ref.aabb_min + ref.aabb_max) * 0.5f;
+
+        objects.push_back(ref);
+    }
+
     std::cout << "Total objects added to BVH: " << objects.size() << std::endl;
 
     // Initialize nodes vector
-    std::vector<scene_data::bvh_node> nodes;
+    std::pmr::vector<scene_data::bvh_node> nodes(scratch);
     nodes.reserve(MAX_BVH_NODES);
 
     // Start building the BVH recursively
@@ -149,12 +165,22 @@ std::vector<scene_data::bvh_node> bvh_builder::build_bvh(
         nodes.push_back(root);
     }
 
+    // Breadth-first order puts the top levels first, where the tracing kernels can cache them in shared memory
+    optimize_bvh_for_cache(nodes);
+
     return nodes;
 }
 
+std::pmr::vector<scene_data::bvh_node> bvh_builder::build_bvh(const scene_snapshot& snapshot,
+                                                               std::pmr::memory_resource* scratch)
+{
+    return build_bvh(*snapshot.spheres, snapshot.num_spheres, *snapshot.planes, snapshot.num_planes,
+                     *snapshot.triangles, snapshot.num_triangles, *snapshot.csg_spheres, *snapshot.mesh_infos, scratch);
+}
+
 int bvh_builder::build_bvh_recursive(
-    std::vector<scene_data::bvh_node>& nodes,
-    std::vector<object_ref>& objects,
+    std::pmr::vector<scene_data::bvh_node>& nodes,
+    std::pmr::vector<object_ref>& objects,
     int start, int end,
     int depth)
 {
@@ -221,7 +247,98 @@ int bvh_builder::build_bvh_recursive(
     return current_node_index;
 }
 
-void bvh_builder::compute_bounds(const std::vector<object_ref>& objects, const int start, const int end, glm::vec3& out_min,
+std::pmr::vector<scene_data::bvh_node> bvh_builder::build_mesh_bvh(
+    const std::span<const glm::vec3> positions,
+    const std::span<glm::uvec4> triangles,
+    std::pmr::memory_resource* scratch)
+{
+    std::pmr::vector<scene_data::bvh_node> nodes(scratch);
+    if (triangles.empty())
+    {
+        return nodes;
+    }
+
+    std::pmr::vector<object_ref> objects(scratch);
+    objects.reserve(triangles.size());
+
+    // Add triangles to the object list
+    for (int i = 0; i < static_cast<int>(triangles.size()); i++)
+    {
+        object_ref ref{i, 2}; // type 2 = triangle
+
+        const glm::uvec4& triangle = triangles[i];
+        ref.aabb_min = glm::min(glm::min(positions[triangle.x], positions[triangle.y]), positions[triangle.z]);
+        ref.aabb_max = glm::max(glm::max(positions[triangle.x], positions[triangle.y]), positions[triangle.z]);
+        ref.centroid = (ref.aabb_min + ref.aabb_max) * 0.5f;
+
+        objects.push_back(ref);
+    }
+
+    // A binary tree with leaves of up to MAX_MESH_LEAF_SIZE triangles
+    nodes.reserve(2 * (triangles.size() / MAX_MESH_LEAF_SIZE + 1));
+    build_mesh_bvh_recursive(nodes, objects, 0, static_cast<int>(objects.size()));
+
+    // Reorder the triangles so each leaf covers a contiguous range
+    const std::pmr::vector<glm::uvec4> source(triangles.begin(), triangles.end(), scratch);
+    for (std::size_t i = 0; i < objects.size(); i++)
+    {
+        triangles[i] = source[objects[i].index];
+    }
+
+    return nodes;
+}
+
+int bvh_builder::build_mesh_bvh_recursive(
+    std::pmr::vector<scene_data::bvh_node>& nodes,
+    std::pmr::vector<object_ref>& objects,
+    const int start, const int end)
+{
+    glm::vec3 aabb_min, aabb_max;
+    compute_bounds(objects, start, end, aabb_min, aabb_max);
+
+    const int node_index = static_cast<int>(nodes.size());
+
+    // Small ranges become leaves referencing their triangles directly
+    if (end - start <= MAX_MESH_LEAF_SIZE)
+    {
+        nodes.emplace_back(aabb_min, aabb_max, start, end - start, 2);
+        return node_index;
+    }
+
+    // Add a placeholder node that will be filled in later
+    nodes.emplace_back();
+
+    // Split on the longest axis of the centroid bounds
+    auto centroid_min = glm::vec3(std::numeric_limits<float>::max());
+    auto centroid_max = glm::vec3(std::numeric_limits<float>::lowest());
+    for (int i = start; i < end; i++)
+    {
+        centroid_min = glm::min(centroid_min, objects[i].centroid);
+        centroid_max = glm::max(centroid_max, objects[i].centroid);
+    }
+
+    int axis = 0;
+    const glm::vec3 extent = centroid_max - centroid_min;
+    if (extent.y > extent.x) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    // Partition around the median, which is linear instead of a full sort
+    const int mid = start + (end - start) / 2;
+    std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end,
+                     [axis](const object_ref& a, const object_ref& b) {
+                         return a.centroid[axis] < b.centroid[axis];
+                     });
+
+    const int left_child = build_mesh_bvh_recursive(nodes, objects, start, mid);
+    const int right_child = build_mesh_bvh_recursive(nodes, objects, mid, end);
+
+    nodes[node_index] = scene_data::bvh_node(aabb_min, aabb_max, left_child, right_child);
+    nodes[node_index].split_axis = axis;
+
+    return node_index;
+}
+
+void bvh_builder::compute_bounds(const std::pmr::vector<object_ref>& objects, const int start, const int end, glm::vec3& out_min,
     glm::vec3& out_max)
 {
     out_min = glm::vec3(std::numeric_limits<float>::max());
@@ -234,29 +351,31 @@ void bvh_builder::compute_bounds(const std::vector<object_ref>& objects, const i
     }
 }
 
-void bvh_builder::optimize_bvh_for_cache(std::vector<scene_data::bvh_node>& nodes)
+void bvh_builder::optimize_bvh_for_cache(std::pmr::vector<scene_data::bvh_node>& nodes)
 {
     if (nodes.empty()) return;
-    
-    std::vector<scene_data::bvh_node> optimized_nodes;
+
+    // Temporaries share the allocator of the nodes
+    std::pmr::memory_resource* scratch = nodes.get_allocator().resource();
+    std::pmr::vector<scene_data::bvh_node> optimized_nodes(scratch);
     optimized_nodes.reserve(nodes.size());
     
     // Map of old node indices to new node indices
-    std::unordered_map<int, int> index_map;
+    std::pmr::vector<int> index_map(nodes.size(), -1, scratch);
     
-    // Traverse the BVH in breadth-first order
-    std::queue<int> queue;
-    queue.push(0);  // Root node
+    // Traverse the BVH in breadth-first order, every node is queued once so a vector can hold the queue
+    std::pmr::vector<int> queue(scratch);
+    queue.reserve(nodes.size());
+    queue.push_back(0);  // Root node
     
-    while (!queue.empty())
+    for (std::size_t head = 0; head < queue.size(); head++)
     {
-        int old_idx = queue.front();
-        queue.pop();
+        const int old_idx = queue[head];
         
         if (old_idx < 0) continue; // Skip invalid nodes
         
         // Map old index to new index
-        int new_idx = static_cast<int>(optimized_nodes.size());
+        const int new_idx = static_cast<int>(optimized_nodes.size());
         index_map[old_idx] = new_idx;
         
         // Add node to optimized list
@@ -265,8 +384,8 @@ void bvh_builder::optimize_bvh_for_cache(std::vector<scene_data::bvh_node>& node
         // Add children to queue if this is an internal node
         if (nodes[old_idx].left_child >= 0)
         {
-            queue.push(nodes[old_idx].left_child);
-            queue.push(nodes[old_idx].right_child);
+            queue.push_back(nodes[old_idx].left_child);
+            queue.push_back(nodes[old_idx].right_child);
         }
     }
     
@@ -282,4 +401,4 @@ void bvh_builder::optimize_bvh_for_cache(std::vector<scene_data::bvh_node>& node
     
     // Replace original nodes with optimized ordering
     nodes = std::move(optimized_nodes);
-}
\ No newline at end of file
+}
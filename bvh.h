@@ -1,6 +1,12 @@
 #ifndef BVH_H
 #define BVH_H
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+#include "mesh_storage.h"
 #include "scene_data.h"
+#include "scene_snapshot.h"
 #include "glm/vec3.hpp"
 
 // Maximum depth for BVH construction
@@ -10,7 +16,7 @@ constexpr auto MAX_BVH_DEPTH = 25;
 struct object_ref
 {
     int index; // Index of the object
-    int type; // Type of the object (0 = sphere, 1 = plane, 2 = triangle, 3=CSG)
+    int type; // Type of the object (0 = sphere, 1 = plane, 2 = triangle, 3=CSG, 4 = mesh)
     glm::vec3 centroid; // Centroid of the object
     glm::vec3 aabb_min; // AABB min of the object
     glm::vec3 aabb_max; // AABB max of the object
@@ -20,24 +26,43 @@ struct object_ref
 class bvh_builder
 {
 public:
-    // Builds the BVH from scene objects
-    static std::vector<scene_data::bvh_node> build_bvh(
+    // Builds the BVH from scene objects; the nodes and every temporary come from the scratch resource
+    static std::pmr::vector<scene_data::bvh_node> build_bvh(
         const std::array<scene_data::sphere_data, MAX_SPHERES>& spheres, int num_spheres,
         const std::array<scene_data::plane_data, MAX_PLANES>& planes, int num_planes,
         const std::array<scene_data::triangle_data, MAX_TRIANGLES>& triangles, int num_triangles,
-        const std::array<scene_data::csg_sphere_data, MAX_CSG_SPHERES>& csg_spheres);
+        const std::array<scene_data::csg_sphere_data, MAX_CSG_SPHERES>& csg_spheres,
+        const std::vector<mesh_storage::mesh_info>& meshes,
+        std::pmr::memory_resource* scratch = std::pmr::get_default_resource());
+
+    // Builds the BVH of a published snapshot, which can be done away from the thread editing the scene
+    static std::pmr::vector<scene_data::bvh_node> build_bvh(
+        const scene_snapshot& snapshot,
+        std::pmr::memory_resource* scratch = std::pmr::get_default_resource());
+
+    // Builds the bvh of a single mesh and reorders its triangles to match the leaves
+    static std::pmr::vector<scene_data::bvh_node> build_mesh_bvh(
+        std::span<const glm::vec3> positions,
+        std::span<glm::uvec4> triangles,
+        std::pmr::memory_resource* scratch = std::pmr::get_default_resource());
 
 private:
     // Recursive BVH building function
     static int build_bvh_recursive(
-        std::vector<scene_data::bvh_node>& nodes,
-        std::vector<object_ref>& objects,
+        std::pmr::vector<scene_data::bvh_node>& nodes,
+        std::pmr::vector<object_ref>& objects,
         int start, int end,
         int depth);
 
+    // Recursive mesh bvh building function, splitting at the centroid median
+    static int build_mesh_bvh_recursive(
+        std::pmr::vector<scene_data::bvh_node>& nodes,
+        std::pmr::vector<object_ref>& objects,
+        int start, int end);
+
     // Computes the bounding box for a range of objects
     static void compute_bounds(
-        const std::vector<object_ref>& objects,
+        const std::pmr::vector<object_ref>& objects,
         int start, int end,
         glm::vec3& out_min,
         glm::vec3& out_max);
@@ -45,8 +70,8 @@ private:
     // Calculate the surface area of a bounding box
     static float calculate_surface_area(const glm::vec3& min, const glm::vec3& max);
 
-    // Optimize BVH for cache locality
-    static void optimize_bvh_for_cache(std::vector<scene_data::bvh_node>& nodes);
+    // Reorder the nodes breadth-first for cache locality, the root stays first
+    static void optimize_bvh_for_cache(std::pmr::vector<scene_data::bvh_node>& nodes);
 };
 
 
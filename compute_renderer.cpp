@@ -1,33 +1,182 @@
 #include "compute_renderer.h"
 
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <utility>
+#include <vector>
+
+#include "memory_tracker.h"
+#include "scene_snapshot.h"
+#include "glm/common.hpp"
+
+// Queries of GL_KHR_shader_subgroup, newer than the GLEW headers
+#ifndef GL_SUBGROUP_SIZE_KHR
+#define GL_SUBGROUP_SIZE_KHR 0x9532
+#define GL_SUBGROUP_SUPPORTED_STAGES_KHR 0x9533
+#define GL_SUBGROUP_SUPPORTED_FEATURES_KHR 0x9534
+#define GL_SUBGROUP_FEATURE_BASIC_BIT_KHR 0x00000001
+#define GL_SUBGROUP_FEATURE_VOTE_BIT_KHR 0x00000002
+#define GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR 0x00000008
+#endif
+
+// Subgroup size of the compute shaders when they have the subgroup operations of the subgroup traversal, 0 otherwise
+static int probe_subgroup_size()
+{
+    GLint extension_count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+    bool extension = false;
+    for (GLint i = 0; i < extension_count && !extension; i++)
+    {
+        const auto* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        extension = name != nullptr && std::strcmp(name, "GL_KHR_shader_subgroup") == 0;
+    }
+    if (!extension)
+    {
+        return 0;
+    }
 
-void gl3::compute_renderer::create_output_texture()
+    GLint stages = 0;
+    GLint features = 0;
+    GLint size = 0;
+    glGetIntegerv(GL_SUBGROUP_SUPPORTED_STAGES_KHR, &stages);
+    glGetIntegerv(GL_SUBGROUP_SUPPORTED_FEATURES_KHR, &features);
+    glGetIntegerv(GL_SUBGROUP_SIZE_KHR, &size);
+    constexpr GLint required_features = GL_SUBGROUP_FEATURE_BASIC_BIT_KHR | GL_SUBGROUP_FEATURE_VOTE_BIT_KHR
+        | GL_SUBGROUP_FEATURE_BALLOT_BIT_KHR;
+    if ((stages & GL_COMPUTE_SHADER_BIT) == 0 || (features & required_features) != required_features)
+    {
+        return 0;
+    }
+    return size;
+}
+
+// (Re)create a texture of the window size, its content is undefined
+static void create_image_texture(GLuint& texture, const GLint internal_format, const GLenum format, const GLenum type,
+                                 const std::size_t texel_bytes, const glm::ivec2 size, const GLint filter)
 {
     // Delete the existing texture if it exists
-    if (output_texture != 0)
+    if (texture != 0)
     {
-        glDeleteTextures(1, &output_texture);
+        memory_tracker::release_texture(texture);
+        glDeleteTextures(1, &texture);
     }
 
-    // Create texture for compute shader output
-    glGenTextures(1, &output_texture);
+    glGenTextures(1, &texture);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, output_texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
 
     // Initialize with empty data
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, window_size.x, window_size.y, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, size.x, size.y, 0, format, type, nullptr);
+    memory_tracker::track_texture(texture, static_cast<std::size_t>(size.x) * size.y * texel_bytes);
 
     // Set texture parameters
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
 
     // Unbind texture
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+std::string gl3::compute_renderer::trace_defines(const bool with_short_stack, const bool with_subgroups) const
+{
+    // Traversal options of raytracer_common.glsl
+    std::string defines;
+    if (with_short_stack)
+    {
+        defines += "#define BVH_SHORT_STACK\n";
+    }
+    if (bvh_shared_levels > 0)
+    {
+        defines += "#define BVH_SHARED_LEVELS " + std::to_string(bvh_shared_levels) + "\n";
+    }
+    if (with_subgroups && subgroup_size > 0)
+    {
+        defines += "#extension GL_KHR_shader_subgroup_basic : require\n"
+            "#extension GL_KHR_shader_subgroup_vote : require\n"
+            "#extension GL_KHR_shader_subgroup_ballot : require\n"
+            "#define BVH_SUBGROUP\n";
+    }
+    return defines;
+}
+
+void gl3::compute_renderer::load_trace_shaders()
+{
+    const std::string defines = trace_defines(short_stack, subgroup_traversal);
+    compute_shader = std::make_unique<shader_class>("shaders/raytracer.comp", defines);
+    persistent_shader = std::make_unique<shader_class>("shaders/raytracer_persistent.comp", defines);
+
+    // The wavefront passes are created again when next used
+    wavefront.reset();
+    wavefront_tiles = 0;
+}
+
+void gl3::compute_renderer::create_output_texture()
+{
+    // Texture for compute shader output
+    create_image_texture(output_texture, GL_RGBA32F, GL_RGBA, GL_FLOAT, 4 * sizeof(float), render_size, GL_LINEAR);
+
+    // Images of the adaptive sampling, only read by the compute shaders
+    create_image_texture(moments_texture, GL_R32F, GL_RED, GL_FLOAT, sizeof(float), render_size, GL_NEAREST);
+    create_image_texture(sample_map_texture, GL_R8UI, GL_RED_INTEGER, GL_UNSIGNED_BYTE, 1, render_size, GL_NEAREST);
+
+    // Displayed image of the checkerboard rendering
+    create_image_texture(resolved_texture, GL_RGBA16F, GL_RGBA, GL_FLOAT, 4 * sizeof(std::uint16_t), render_size,
+                         GL_LINEAR);
+
+    // Primary hits and history of the temporal reprojection, the old history does not match the new size
+    create_image_texture(primary_hit_texture, GL_RGBA32F, GL_RGBA, GL_FLOAT, 4 * sizeof(float), render_size, GL_NEAREST);
+    create_image_texture(primary_normal_texture, GL_RGBA16F, GL_RGBA, GL_FLOAT, 4 * sizeof(std::uint16_t), render_size,
+                         GL_NEAREST);
+    for (int i = 0; i < 2; i++)
+    {
+        create_image_texture(history_color[i], GL_RGBA16F, GL_RGBA, GL_FLOAT, 4 * sizeof(std::uint16_t), render_size,
+                             GL_LINEAR);
+        create_image_texture(history_hit[i], GL_RGBA32F, GL_RGBA, GL_FLOAT, 4 * sizeof(float), render_size, GL_NEAREST);
+        create_image_texture(history_normal[i], GL_RGBA16F, GL_RGBA, GL_FLOAT, 4 * sizeof(std::uint16_t), render_size,
+                             GL_NEAREST);
+    }
+    history_valid = false;
+
+    // Albedo guide and filtered images of the denoiser
+    create_image_texture(primary_albedo_texture, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, render_size, GL_NEAREST);
+    for (GLuint& texture : denoised)
+    {
+        create_image_texture(texture, GL_RGBA16F, GL_RGBA, GL_FLOAT, 4 * sizeof(std::uint16_t), render_size, GL_LINEAR);
+    }
+
+    create_final_texture();
+}
+
+void gl3::compute_renderer::create_final_texture()
+{
+    switch (format)
+    {
+    case output_format::r11f_g11f_b10f:
+        create_image_texture(final_texture, GL_R11F_G11F_B10F, GL_RGB, GL_FLOAT, sizeof(std::uint32_t), render_size,
+                             GL_LINEAR);
+        break;
+    case output_format::rgba8:
+        create_image_texture(final_texture, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, render_size, GL_LINEAR);
+        break;
+    default:
+        create_image_texture(final_texture, GL_RGBA16F, GL_RGBA, GL_FLOAT, 4 * sizeof(std::uint16_t), render_size,
+                             GL_LINEAR);
+        break;
+    }
+
+    // Read framebuffer of the copy to the screen
+    if (final_framebuffer == 0)
+    {
+        glGenFramebuffers(1, &final_framebuffer);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, final_framebuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, final_texture, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
 void gl3::compute_renderer::create_display_quad()
 {
     // Vertex data for a quad spanning the entire screen
@@ -46,6 +195,7 @@ void gl3::compute_renderer::create_display_quad()
     glBindVertexArray(quad_vao);
     glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
     glBufferData(GL_ARRAY_BUFFER, quad_vertices.size() * sizeof(GLfloat), quad_vertices.data(), GL_STATIC_DRAW);
+    memory_tracker::track_buffer(quad_vbo, gpu_memory_category::vertex_buffer, quad_vertices.size() * sizeof(GLfloat));
 
     // Position attribute
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), nullptr);
@@ -60,11 +210,39 @@ void gl3::compute_renderer::create_display_quad()
     glBindVertexArray(0);
 }
 
-gl3::compute_renderer::compute_renderer(scene_data& scene, const int width, const int height): scene(scene), window_size(width, height)
+gl3::compute_renderer::compute_renderer(scene_data& scene, const int width, const int height): scene(scene), window_size(width, height), render_size(width, height)
 {
-    // Load the compute shader
-    compute_shader = std::make_unique<shader_class>("shaders/raytracer.comp");  
-    
+    // Subgroup operations of the device, before the tracing kernels are compiled
+    subgroup_size = probe_subgroup_size();
+    if (subgroup_size > 0)
+    {
+        std::cout << "Subgroup size: " << subgroup_size << std::endl;
+    }
+    else
+    {
+        std::cout << "Subgroup operations not supported, the BVH traversal stays scalar" << std::endl;
+    }
+
+    // Load the compute shaders
+    load_trace_shaders();
+    adaptive_shader = std::make_unique<shader_class>("shaders/adaptive_sampling.comp");
+    checkerboard_shader = std::make_unique<shader_class>("shaders/checkerboard_resolve.comp");
+    temporal_shader = std::make_unique<shader_class>("shaders/temporal_reprojection.comp");
+    denoise_shader = std::make_unique<shader_class>("shaders/denoise.comp");
+    output_shader = std::make_unique<shader_class>("shaders/output.comp");
+
+    // Work counter of the persistent threads, cleared before every dispatch
+    glGenBuffers(1, &work_counter_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, work_counter_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+    memory_tracker::track_buffer(work_counter_buffer, gpu_memory_category::storage_buffer, sizeof(GLuint));
+
+    // Noisy pixel count of the adaptive sampling, cleared before every allocation pass
+    glGenBuffers(1, &adaptive_stats_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, adaptive_stats_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+    memory_tracker::track_buffer(adaptive_stats_buffer, gpu_memory_category::storage_buffer, sizeof(GLuint));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
     // Load the display shader
     display_shader = std::make_unique<shader_class>("shaders/display.vert", "shaders/display.frag");
@@ -101,9 +279,22 @@ gl3::compute_renderer::compute_renderer(scene_data& scene, const int width, cons
 
 gl3::compute_renderer::~compute_renderer()
 {
-    if (output_texture != 0)
+    for (const GLuint texture : {
+             output_texture, moments_texture, sample_map_texture, resolved_texture, primary_hit_texture,
+             primary_normal_texture, history_color[0], history_color[1], history_hit[0], history_hit[1],
+             history_normal[0], history_normal[1], primary_albedo_texture, denoised[0], denoised[1],
+             final_texture
+         })
+    {
+        if (texture != 0)
+        {
+            memory_tracker::release_texture(texture);
+            glDeleteTextures(1, &texture);
+        }
+    }
+    if (final_framebuffer != 0)
     {
-        glDeleteTextures(1, &output_texture);
+        glDeleteFramebuffers(1, &final_framebuffer);
     }
     if (quad_vao != 0)
     {
@@ -111,47 +302,614 @@ gl3::compute_renderer::~compute_renderer()
     }
     if (quad_vbo != 0)
     {
+        memory_tracker::release_buffer(quad_vbo);
         glDeleteBuffers(1, &quad_vbo);
     }
+    if (work_counter_buffer != 0)
+    {
+        memory_tracker::release_buffer(work_counter_buffer);
+        glDeleteBuffers(1, &work_counter_buffer);
+    }
+    if (adaptive_stats_buffer != 0)
+    {
+        memory_tracker::release_buffer(adaptive_stats_buffer);
+        glDeleteBuffers(1, &adaptive_stats_buffer);
+    }
 }
 
 void gl3::compute_renderer::resize(const int width, const int height)
 {
+    // Resize events repeat the same size, e.g. while the window is minimized or restored
+    if (window_size == glm::ivec2(width, height))
+    {
+        return;
+    }
     window_size = {width, height};
 
-    // Update the output texture dimensions
+    // Keep the current scale for the new window
+    const glm::vec2 scaled = glm::vec2(window_size) * render_scale;
+    set_render_size(glm::max(glm::ivec2(glm::round(scaled)), glm::ivec2(1)));
+}
+
+void gl3::compute_renderer::set_render_size(const glm::ivec2 size)
+{
+    if (size == render_size)
+    {
+        return;
+    }
+    render_size = size;
+
+    // Update the output texture dimensions, its content is lost
     create_output_texture();
+    reset_accumulation();
+    next_tile = 0;
+    rescaled = true;
 }
 
-void gl3::compute_renderer::render() const
+void gl3::compute_renderer::update_render_scale()
 {
-    // Update the UBOs with current scene data
+    float scale = render_scale;
+    if (!dynamic_resolution || static_frames >= RENDER_SCALE_SETTLE_FRAMES)
+    {
+        // A still view converges at the full resolution, the frame budget keeps it interactive
+        scale = 1.0f;
+    }
+    else if (const double tile_ms = tile_milliseconds[static_cast<int>(mode)]; static_frames == 0 && tile_ms > 0.0)
+    {
+        // The traced pixels, hence the square of the scale, follow the ratio of the target to the time of a pass
+        const double pass_ms = tile_ms * get_tile_count();
+        const float wanted = render_scale * static_cast<float>(std::sqrt(target_frame_ms / pass_ms));
+        scale = std::clamp(render_scale + (wanted - render_scale) * 0.5f, MIN_RENDER_SCALE, 1.0f);
+        scale = std::round(scale / RENDER_SCALE_STEP) * RENDER_SCALE_STEP;
+    }
+    if (scale == render_scale)
+    {
+        return;
+    }
+
+    render_scale = scale;
+    const glm::vec2 scaled = glm::vec2(window_size) * render_scale;
+    set_render_size(glm::max(glm::ivec2(glm::round(scaled)), glm::ivec2(1)));
+}
+
+void gl3::compute_renderer::render()
+{
+    // Average GPU time of a tile in each mode, from the frames the GPU finished since the last call
+    for (int i = 0; i < static_cast<int>(trace_mode::count); i++)
+    {
+        while (const std::optional<gpu_timer::sample> sample = timers[i].poll())
+        {
+            if (sample->work == 0)
+                continue;
+            const double milliseconds = sample->milliseconds / sample->work;
+            tile_milliseconds[i] = tile_milliseconds[i] > 0.0
+                                       ? tile_milliseconds[i] * 0.8 + milliseconds * 0.2
+                                       : milliseconds;
+        }
+    }
+    update_render_scale();
+
+    // Update the UBOs with current scene data. The rays are traced at the render size, the camera of the scene
+    // keeps the window size for the fragment renderer.
+    scene_data::camera_data& camera = scene.get_camera();
+    camera.window_size = glm::vec2(render_size);
     scene.update_UBOs();
+    camera.window_size = glm::vec2(window_size);
 
-    // Bind the compute shader
-    compute_shader->activate();
+    // Any change of the camera, objects or lighting publishes a new version and restarts the accumulation. The
+    // sweep goes on from the current tile, so a moving camera still refreshes every tile in turn.
+    if (const std::uint64_t version = scene.snapshot()->version; version != accumulated_version)
+    {
+        accumulated_version = version;
+        reset_accumulation();
 
-    // Bind the output texture
-    glBindImageTexture(0, output_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+        // A new render size changes the camera too, without the view moving
+        if (!rescaled)
+            static_frames = 0;
+        rescaled = false;
+    }
+    else
+    {
+        static_frames = std::min(static_frames + 1, RENDER_SCALE_SETTLE_FRAMES);
+    }
 
-    // Dispatch the compute shader
-    constexpr glm::ivec2 work_group_size = {16, 16};
+    // Bind the output texture, read back to blend with the previous frames, the images of the adaptive sampling and
+    // the primary hits, also read by the post passes
+    glBindImageTexture(0, output_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glBindImageTexture(1, moments_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+    glBindImageTexture(2, sample_map_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R8UI);
+    glBindImageTexture(PRIMARY_HIT_IMAGE_UNIT, primary_hit_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glBindImageTexture(PRIMARY_NORMAL_IMAGE_UNIT, primary_normal_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16F);
+    glBindImageTexture(PRIMARY_ALBEDO_IMAGE_UNIT, primary_albedo_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+
+    trace();
+
+    // Post passes, each one reads the image of the previous one. They also run on a converged image, so their
+    // settings apply at once.
+    GLuint image = output_texture;
+    if (checkerboard != checkerboard_mode::off)
+    {
+        resolve_checkerboard();
+        image = resolved_texture;
+    }
+    if (temporal)
+    {
+        image = reproject_temporal(image);
+    }
+    if (denoise)
+    {
+        image = denoise_image(image);
+    }
+    write_output(image);
 
-    // Calculate the number of work groups to cover the entire texture
-    const glm::ivec2 num_groups = (window_size + work_group_size - 1) / work_group_size;
+    shader_class::deactivate();
+}
 
-    // Dispatch the compute shader
-    glDispatchCompute(num_groups.x, num_groups.y, 1);
+void gl3::compute_renderer::trace()
+{
+    // A static view that converged keeps its image without tracing anything
+    last_frame_tiles = 0;
+    if (accumulate && tiles_in_pass == 0 && accumulated_frames >= max_accumulated_frames)
+    {
+        return;
+    }
+
+    // Trace the tiles that fit in the budget, at least one so the image always progresses. A frame stops at the end
+    // of a pass, as the next pass reads what this one wrote.
+    const glm::ivec2 grid = tile_grid();
+    const int tile_count = grid.x * grid.y;
+    if (tile_count == 0)
+    {
+        return;
+    }
+    const double milliseconds_per_tile = tile_milliseconds[static_cast<int>(mode)];
+    int tiles = tile_count - tiles_in_pass;
+    if (frame_budget_ms > 0.0f)
+    {
+        const int affordable = milliseconds_per_tile > 0.0 ? static_cast<int>(frame_budget_ms / milliseconds_per_tile) : 1;
+        tiles = std::clamp(affordable, 1, tiles);
+    }
+
+    // The samples of every pixel are chosen once per pass, from the error of the passes before. Only the first pass
+    // of a view is a checkerboard, the next ones trace every pixel.
+    if (tiles_in_pass == 0)
+    {
+        pass_checkerboard = accumulated_frames == 0 ? checkerboard : checkerboard_mode::off;
+        checkerboard_phase++;
+        allocate_samples();
+    }
+
+    gpu_timer& timer = timers[static_cast<int>(mode)];
+    const bool timed = timer.begin();
+    if (mode == trace_mode::wavefront)
+    {
+        if (!wavefront)
+        {
+            wavefront = std::make_unique<wavefront_renderer>(trace_defines(short_stack, subgroup_traversal));
+        }
+
+        // Statistics of the tiles of the previous frames, copied aside and read back once the GPU has finished them
+        if (wavefront_tiles > 0 && wavefront->request_statistics(static_cast<unsigned>(wavefront_tiles)))
+        {
+            wavefront_tiles = 0;
+        }
+        while (const std::optional<wavefront_renderer::ray_statistics> statistics = wavefront->poll_statistics())
+        {
+            const double tile_ms = tile_milliseconds[static_cast<int>(trace_mode::wavefront)];
+            const unsigned rays = statistics->extended_rays + statistics->shadow_rays;
+            if (rays > 0 && tile_ms > 0.0)
+            {
+                rays_per_second = rays / (statistics->tiles * tile_ms) * 1000.0;
+                ray_divergence = static_cast<double>(statistics->bin_changes) / std::max(statistics->extended_rays, 1u);
+            }
+            dropped_rays = statistics->dropped_rays;
+        }
+        wavefront->set_ray_binning(ray_binning);
+
+        const scene_data::lighting_data& lighting = scene.get_lighting();
+        for (int i = 0; i < tiles; i++)
+        {
+            const glm::ivec2 offset = glm::ivec2(next_tile % grid.x, next_tile / grid.x) * RENDER_TILE_SIZE;
+            const glm::ivec2 size = glm::min(glm::ivec2(RENDER_TILE_SIZE), render_size - offset);
+            wavefront->trace_tile(offset, size, accumulated_frames, lighting.sample_rate, lighting.recursion_depth);
+            next_tile = (next_tile + 1) % tile_count;
+        }
+        wavefront_tiles += tiles;
+    }
+    else if (mode == trace_mode::persistent)
+    {
+        // Every tile of the frame in a single dispatch, sized for the device rather than for the pixels
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, work_counter_buffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PERSISTENT_WORK_BINDING, work_counter_buffer);
+
+        persistent_shader->activate();
+        const GLuint id = persistent_shader->id;
+        glUniform1ui(glGetUniformLocation(id, "accumulated_frames"), accumulated_frames);
+        glUniform1i(glGetUniformLocation(id, "first_tile"), next_tile);
+        glUniform1i(glGetUniformLocation(id, "tile_count"), tiles);
+        glUniform2i(glGetUniformLocation(id, "tile_grid"), grid.x, grid.y);
+        glUniform1i(glGetUniformLocation(id, "tile_extent"), RENDER_TILE_SIZE);
+        set_checkerboard_uniforms(*persistent_shader);
+
+        // No more threads than traced pixels, small windows would only spin on the counter
+        const std::size_t pixels = static_cast<std::size_t>(tiles) * RENDER_TILE_SIZE * RENDER_TILE_SIZE
+            / (pass_checkerboard == checkerboard_mode::quarter ? 4 : pass_checkerboard == checkerboard_mode::half ? 2 : 1);
+        const auto needed_groups = static_cast<int>((pixels + PERSISTENT_GROUP_SIZE - 1) / PERSISTENT_GROUP_SIZE);
+        glDispatchCompute(std::min(persistent_work_groups, needed_groups), 1, 1);
+        next_tile = (next_tile + tiles) % tile_count;
+    }
+    else
+    {
+        // Bind the compute shader
+        compute_shader->activate();
+        glUniform1ui(glGetUniformLocation(compute_shader->id, "accumulated_frames"), accumulated_frames);
+        glUniform1i(glGetUniformLocation(compute_shader->id, "tile_frustum"), tile_frustum);
+        const GLint tile_offset_location = glGetUniformLocation(compute_shader->id, "tile_offset");
+        set_checkerboard_uniforms(*compute_shader);
+
+        // Dispatch the compute shader, the threads of a checkerboard pass only cover the traced pixels
+        constexpr glm::ivec2 work_group_size = {16, 16};
+        const glm::ivec2 pixels_per_thread = pass_checkerboard == checkerboard_mode::quarter
+                                                 ? glm::ivec2(2, 2)
+                                                 : pass_checkerboard == checkerboard_mode::half
+                                                 ? glm::ivec2(2, 1)
+                                                 : glm::ivec2(1, 1);
+        for (int i = 0; i < tiles; i++)
+        {
+            // Calculate the number of work groups to cover the tile, clipped by the window
+            const glm::ivec2 offset = glm::ivec2(next_tile % grid.x, next_tile / grid.x) * RENDER_TILE_SIZE;
+            const glm::ivec2 size = glm::min(glm::ivec2(RENDER_TILE_SIZE), render_size - offset);
+            const glm::ivec2 threads = (size + pixels_per_thread - 1) / pixels_per_thread;
+            const glm::ivec2 num_groups = (threads + work_group_size - 1) / work_group_size;
+
+            glUniform2i(tile_offset_location, offset.x, offset.y);
+            glDispatchCompute(num_groups.x, num_groups.y, 1);
+            next_tile = (next_tile + 1) % tile_count;
+        }
+    }
+    if (timed)
+        timer.end(tiles);
+    last_frame_tiles = tiles;
 
     // Wait for the compute shader to finish
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
 
     // Unbind the compute shader
     shader_class::deactivate();
+
+    // Every tile has one more sample once the pass is complete
+    tiles_in_pass += tiles;
+    if (tiles_in_pass == tile_count)
+    {
+        tiles_in_pass = 0;
+        if (accumulate)
+            accumulated_frames++;
+    }
+}
+
+void gl3::compute_renderer::allocate_samples()
+{
+    // Noisy pixels counted by the previous allocation pass, trusted once enough frames were accumulated. The GPU
+    // finished that pass before the tiles that followed it, so the read back rarely waits.
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, adaptive_stats_buffer);
+    if (accumulated_frames > ADAPTIVE_MIN_FRAMES)
+    {
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &noisy_pixels);
+        if (noisy_pixels == 0 && converged_seconds < 0.0)
+        {
+            const auto elapsed = std::chrono::steady_clock::now() - accumulation_start;
+            converged_seconds = std::chrono::duration<double>(elapsed).count();
+        }
+    }
+    else
+    {
+        noisy_pixels = static_cast<unsigned>(render_size.x * render_size.y);
+    }
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ADAPTIVE_STATS_BINDING, adaptive_stats_buffer);
+
+    adaptive_shader->activate();
+    const GLuint id = adaptive_shader->id;
+    glUniform1ui(glGetUniformLocation(id, "accumulated_frames"), accumulated_frames);
+    glUniform1i(glGetUniformLocation(id, "adaptive_sampling"), adaptive);
+    glUniform1f(glGetUniformLocation(id, "error_threshold"), adaptive_threshold);
+    glUniform1ui(glGetUniformLocation(id, "min_frames"), ADAPTIVE_MIN_FRAMES);
+    set_checkerboard_uniforms(*adaptive_shader);
+
+    constexpr glm::ivec2 work_group_size = {16, 16};
+    const glm::ivec2 num_groups = (render_size + work_group_size - 1) / work_group_size;
+    glDispatchCompute(num_groups.x, num_groups.y, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+void gl3::compute_renderer::set_checkerboard_uniforms(const shader_class& shader) const
+{
+    glUniform1i(glGetUniformLocation(shader.id, "checkerboard_pattern"), static_cast<int>(pass_checkerboard));
+    glUniform1ui(glGetUniformLocation(shader.id, "checkerboard_phase"), checkerboard_phase);
+}
+
+void gl3::compute_renderer::resolve_checkerboard() const
+{
+    glBindImageTexture(POST_OUTPUT_IMAGE_UNIT, resolved_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    checkerboard_shader->activate();
+
+    constexpr glm::ivec2 work_group_size = {16, 16};
+    const glm::ivec2 num_groups = (render_size + work_group_size - 1) / work_group_size;
+    glDispatchCompute(num_groups.x, num_groups.y, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+GLuint gl3::compute_renderer::reproject_temporal(const GLuint color)
+{
+    // The history follows the camera only, any other edit changes the shading of the surfaces it holds
+    const std::shared_ptr<const scene_snapshot> snapshot = scene.snapshot();
+    const bool valid = history_valid && history_snapshot && snapshot->same_content(*history_snapshot);
+    const int read = history_index;
+    const int write = 1 - history_index;
+
+    temporal_shader->activate();
+    const GLuint id = temporal_shader->id;
+    const std::array<std::pair<const char*, GLuint>, 4> inputs = {
+        {
+            {"current_color", color}, {"history_color", history_color[read]}, {"history_hit", history_hit[read]},
+            {"history_normal", history_normal[read]}
+        }
+    };
+    for (int unit = 0; unit < static_cast<int>(inputs.size()); unit++)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, inputs[unit].second);
+        glUniform1i(glGetUniformLocation(id, inputs[unit].first), unit);
+    }
+
+    const scene_data::camera_data& previous = valid ? *history_snapshot->camera : *snapshot->camera;
+    glUniform1i(glGetUniformLocation(id, "history_valid"), valid);
+    glUniform3fv(glGetUniformLocation(id, "history_camera_position"), 1, &previous.position.x);
+    glUniform3fv(glGetUniformLocation(id, "history_camera_target"), 1, &previous.target.x);
+    glUniform1f(glGetUniformLocation(id, "history_camera_fov"), previous.fov);
+
+    // Only the tiles traced this frame have fresh primary hits, they end right before next_tile
+    const glm::ivec2 grid = tile_grid();
+    const int tile_count = std::max(grid.x * grid.y, 1);
+    glUniform1i(glGetUniformLocation(id, "first_tile"), (next_tile - last_frame_tiles + tile_count) % tile_count);
+    glUniform1i(glGetUniformLocation(id, "tile_count"), last_frame_tiles);
+    glUniform2i(glGetUniformLocation(id, "tile_grid"), grid.x, grid.y);
+    glUniform1i(glGetUniformLocation(id, "tile_extent"), RENDER_TILE_SIZE);
+
+    glBindImageTexture(POST_OUTPUT_IMAGE_UNIT, history_color[write], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+    constexpr glm::ivec2 work_group_size = {16, 16};
+    const glm::ivec2 num_groups = (render_size + work_group_size - 1) / work_group_size;
+    glDispatchCompute(num_groups.x, num_groups.y, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    for (int unit = 0; unit < static_cast<int>(inputs.size()); unit++)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    // The primary hits of this frame go with its color
+    glCopyImageSubData(primary_hit_texture, GL_TEXTURE_2D, 0, 0, 0, 0, history_hit[write], GL_TEXTURE_2D, 0, 0, 0, 0,
+                       render_size.x, render_size.y, 1);
+    glCopyImageSubData(primary_normal_texture, GL_TEXTURE_2D, 0, 0, 0, 0, history_normal[write], GL_TEXTURE_2D, 0, 0, 0,
+                       0, render_size.x, render_size.y, 1);
+
+    history_index = write;
+    history_valid = true;
+    history_snapshot = snapshot;
+    return history_color[write];
+}
+
+GLuint gl3::compute_renderer::denoise_image(const GLuint color)
+{
+    denoise_shader->activate();
+    const GLuint id = denoise_shader->id;
+    glUniform1i(glGetUniformLocation(id, "input_color"), 0);
+    glUniform1i(glGetUniformLocation(id, "source_color"), 1);
+    glUniform1f(glGetUniformLocation(id, "sigma_normal"), sigma_normal);
+    glUniform1f(glGetUniformLocation(id, "sigma_depth"), sigma_depth);
+    glUniform1f(glGetUniformLocation(id, "sigma_luminance"), sigma_luminance);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, color);
+
+    // Every iteration doubles the spacing of the taps, reading the image written by the previous one
+    constexpr glm::ivec2 work_group_size = {16, 16};
+    const glm::ivec2 num_groups = (render_size + work_group_size - 1) / work_group_size;
+    GLuint input = color;
+    for (int i = 0; i < denoise_iterations; i++)
+    {
+        const GLuint output = denoised[i % 2];
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, input);
+        glBindImageTexture(POST_OUTPUT_IMAGE_UNIT, output, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        glUniform1i(glGetUniformLocation(id, "step_size"), 1 << i);
+        glUniform1i(glGetUniformLocation(id, "first_iteration"), i == 0);
+        glUniform1i(glGetUniformLocation(id, "last_iteration"), i == denoise_iterations - 1);
+
+        glDispatchCompute(num_groups.x, num_groups.y, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        input = output;
+    }
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return input;
+}
+
+void gl3::compute_renderer::write_output(const GLuint color) const
+{
+    output_shader->activate();
+    const GLuint id = output_shader->id;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, color);
+    glUniform1i(glGetUniformLocation(id, "presented_color"), 0);
+    glUniform1i(glGetUniformLocation(id, "quantize"), format == output_format::rgba8);
+    set_tone_mapping_uniforms(*output_shader);
+
+    // Sample heatmap, scaled by the count of a pixel that got the most samples in every pass
+    const unsigned samples_per_pass = adaptive ? ADAPTIVE_MAX_SAMPLES : 1;
+    glUniform1i(glGetUniformLocation(id, "show_sample_heatmap"), show_sample_heatmap);
+    glUniform1f(glGetUniformLocation(id, "heatmap_max_samples"),
+                static_cast<float>(std::max(accumulated_frames, 1u) * samples_per_pass));
+
+    const GLenum image_format = format == output_format::rgba8
+                                    ? GL_RGBA8
+                                    : format == output_format::r11f_g11f_b10f
+                                    ? GL_R11F_G11F_B10F
+                                    : GL_RGBA16F;
+    glBindImageTexture(POST_OUTPUT_IMAGE_UNIT, final_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, image_format);
+
+    constexpr glm::ivec2 work_group_size = {16, 16};
+    const glm::ivec2 num_groups = (render_size + work_group_size - 1) / work_group_size;
+    glDispatchCompute(num_groups.x, num_groups.y, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void gl3::compute_renderer::set_tone_mapping_uniforms(const shader_class& shader) const
+{
+    glUniform1i(glGetUniformLocation(shader.id, "tone_mapping"), tone_mapping);
+    glUniform1f(glGetUniformLocation(shader.id, "exposure"), exposure);
+}
+
+void gl3::compute_renderer::set_output_format(const output_format new_format)
+{
+    if (new_format == format)
+    {
+        return;
+    }
+    format = new_format;
+    create_final_texture();
+}
+
+void gl3::compute_renderer::reset_accumulation()
+{
+    accumulated_frames = 0;
+    tiles_in_pass = 0;
+    accumulation_start = std::chrono::steady_clock::now();
+    converged_seconds = -1.0;
+}
+
+void gl3::compute_renderer::set_short_stack_traversal(const bool enabled)
+{
+    if (enabled == short_stack)
+    {
+        return;
+    }
+    short_stack = enabled;
+    load_trace_shaders();
+
+    // The GPU times measured with the other traversal no longer apply, so both can be compared
+    tile_milliseconds.fill(0.0);
+}
+
+void gl3::compute_renderer::set_bvh_shared_levels(const int levels)
+{
+    const int clamped = std::clamp(levels, 0, MAX_BVH_SHARED_LEVELS);
+    if (clamped == bvh_shared_levels)
+    {
+        return;
+    }
+    bvh_shared_levels = clamped;
+    load_trace_shaders();
+    tile_milliseconds.fill(0.0);
+}
+
+void gl3::compute_renderer::set_subgroup_traversal(const bool enabled)
+{
+    // Without the extension the scalar traversal is the only one
+    const bool available = enabled && subgroup_size > 0;
+    if (available == subgroup_traversal)
+    {
+        return;
+    }
+    subgroup_traversal = available;
+    load_trace_shaders();
+    tile_milliseconds.fill(0.0);
+}
+
+int gl3::compute_renderer::check_subgroup_traversal()
+{
+    if (subgroup_size == 0)
+    {
+        return -1;
+    }
+
+    // Hits of every pixel with the scalar and with the subgroup traversal, both with the short stack whose restarts
+    // must follow the path of the first descent
+    const std::size_t pixels = static_cast<std::size_t>(render_size.x) * render_size.y;
+    const auto bytes = static_cast<GLsizeiptr>(pixels * sizeof(glm::vec4));
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, nullptr, GL_DYNAMIC_READ);
+    memory_tracker::track_buffer(buffer, gpu_memory_category::storage_buffer, bytes);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TRAVERSAL_CHECK_BINDING, buffer);
+
+    constexpr glm::ivec2 work_group_size = {16, 16};
+    const glm::ivec2 num_groups = (render_size + work_group_size - 1) / work_group_size;
+    std::array<std::vector<glm::vec4>, 2> hits;
+    for (int i = 0; i < 2; i++)
+    {
+        const shader_class check_shader("shaders/traversal_check.comp", trace_defines(true, i == 1));
+        check_shader.activate();
+        glDispatchCompute(num_groups.x, num_groups.y, 1);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        hits[i].resize(pixels);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, hits[i].data());
+    }
+    shader_class::deactivate();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    memory_tracker::release_buffer(buffer);
+    glDeleteBuffers(1, &buffer);
+
+    // Both builds run the same intersection code, only the object or a rounding of the distance may differ
+    const auto same_hit = [](const float dist, const float object, const float other_dist, const float other_object)
+    {
+        return object == other_object && std::abs(dist - other_dist) <= 1e-4f * std::max(1.0f, std::abs(dist));
+    };
+    int mismatches = 0;
+    for (std::size_t i = 0; i < pixels; i++)
+    {
+        const glm::vec4& scalar = hits[0][i];
+        const glm::vec4& subgroup = hits[1][i];
+        if (!same_hit(scalar.x, scalar.y, subgroup.x, subgroup.y) || !same_hit(scalar.z, scalar.w, subgroup.z, subgroup.w))
+        {
+            mismatches++;
+        }
+    }
+    std::cout << "Subgroup traversal check: " << mismatches << " of " << pixels << " pixels differ" << std::endl;
+    subgroup_mismatches = mismatches;
+    return mismatches;
+}
+
+void gl3::compute_renderer::set_trace_mode(const trace_mode new_mode)
+{
+    // Every mode estimates the same image, the accumulation goes on
+    mode = new_mode;
 }
 
 void gl3::compute_renderer::display() const
 {
+    // A tone mapped image of the window size only needs a copy
+    if (format == output_format::rgba8 && render_size == window_size)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, final_framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, render_size.x, render_size.y, 0, 0, window_size.x, window_size.y, GL_COLOR_BUFFER_BIT,
+                          GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        return;
+    }
+
     // Clear screen
     glClear(GL_COLOR_BUFFER_BIT);
 
@@ -160,9 +918,16 @@ void gl3::compute_renderer::display() const
 
     // Bind the texture
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, output_texture);
+    glBindTexture(GL_TEXTURE_2D, final_texture);
     glUniform1i(glGetUniformLocation(display_shader->id, "rendered_texture"), 0);
 
+    // Edge-aware upscaling of a render smaller than the window
+    glUniform1i(glGetUniformLocation(display_shader->id, "upscale"), render_size != window_size);
+
+    // Tone mapping, unless the output pass did it already
+    glUniform1i(glGetUniformLocation(display_shader->id, "tone_mapped"), format == output_format::rgba8);
+    set_tone_mapping_uniforms(*display_shader);
+
     // Draw quad
     glBindVertexArray(quad_vao);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
@@ -1,21 +1,192 @@
 #ifndef COMPUTE_RENDERER_H
 #define COMPUTE_RENDERER_H
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <string>
 
+#include "gpu_timer.h"
 #include "scene_data.h"
 #include "shader_class.h"
+#include "wavefront_renderer.h"
 
 
+// Default number of frames averaged before a static view stops rendering
+constexpr unsigned MAX_ACCUMULATED_FRAMES = 4096;
+
+// Width and height of the tiles the image is dispatched in, a multiple of the work group size
+constexpr int RENDER_TILE_SIZE = 128;
+
+// Default GPU time given to the ray tracing of a frame, 0 for no limit
+constexpr float DEFAULT_FRAME_BUDGET_MS = 12.0f;
+
+// Dynamic resolution: the image is traced at a fraction of the window size that keeps a pass under the target time
+constexpr float DEFAULT_TARGET_FRAME_MS = 16.6f;
+constexpr float MIN_RENDER_SCALE = 0.25f;
+constexpr float RENDER_SCALE_STEP = 0.05f; // Scales are rounded to it, so small corrections keep the textures
+constexpr int RENDER_SCALE_SETTLE_FRAMES = 10; // Frames without motion before the full resolution comes back
+
+// Adaptive sampling: pixels whose relative error is below the threshold stop getting samples
+constexpr float DEFAULT_ADAPTIVE_THRESHOLD = 0.02f;
+constexpr unsigned ADAPTIVE_MIN_FRAMES = 8; // Frames before the variance of a pixel is trusted
+constexpr unsigned ADAPTIVE_MAX_SAMPLES = 4; // Most samples a pixel gets in a pass, as in adaptive_sampling.comp
+constexpr int ADAPTIVE_STATS_BINDING = 14;
+
+// Image units of the primary hits, written by the tracers for the temporal reprojection and the denoiser
+constexpr int PRIMARY_ALBEDO_IMAGE_UNIT = 3;
+constexpr int PRIMARY_HIT_IMAGE_UNIT = 4;
+constexpr int PRIMARY_NORMAL_IMAGE_UNIT = 5;
+
+// Image unit of the output of the post passes; 8 units is all some drivers offer
+constexpr int POST_OUTPUT_IMAGE_UNIT = 6;
+
+// Denoiser: a-trous iterations, the taps of the last one are 2^(n-1) pixels apart
+constexpr int DEFAULT_DENOISE_ITERATIONS = 4;
+constexpr int MAX_DENOISE_ITERATIONS = 6;
+
+// Exposure of the tone mapping, applied by the output pass or the display pass
+constexpr float DEFAULT_EXPOSURE = 1.0f;
+
+// Deepest level of the BVH cached in shared memory by the tracing kernels, 255 nodes of 48 bytes
+constexpr int MAX_BVH_SHARED_LEVELS = 8;
+
+// Hits written by the traversal check
+constexpr int TRAVERSAL_CHECK_BINDING = 17;
+
+// Work counter of the persistent threads kernel
+constexpr int PERSISTENT_WORK_BINDING = 13;
+constexpr int PERSISTENT_GROUP_SIZE = 64;
+
+// Work groups launched by the persistent threads kernel, enough to keep every compute unit of a desktop GPU busy
+constexpr int DEFAULT_PERSISTENT_WORK_GROUPS = 512;
+
+struct scene_snapshot;
+
 namespace gl3
 {
+    // How the compute renderer traces the rays of a tile
+    enum class trace_mode : int
+    {
+        megakernel = 0, // One invocation follows every ray of a pixel
+        wavefront = 1, // Separate passes exchange rays through queues
+        persistent = 2, // A fixed set of threads pulls pixels from a global counter
+        count
+    };
+
+    // Pixels traced by the first pass after the view changes, the others are reconstructed
+    enum class checkerboard_mode : int
+    {
+        off = 0,
+        half = 1, // Checkerboard alternating every pass
+        quarter = 2, // One pixel of every 2x2 block, rotating every pass
+        count
+    };
+
+    // Format of the image the display pass reads, smaller formats cost less bandwidth every frame
+    enum class output_format : int
+    {
+        rgba16f = 0, // 8 bytes per pixel
+        r11f_g11f_b10f = 1, // 4 bytes per pixel, no alpha
+        rgba8 = 2, // 4 bytes per pixel, tone mapped by the output pass and copied to the screen
+        count
+    };
+
     class compute_renderer
     {
         // Compute shader for ray tracing
         std::unique_ptr<shader_class> compute_shader;
 
+        // BVH traversal of the tracing kernels: a full stack per invocation, or a short stack with a restart trail,
+        // and the top levels of the tree cached in shared memory, 0 for none
+        bool short_stack = false;
+        int bvh_shared_levels = 0;
+
+        // Subgroup size found by the capability probe, 0 without GL_KHR_shader_subgroup, and whether the subgroups
+        // traverse the BVH together
+        int subgroup_size = 0;
+        bool subgroup_traversal = false;
+        int subgroup_mismatches = -1; // Result of the last traversal check, -1 before the first one
+
+        // Primary rays of the megakernel tested against the BVH leaves in the frustum of their work group
+        bool tile_frustum = false;
+
+        // Wavefront passes, created the first time they are used
+        std::unique_ptr<wavefront_renderer> wavefront;
+        trace_mode mode = trace_mode::megakernel;
+
+        // Ray binning of the wavefront passes, with the rays traced per second and the share of rays in another bin
+        // than their neighbour, measured on the tiles traced since the last read back, and the rays lost to a full
+        // queue
+        bool ray_binning = true;
+        int wavefront_tiles = 0;
+        double rays_per_second = 0.0;
+        double ray_divergence = 0.0;
+        unsigned dropped_rays = 0;
+
+        // Persistent threads kernel and its work counter
+        std::unique_ptr<shader_class> persistent_shader;
+        GLuint work_counter_buffer{};
+        int persistent_work_groups = DEFAULT_PERSISTENT_WORK_GROUPS;
+
         // Texture to store the rendered image
         GLuint output_texture{};
 
+        // Adaptive sampling: second moment of every pixel, samples of every pixel in the current pass, and the
+        // allocation pass that fills them
+        GLuint moments_texture{};
+        GLuint sample_map_texture{};
+        std::unique_ptr<shader_class> adaptive_shader;
+        GLuint adaptive_stats_buffer{};
+        bool adaptive = true;
+        float adaptive_threshold = DEFAULT_ADAPTIVE_THRESHOLD;
+        bool show_sample_heatmap = false;
+
+        // Checkerboard rendering: the pattern of the current pass, and the resolve pass that fills the skipped pixels
+        // into the displayed image
+        checkerboard_mode checkerboard = checkerboard_mode::off;
+        checkerboard_mode pass_checkerboard = checkerboard_mode::off;
+        unsigned checkerboard_phase = 0;
+        std::unique_ptr<shader_class> checkerboard_shader;
+        GLuint resolved_texture{};
+
+        // Temporal reprojection: primary hits written by the tracer, and two sets of history, one read and one
+        // written by every frame
+        GLuint primary_hit_texture{};
+        GLuint primary_normal_texture{};
+        std::array<GLuint, 2> history_color{};
+        std::array<GLuint, 2> history_hit{};
+        std::array<GLuint, 2> history_normal{};
+        int history_index = 0; // Set read by the next reprojection
+        bool temporal = true;
+        bool history_valid = false;
+        std::shared_ptr<const scene_snapshot> history_snapshot; // Scene the history was rendered from
+        std::unique_ptr<shader_class> temporal_shader;
+
+        // Denoiser, filtering back and forth between two images
+        GLuint primary_albedo_texture{};
+        std::array<GLuint, 2> denoised{};
+        std::unique_ptr<shader_class> denoise_shader;
+        bool denoise = true;
+        int denoise_iterations = DEFAULT_DENOISE_ITERATIONS;
+        float sigma_normal = 128.0f;
+        float sigma_depth = 1.0f;
+        float sigma_luminance = 4.0f;
+
+        // Image shown by display, written by the output pass in a compact format, with the framebuffer that copies
+        // it to the screen once tone mapped
+        GLuint final_texture{};
+        GLuint final_framebuffer{};
+        std::unique_ptr<shader_class> output_shader;
+        output_format format = output_format::rgba16f;
+        bool tone_mapping = false;
+        float exposure = DEFAULT_EXPOSURE;
+
+        // Convergence of the current accumulation, measured with every pixel's error against the threshold
+        unsigned noisy_pixels = 0;
+        std::chrono::steady_clock::time_point accumulation_start = std::chrono::steady_clock::now();
+        double converged_seconds = -1.0; // Negative until every pixel is below the threshold
+
         // Quad for displaying the rendered image
         GLuint quad_vao{};
         GLuint quad_vbo{};
@@ -29,9 +200,68 @@ namespace gl3
         // Window properties
         glm::ivec2 window_size;
 
-        // Create texture for a rendered output
+        // Dynamic resolution: size of the traced image, scaled down from the window while the view moves
+        glm::ivec2 render_size;
+        bool dynamic_resolution = true;
+        float target_frame_ms = DEFAULT_TARGET_FRAME_MS;
+        float render_scale = 1.0f;
+        int static_frames = 0; // Frames since the view last moved
+        bool rescaled = false; // The next version change comes from the render size, not from the view
+
+        // Progressive accumulation, restarted when the published scene version changes
+        bool accumulate = true;
+        unsigned max_accumulated_frames = MAX_ACCUMULATED_FRAMES;
+        unsigned accumulated_frames = 0;
+        std::uint64_t accumulated_version = 0;
+
+        // Tiled dispatch: every frame traces as many tiles as fit in the budget, a pass covers every tile once
+        float frame_budget_ms = DEFAULT_FRAME_BUDGET_MS;
+        int next_tile = 0;
+        int tiles_in_pass = 0; // Tiles traced since the current pass started
+        std::array<double, static_cast<int>(trace_mode::count)> tile_milliseconds{}; // Average GPU time of a tile
+        int last_frame_tiles = 0;
+        std::array<gpu_timer, static_cast<int>(trace_mode::count)> timers; // One per mode, to compare them
+
+        [[nodiscard]] glm::ivec2 tile_grid() const { return (render_size + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE; }
+
+        // (Re)load the kernels that traverse the BVH, with the defines of the traversal
+        [[nodiscard]] std::string trace_defines(bool with_short_stack, bool with_subgroups) const;
+        void load_trace_shaders();
+
+        // Create texture for a rendered output, with the images of the adaptive sampling
         void create_output_texture();
 
+        // Trace the tiles of the frame into the output texture
+        void trace();
+
+        // Choose the samples of every pixel for the next pass
+        void allocate_samples();
+
+        // Set the checkerboard uniforms of the current pass
+        void set_checkerboard_uniforms(const shader_class& shader) const;
+
+        // Fill the pixels skipped by a checkerboard pass into the resolved image
+        void resolve_checkerboard() const;
+
+        // Blend an image with the reprojected history, returns the new history
+        GLuint reproject_temporal(GLuint color);
+
+        // Filter an image with the a-trous denoiser, returns the filtered image
+        GLuint denoise_image(GLuint color);
+
+        // Adjust the render size to the measured GPU time, recreating the textures if it changes
+        void update_render_scale();
+        void set_render_size(glm::ivec2 size);
+
+        // Create the image shown by display, in the output format
+        void create_final_texture();
+
+        // Write the last image of the post passes into the final texture
+        void write_output(GLuint color) const;
+
+        // Set the tone mapping uniforms of a shader
+        void set_tone_mapping_uniforms(const shader_class& shader) const;
+
         // Create quad for displaying the texture
         void create_display_quad();
 
@@ -42,8 +272,120 @@ namespace gl3
         // Update texture dimensions if the window size changes
         void resize(int width, int height);
 
-        // Render the scene
-        void render() const;
+        // Render the scene, adding a frame to the accumulated image while the scene stays the same
+        void render();
+
+        // Progressive accumulation settings
+        void set_accumulation(bool enabled) { accumulate = enabled; reset_accumulation(); }
+        [[nodiscard]] bool is_accumulating() const { return accumulate; }
+        void set_max_accumulated_frames(const unsigned frames) { max_accumulated_frames = std::max(frames, 1u); }
+        [[nodiscard]] unsigned get_max_accumulated_frames() const { return max_accumulated_frames; }
+        [[nodiscard]] unsigned get_accumulated_frames() const { return accumulated_frames; }
+
+        // Start the accumulation over at the next frame
+        void reset_accumulation();
+
+        // Adaptive sampling settings
+        void set_adaptive_sampling(const bool enabled) { adaptive = enabled; reset_accumulation(); }
+        [[nodiscard]] bool is_adaptive_sampling() const { return adaptive; }
+        void set_adaptive_threshold(const float threshold) { adaptive_threshold = std::max(threshold, 0.001f); }
+        [[nodiscard]] float get_adaptive_threshold() const { return adaptive_threshold; }
+        void set_sample_heatmap(const bool shown) { show_sample_heatmap = shown; }
+        [[nodiscard]] bool is_sample_heatmap_shown() const { return show_sample_heatmap; }
+
+        // Convergence statistics, for the UI; the count lags a pass behind
+        [[nodiscard]] unsigned get_noisy_pixels() const { return noisy_pixels; }
+        [[nodiscard]] double get_converged_seconds() const { return converged_seconds; }
+
+        // GPU time allowed for the tiles of a frame, 0 to trace the whole image every frame
+        void set_frame_budget(const float milliseconds) { frame_budget_ms = std::max(milliseconds, 0.0f); }
+        [[nodiscard]] float get_frame_budget() const { return frame_budget_ms; }
+
+        // Tiling statistics, for the UI
+        [[nodiscard]] int get_tile_count() const { return tile_grid().x * tile_grid().y; }
+        [[nodiscard]] int get_last_frame_tiles() const { return last_frame_tiles; }
+        [[nodiscard]] double get_tile_milliseconds(const trace_mode of) const
+        {
+            return tile_milliseconds[static_cast<int>(of)];
+        }
+
+        // Dynamic resolution settings
+        void set_dynamic_resolution(const bool enabled) { dynamic_resolution = enabled; }
+        [[nodiscard]] bool is_dynamic_resolution() const { return dynamic_resolution; }
+        void set_target_frame_time(const float milliseconds) { target_frame_ms = std::max(milliseconds, 1.0f); }
+        [[nodiscard]] float get_target_frame_time() const { return target_frame_ms; }
+        [[nodiscard]] float get_render_scale() const { return render_scale; }
+        [[nodiscard]] glm::ivec2 get_render_size() const { return render_size; }
+
+        // Checkerboard rendering while the view moves
+        void set_checkerboard(const checkerboard_mode new_mode) { checkerboard = new_mode; reset_accumulation(); }
+        [[nodiscard]] checkerboard_mode get_checkerboard() const { return checkerboard; }
+
+        // Temporal reprojection of the previous frames
+        void set_temporal(const bool enabled) { temporal = enabled; history_valid = false; reset_accumulation(); }
+        [[nodiscard]] bool is_temporal() const { return temporal; }
+
+        // Denoiser settings
+        void set_denoise(const bool enabled) { denoise = enabled; }
+        [[nodiscard]] bool is_denoising() const { return denoise; }
+        void set_denoise_iterations(const int iterations)
+        {
+            denoise_iterations = std::clamp(iterations, 1, MAX_DENOISE_ITERATIONS);
+        }
+        [[nodiscard]] int get_denoise_iterations() const { return denoise_iterations; }
+        void set_denoise_sigmas(const float normal, const float depth, const float luminance)
+        {
+            sigma_normal = std::max(normal, 0.0f);
+            sigma_depth = std::max(depth, 0.001f);
+            sigma_luminance = std::max(luminance, 0.001f);
+        }
+        [[nodiscard]] glm::vec3 get_denoise_sigmas() const { return {sigma_normal, sigma_depth, sigma_luminance}; }
+
+        // Format of the displayed image and its tone mapping
+        void set_output_format(output_format new_format);
+        [[nodiscard]] output_format get_output_format() const { return format; }
+        void set_tone_mapping(const bool enabled) { tone_mapping = enabled; }
+        [[nodiscard]] bool is_tone_mapping() const { return tone_mapping; }
+        void set_exposure(const float value) { exposure = std::max(value, 0.0f); }
+        [[nodiscard]] float get_exposure() const { return exposure; }
+
+        // Megakernel, wavefront or persistent threads tracing
+        void set_trace_mode(trace_mode new_mode);
+        [[nodiscard]] trace_mode get_trace_mode() const { return mode; }
+
+        // Sorting of the secondary and shadow rays of the wavefront passes, and its statistics
+        void set_ray_binning(const bool enabled) { ray_binning = enabled; }
+        [[nodiscard]] bool is_ray_binning() const { return ray_binning; }
+        [[nodiscard]] double get_rays_per_second() const { return rays_per_second; }
+        [[nodiscard]] double get_ray_divergence() const { return ray_divergence; }
+        [[nodiscard]] unsigned get_dropped_rays() const { return dropped_rays; }
+
+        // Short stack BVH traversal, recompiles the tracing kernels
+        void set_short_stack_traversal(bool enabled);
+        [[nodiscard]] bool is_short_stack_traversal() const { return short_stack; }
+
+        // Levels of the BVH served from shared memory, 0 to read every node from the uniform block; recompiles the
+        // tracing kernels
+        void set_bvh_shared_levels(int levels);
+        [[nodiscard]] int get_bvh_shared_levels() const { return bvh_shared_levels; }
+
+        // Subgroup-cooperative BVH traversal, only when the device supports it; recompiles the tracing kernels
+        void set_subgroup_traversal(bool enabled);
+        [[nodiscard]] bool is_subgroup_traversal() const { return subgroup_traversal; }
+        [[nodiscard]] int get_subgroup_size() const { return subgroup_size; }
+
+        // Trace the pixels with the subgroup and the scalar traversal, both on the short stack, and count the pixels
+        // whose hits differ; -1 without subgroup support
+        int check_subgroup_traversal();
+        [[nodiscard]] int get_subgroup_mismatches() const { return subgroup_mismatches; }
+
+        // Frustum traversal of the primary rays of the megakernel, per work group
+        void set_tile_frustum(const bool enabled) { tile_frustum = enabled; }
+        [[nodiscard]] bool is_tile_frustum() const { return tile_frustum; }
+
+        // Work groups of the persistent threads kernel, to match the size of the device
+        void set_persistent_work_groups(const int groups) { persistent_work_groups = std::max(groups, 1); }
+        [[nodiscard]] int get_persistent_work_groups() const { return persistent_work_groups; }
 
         // Display the rendered image
         void display() const;
@@ -0,0 +1,60 @@
+#include "gpu_timer.h"
+
+gl3::gpu_timer::gpu_timer()
+{
+    glGenQueries(GPU_TIMER_QUERIES, queries.data());
+}
+
+gl3::gpu_timer::~gpu_timer()
+{
+    glDeleteQueries(GPU_TIMER_QUERIES, queries.data());
+}
+
+bool gl3::gpu_timer::begin()
+{
+    if (active || pending == GPU_TIMER_QUERIES)
+    {
+        return false;
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, queries[(first_pending + pending) % GPU_TIMER_QUERIES]);
+    active = true;
+    return true;
+}
+
+void gl3::gpu_timer::end(const unsigned work_done)
+{
+    if (!active)
+    {
+        return;
+    }
+
+    glEndQuery(GL_TIME_ELAPSED);
+    work[(first_pending + pending) % GPU_TIMER_QUERIES] = work_done;
+    pending++;
+    active = false;
+}
+
+std::optional<gl3::gpu_timer::sample> gl3::gpu_timer::poll()
+{
+    if (pending == 0)
+    {
+        return std::nullopt;
+    }
+
+    // Queries finish in order, only the oldest one needs to be checked
+    const GLuint query = queries[first_pending];
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available == GL_FALSE)
+    {
+        return std::nullopt;
+    }
+
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+    const sample result{static_cast<double>(nanoseconds) / 1.0e6, work[first_pending]};
+    first_pending = (first_pending + 1) % GPU_TIMER_QUERIES;
+    pending--;
+    return result;
+}
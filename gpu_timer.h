@@ -0,0 +1,50 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+#include <array>
+#include <optional>
+
+#include <GL/glew.h>
+
+// Number of measurements that can wait for the GPU at the same time
+constexpr int GPU_TIMER_QUERIES = 4;
+
+namespace gl3
+{
+    // Measures the GPU time of a group of commands with timer queries. Results are read a few frames later, once the
+    // GPU has finished, so measuring never stalls the pipeline.
+    class gpu_timer
+    {
+    public:
+        // Finished measurement, with the amount of work given to end
+        struct sample
+        {
+            double milliseconds;
+            unsigned work;
+        };
+
+        gpu_timer();
+        ~gpu_timer();
+
+        gpu_timer(const gpu_timer&) = delete;
+        gpu_timer& operator=(const gpu_timer&) = delete;
+
+        // Start timing the following commands; returns false if every query is still waiting for its result
+        bool begin();
+
+        // Stop timing, tagging the measurement with the amount of work it covers
+        void end(unsigned work = 1);
+
+        // Oldest finished measurement, if any, without waiting for the GPU
+        std::optional<sample> poll();
+
+    private:
+        std::array<GLuint, GPU_TIMER_QUERIES> queries{};
+        std::array<unsigned, GPU_TIMER_QUERIES> work{};
+        int first_pending = 0; // Oldest query waiting for its result
+        int pending = 0;
+        bool active = false; // Between begin and end
+    };
+}
+
+
+#endif //GPU_TIMER_H
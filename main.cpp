@@ -1,7 +1,8 @@
 #include "renderer.h"
 
-int main() {
-    gl3::renderer renderer;
+int main(const int argc, char* argv[]) {
+    // An OBJ or PLY file given on the command line is streamed in while rendering
+    gl3::renderer renderer(argc > 1 ? argv[1] : "");
     
     // Main render loop
     while (!renderer.should_close()) {
@@ -0,0 +1,104 @@
+#include "mapped_file.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+mapped_file::mapped_file(const std::string& path)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << "Could not open file: " << path << std::endl;
+        return;
+    }
+    file_handle = file;
+    opened = true;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        return;
+    }
+    length = static_cast<std::size_t>(file_size.QuadPart);
+
+    // Map the whole file read-only
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        std::cerr << "Could not map file: " << path << std::endl;
+        length = 0;
+        opened = false;
+        return;
+    }
+    mapping_handle = mapping;
+    data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (data == nullptr)
+    {
+        std::cerr << "Could not map file: " << path << std::endl;
+        length = 0;
+        opened = false;
+    }
+}
+
+mapped_file::~mapped_file()
+{
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (mapping_handle != nullptr)
+        CloseHandle(mapping_handle);
+    if (file_handle != nullptr)
+        CloseHandle(file_handle);
+}
+#else
+mapped_file::mapped_file(const std::string& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Could not open file: " << path << std::endl;
+        return;
+    }
+    opened = true;
+
+    struct stat file_stat{};
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+    length = static_cast<std::size_t>(file_stat.st_size);
+
+    // Map the whole file read-only, the mapping stays valid once the descriptor is closed
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        std::cerr << "Could not map file: " << path << std::endl;
+        length = 0;
+        opened = false;
+        return;
+    }
+
+    // Files are read front to back by every parser
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    data = static_cast<const char*>(mapping);
+}
+
+mapped_file::~mapped_file()
+{
+    if (data != nullptr)
+        munmap(const_cast<char*>(data), length);
+}
+#endif
@@ -0,0 +1,38 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file
+class mapped_file
+{
+public:
+    explicit mapped_file(const std::string& path);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    // Whether the file was opened and mapped
+    [[nodiscard]] bool is_open() const { return data != nullptr || (opened && length == 0); }
+
+    // Mapped contents
+    [[nodiscard]] const char* begin() const { return data; }
+    [[nodiscard]] const char* end() const { return data + length; }
+    [[nodiscard]] std::size_t size() const { return length; }
+    [[nodiscard]] std::string_view view() const { return {data, length}; }
+
+private:
+    const char* data = nullptr;
+    std::size_t length = 0;
+    bool opened = false;
+
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+
+#endif //MAPPED_FILE_H
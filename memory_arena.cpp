@@ -0,0 +1,72 @@
+#include "memory_arena.h"
+
+#include <algorithm>
+#include <bit>
+
+memory_arena::memory_arena(const std::size_t initial_capacity, const std::size_t max_capacity) :
+    buffer(std::make_unique<std::byte[]>(initial_capacity)), capacity(initial_capacity),
+    max_capacity(std::max(initial_capacity, max_capacity)), heap_allocations(1)
+{
+    monotonic.emplace(buffer.get(), capacity, &upstream);
+}
+
+void memory_arena::reset()
+{
+    std::lock_guard lock(mutex);
+
+    // Free the overflow blocks first, they are owned by the monotonic resource
+    monotonic.reset();
+
+    // Grow the buffer so the next cycle of the same size fits entirely
+    if (cycle_bytes > capacity && capacity < max_capacity)
+    {
+        capacity = std::min(std::bit_ceil(cycle_bytes), max_capacity);
+        buffer = std::make_unique<std::byte[]>(capacity);
+        heap_allocations++;
+    }
+
+    monotonic.emplace(buffer.get(), capacity, &upstream);
+    cycle_bytes = 0;
+}
+
+memory_arena::statistics memory_arena::get_statistics() const
+{
+    std::lock_guard lock(mutex);
+    return {allocations, heap_allocations + upstream.allocations, cycle_bytes, peak_bytes, capacity};
+}
+
+void* memory_arena::do_allocate(const std::size_t bytes, const std::size_t alignment)
+{
+    std::lock_guard lock(mutex);
+    allocations++;
+    cycle_bytes += bytes + alignment - 1;
+    peak_bytes = std::max(peak_bytes, cycle_bytes);
+    return monotonic->allocate(bytes, alignment);
+}
+
+void memory_arena::do_deallocate(void*, std::size_t, std::size_t)
+{
+    // Memory is only reclaimed by reset
+}
+
+bool memory_arena::do_is_equal(const memory_resource& other) const noexcept
+{
+    return this == &other;
+}
+
+void* memory_arena::counting_resource::do_allocate(const std::size_t bytes, const std::size_t alignment)
+{
+    allocations++;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void memory_arena::counting_resource::do_deallocate(void* pointer, const std::size_t bytes,
+                                                    const std::size_t alignment)
+{
+    std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+}
+
+bool memory_arena::counting_resource::do_is_equal(const memory_resource& other) const noexcept
+{
+    return this == &other;
+}
@@ -0,0 +1,72 @@
+#ifndef MEMORY_ARENA_H
+#define MEMORY_ARENA_H
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+
+// Default sizes of an arena buffer
+constexpr std::size_t ARENA_INITIAL_CAPACITY = 64 * 1024;
+constexpr std::size_t ARENA_MAX_CAPACITY = 64 * 1024 * 1024;
+
+// Reusable monotonic arena for scratch memory. Allocations are bump-allocated from a buffer that persists across
+// resets; when a cycle overflows it, the buffer grows to fit the next one, so steady-state cycles never reach the
+// global heap. Allocation is serialized, so scratch vectors may grow from worker threads.
+class memory_arena final : public std::pmr::memory_resource
+{
+public:
+    // Allocation counters, for the UI
+    struct statistics
+    {
+        std::size_t allocations = 0; // Allocations served since creation
+        std::size_t heap_allocations = 0; // Allocations that reached the global heap since creation
+        std::size_t bytes = 0; // Bytes allocated since the last reset
+        std::size_t peak_bytes = 0; // Largest cycle so far
+        std::size_t capacity = 0; // Size of the persistent buffer
+    };
+
+    explicit memory_arena(std::size_t initial_capacity = ARENA_INITIAL_CAPACITY,
+                          std::size_t max_capacity = ARENA_MAX_CAPACITY);
+
+    memory_arena(const memory_arena&) = delete;
+    memory_arena& operator=(const memory_arena&) = delete;
+
+    // Free everything allocated since the last reset, growing the buffer if the last cycle overflowed it
+    void reset();
+
+    [[nodiscard]] statistics get_statistics() const;
+
+private:
+    // Upstream of the monotonic resource, counting the allocations that overflow the buffer
+    class counting_resource final : public std::pmr::memory_resource
+    {
+    public:
+        std::size_t allocations = 0;
+
+    private:
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+        void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) override;
+        [[nodiscard]] bool do_is_equal(const memory_resource& other) const noexcept override;
+    };
+
+    std::unique_ptr<std::byte[]> buffer;
+    std::size_t capacity;
+    std::size_t max_capacity;
+    counting_resource upstream;
+    std::optional<std::pmr::monotonic_buffer_resource> monotonic;
+    mutable std::mutex mutex;
+
+    // Counters
+    std::size_t allocations = 0;
+    std::size_t heap_allocations = 0; // Buffer allocations, overflow blocks are counted by upstream
+    std::size_t cycle_bytes = 0; // Including alignment slack
+    std::size_t peak_bytes = 0;
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) override;
+    [[nodiscard]] bool do_is_equal(const memory_resource& other) const noexcept override;
+};
+
+
+#endif //MEMORY_ARENA_H
@@ -0,0 +1,85 @@
+#include "memory_tracker.h"
+
+#include <numeric>
+
+// Buffers and textures have separate handle namespaces
+static std::uint64_t buffer_key(const unsigned handle)
+{
+    return handle;
+}
+
+static std::uint64_t texture_key(const unsigned handle)
+{
+    return std::uint64_t{1} << 32 | handle;
+}
+
+std::size_t memory_tracker::gpu_usage::total_bytes() const
+{
+    return std::accumulate(bytes.begin(), bytes.end(), std::size_t{0});
+}
+
+void memory_tracker::track_buffer(const unsigned handle, const gpu_memory_category category, const std::size_t bytes)
+{
+    instance().track(buffer_key(handle), category, bytes);
+}
+
+void memory_tracker::release_buffer(const unsigned handle)
+{
+    instance().release(buffer_key(handle));
+}
+
+void memory_tracker::track_texture(const unsigned handle, const std::size_t bytes)
+{
+    instance().track(texture_key(handle), gpu_memory_category::texture, bytes);
+}
+
+void memory_tracker::release_texture(const unsigned handle)
+{
+    instance().release(texture_key(handle));
+}
+
+memory_tracker::gpu_usage memory_tracker::get_gpu_usage()
+{
+    memory_tracker& tracker = instance();
+    std::lock_guard lock(tracker.mutex);
+    return tracker.usage;
+}
+
+memory_tracker& memory_tracker::instance()
+{
+    static memory_tracker tracker;
+    return tracker;
+}
+
+void memory_tracker::track(const std::uint64_t key, const gpu_memory_category category, const std::size_t bytes)
+{
+    std::lock_guard lock(mutex);
+    const auto index = static_cast<std::size_t>(category);
+
+    // A new storage for an existing object replaces the old one
+    if (const auto [it, inserted] = allocations.try_emplace(key, allocation{category, bytes}); !inserted)
+    {
+        const auto previous = static_cast<std::size_t>(it->second.category);
+        usage.bytes[previous] -= it->second.bytes;
+        usage.objects[previous]--;
+        it->second = {category, bytes};
+    }
+
+    usage.bytes[index] += bytes;
+    usage.objects[index]++;
+    usage.allocations++;
+}
+
+void memory_tracker::release(const std::uint64_t key)
+{
+    std::lock_guard lock(mutex);
+    const auto it = allocations.find(key);
+    if (it == allocations.end())
+        return;
+
+    const auto index = static_cast<std::size_t>(it->second.category);
+    usage.bytes[index] -= it->second.bytes;
+    usage.objects[index]--;
+    usage.releases++;
+    allocations.erase(it);
+}
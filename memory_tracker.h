@@ -0,0 +1,87 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+// Kinds of GL objects holding memory
+enum class gpu_memory_category : int
+{
+    uniform_buffer = 0,
+    storage_buffer,
+    vertex_buffer,
+    texture,
+    count
+};
+
+// Names of the categories, for the UI
+constexpr std::array<const char*, static_cast<std::size_t>(gpu_memory_category::count)> GPU_MEMORY_CATEGORY_NAMES = {
+    "Uniform buffers", "Storage buffers", "Vertex buffers", "Textures"
+};
+
+// Process-wide record of the GL buffer and texture allocations. Every place that allocates the storage of a buffer
+// or texture reports its size, and every deletion releases it, so the totals always match what is alive on the GPU
+// and a growing object count points at a leak.
+class memory_tracker
+{
+public:
+    // Live GPU memory, per category
+    struct gpu_usage
+    {
+        std::array<std::size_t, static_cast<std::size_t>(gpu_memory_category::count)> bytes{};
+        std::array<std::size_t, static_cast<std::size_t>(gpu_memory_category::count)> objects{};
+        std::size_t allocations = 0; // Storage allocations since the start, reallocations included
+        std::size_t releases = 0;
+
+        [[nodiscard]] std::size_t total_bytes() const;
+    };
+
+    // CPU memory of the scene, gathered on demand from its owners
+    struct cpu_usage
+    {
+        std::size_t scene = 0; // Camera, objects, lighting and bvh sent to the UBOs
+        std::size_t snapshots = 0; // Sections of the published snapshot
+        std::size_t meshes = 0; // Mesh arrays and their full precision source
+        std::size_t arenas = 0; // Buffers of the scratch arenas
+
+        [[nodiscard]] std::size_t total_bytes() const { return scene + snapshots + meshes + arenas; }
+    };
+
+    // Everything the engine holds, on both sides
+    struct report
+    {
+        gpu_usage gpu;
+        cpu_usage cpu;
+    };
+
+    // (Re)allocation of the storage of a buffer, replaces its previous size
+    static void track_buffer(unsigned handle, gpu_memory_category category, std::size_t bytes);
+    static void release_buffer(unsigned handle);
+
+    // (Re)allocation of the storage of a texture
+    static void track_texture(unsigned handle, std::size_t bytes);
+    static void release_texture(unsigned handle);
+
+    [[nodiscard]] static gpu_usage get_gpu_usage();
+
+private:
+    struct allocation
+    {
+        gpu_memory_category category;
+        std::size_t bytes;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::uint64_t, allocation> allocations; // Keyed by object kind and handle
+    gpu_usage usage;
+
+    static memory_tracker& instance();
+
+    void track(std::uint64_t key, gpu_memory_category category, std::size_t bytes);
+    void release(std::uint64_t key);
+};
+
+
+#endif //MEMORY_TRACKER_H
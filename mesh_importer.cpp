@@ -0,0 +1,768 @@
+#include "mesh_importer.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "mapped_file.h"
+#include "mesh_storage.h"
+
+// Smallest chunk handed to a parser thread, below which threads cost more than they save
+constexpr std::size_t MIN_CHUNK_SIZE = 256 * 1024;
+
+// Run function(i) for every i in [0, count) on its own thread
+template <typename Function>
+static void parallel_for(const std::size_t count, Function&& function)
+{
+    if (count == 1)
+    {
+        function(std::size_t{0});
+        return;
+    }
+
+    std::vector<std::jthread> threads;
+    threads.reserve(count);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        threads.emplace_back(function, i);
+    }
+}
+
+// Split a text into up to chunk_count chunks ending at line boundaries
+static std::pmr::vector<std::string_view> split_lines(const std::string_view text, const unsigned chunk_count,
+                                                      std::pmr::memory_resource* scratch)
+{
+    std::pmr::vector<std::string_view> chunks(scratch);
+    const char* start = text.data();
+    const char* end = text.data() + text.size();
+
+    for (unsigned i = 1; i < chunk_count && start < end; i++)
+    {
+        const char* target = text.data() + text.size() * i / chunk_count;
+        if (target < start)
+            continue;
+
+        const auto* newline = static_cast<const char*>(std::memchr(target, '\n', end - target));
+        const char* boundary = newline != nullptr ? newline + 1 : end;
+        chunks.emplace_back(start, boundary - start);
+        start = boundary;
+    }
+    if (start < end)
+    {
+        chunks.emplace_back(start, end - start);
+    }
+    return chunks;
+}
+
+// Number of chunks worth parsing in parallel for a text of the given size
+static unsigned chunk_count_for(const std::size_t size, const unsigned thread_count)
+{
+    return static_cast<unsigned>(std::clamp<std::size_t>(size / MIN_CHUNK_SIZE, 1, thread_count));
+}
+
+// Skip blanks within a line
+static const char* skip_blanks(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+    return p;
+}
+
+// Start of the line following p
+static const char* next_line(const char* p, const char* end)
+{
+    const auto* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return newline != nullptr ? newline + 1 : end;
+}
+
+// End of the line starting at p, excluding the newline
+static const char* line_end(const char* p, const char* end)
+{
+    const auto* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return newline != nullptr ? newline : end;
+}
+
+// Parse a number after optional blanks; returns nullptr on failure
+template <typename T>
+static const char* parse_number(const char* p, const char* end, T& value)
+{
+    p = skip_blanks(p, end);
+    if (p < end && *p == '+')
+        ++p;
+    const auto [ptr, ec] = std::from_chars(p, end, value);
+    return ec == std::errc() ? ptr : nullptr;
+}
+
+// Polygon triangulation as a fan around its first vertex
+struct fan_triangulator
+{
+    std::pmr::vector<glm::uvec3>& triangles;
+    unsigned first = 0;
+    unsigned previous = 0;
+    int count = 0;
+
+    void add(const unsigned vertex)
+    {
+        if (count == 0)
+            first = vertex;
+        else if (count >= 2)
+            triangles.emplace_back(first, previous, vertex);
+        previous = vertex;
+        count++;
+    }
+};
+
+bool mesh_importer::load(const std::string& path, mesh_geometry& geometry, import_stats& stats,
+                         unsigned thread_count, std::pmr::memory_resource* scratch)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+
+    if (thread_count == 0)
+    {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    const mapped_file file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // Pick the parser from the file extension
+    std::string extension = path.substr(path.find_last_of('.') + 1);
+    std::ranges::transform(extension, extension.begin(), [](const unsigned char c) { return std::tolower(c); });
+
+    bool loaded;
+    if (extension == "obj")
+    {
+        loaded = load_obj(file.view(), geometry, thread_count, scratch);
+    }
+    else if (extension == "ply")
+    {
+        loaded = load_ply(file.view(), geometry, thread_count, scratch);
+    }
+    else
+    {
+        std::cerr << "Unsupported mesh format: " << path << std::endl;
+        return false;
+    }
+
+    stats.bytes = file.size();
+    stats.vertices = geometry.positions.size();
+    stats.triangles = geometry.triangles.size();
+    stats.threads = std::min(thread_count, chunk_count_for(file.size(), thread_count));
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    if (loaded)
+    {
+        std::cout << "Loaded " << path << ": " << stats.vertices << " vertices, " << stats.triangles
+            << " triangles in " << stats.seconds * 1000.0 << " ms (" << stats.megabytes_per_second()
+            << " MB/s, " << stats.threads << " threads)" << std::endl;
+    }
+    return loaded;
+}
+
+int mesh_importer::import_mesh(scene_data& scene, const std::string& path,
+                               const scene_data::scene_objects::material& material, import_stats& stats,
+                               std::pmr::memory_resource* scratch)
+{
+    mesh_geometry geometry;
+    if (!load(path, geometry, stats, 0, scratch))
+    {
+        return -1;
+    }
+    return scene.add_mesh(geometry.positions, geometry.triangles, material);
+}
+
+bool mesh_importer::load_obj(const std::string_view text, mesh_geometry& geometry, const unsigned thread_count,
+                             std::pmr::memory_resource* scratch)
+{
+    const std::pmr::vector<std::string_view> chunks = split_lines(text, chunk_count_for(text.size(), thread_count),
+                                                                  scratch);
+    const std::size_t chunk_count = chunks.size();
+
+    // First pass: count the vertices of every chunk, so each chunk knows the index of its first vertex
+    std::pmr::vector<std::size_t> vertex_bases(chunk_count + 1, 0, scratch);
+    parallel_for(chunk_count, [&](const std::size_t chunk)
+    {
+        std::size_t count = 0;
+        const char* end = chunks[chunk].data() + chunks[chunk].size();
+        for (const char* p = chunks[chunk].data(); p < end; p = next_line(p, end))
+        {
+            p = skip_blanks(p, end);
+            if (end - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+                count++;
+        }
+        vertex_bases[chunk + 1] = count;
+    });
+    for (std::size_t chunk = 0; chunk < chunk_count; chunk++)
+    {
+        vertex_bases[chunk + 1] += vertex_bases[chunk];
+    }
+    const std::size_t vertex_count = vertex_bases[chunk_count];
+    geometry.positions.resize(vertex_count);
+
+    // Second pass: vertices go straight to their final slot, faces to a per-chunk list
+    std::pmr::vector<std::pmr::vector<glm::uvec3>> chunk_triangles(chunk_count, scratch);
+    std::atomic<bool> valid = true;
+    parallel_for(chunk_count, [&](const std::size_t chunk)
+    {
+        std::pmr::vector<glm::uvec3>& triangles = chunk_triangles[chunk];
+        triangles.reserve(chunks[chunk].size() / 24);
+
+        std::size_t vertex_index = vertex_bases[chunk];
+        const char* end = chunks[chunk].data() + chunks[chunk].size();
+        for (const char* p = chunks[chunk].data(); p < end; p = next_line(p, end))
+        {
+            p = skip_blanks(p, end);
+            if (end - p < 2 || (p[1] != ' ' && p[1] != '\t'))
+                continue;
+
+            if (p[0] == 'v')
+            {
+                // Vertex position, an optional w is ignored
+                glm::vec3& position = geometry.positions[vertex_index++];
+                p += 1;
+                if (!(p = parse_number(p, end, position.x)) || !(p = parse_number(p, end, position.y)) ||
+                    !(p = parse_number(p, end, position.z)))
+                {
+                    valid = false;
+                    return;
+                }
+            }
+            else if (p[0] == 'f')
+            {
+                // Face as a list of "v", "v/vt", "v//vn" or "v/vt/vn", with negative indices relative to the
+                // vertices read so far
+                fan_triangulator fan{triangles};
+                const char* face_end = line_end(p, end);
+                p = skip_blanks(p + 1, face_end);
+                while (p < face_end)
+                {
+                    long long index;
+                    if (!(p = parse_number(p, face_end, index)) || index == 0)
+                    {
+                        valid = false;
+                        return;
+                    }
+
+                    const long long resolved = index > 0 ? index - 1 : static_cast<long long>(vertex_index) + index;
+                    if (resolved < 0 || resolved >= static_cast<long long>(vertex_count))
+                    {
+                        valid = false;
+                        return;
+                    }
+                    fan.add(static_cast<unsigned>(resolved));
+
+                    // Skip texture and normal indices
+                    while (p < face_end && *p != ' ' && *p != '\t' && *p != '\r')
+                        ++p;
+                    p = skip_blanks(p, face_end);
+                }
+            }
+        }
+    });
+
+    if (!valid)
+    {
+        std::cerr << "Malformed OBJ vertex or face record." << std::endl;
+        return false;
+    }
+
+    // Gather the faces of every chunk in file order
+    std::pmr::vector<std::size_t> triangle_bases(chunk_count + 1, 0, scratch);
+    for (std::size_t chunk = 0; chunk < chunk_count; chunk++)
+    {
+        triangle_bases[chunk + 1] = triangle_bases[chunk] + chunk_triangles[chunk].size();
+    }
+    geometry.triangles.resize(triangle_bases[chunk_count]);
+    parallel_for(chunk_count, [&](const std::size_t chunk)
+    {
+        std::ranges::copy(chunk_triangles[chunk], geometry.triangles.begin() + triangle_bases[chunk]);
+    });
+
+    return true;
+}
+
+// PLY scalar types
+enum class ply_type
+{
+    int8, uint8, int16, uint16, int32, uint32, float32, float64, invalid
+};
+
+struct ply_property
+{
+    std::string name;
+    ply_type type = ply_type::invalid;
+    ply_type count_type = ply_type::invalid; // For list properties
+    bool is_list = false;
+};
+
+struct ply_element
+{
+    std::string name;
+    std::size_t count = 0;
+    std::vector<ply_property> properties;
+};
+
+static ply_type parse_ply_type(const std::string_view name)
+{
+    if (name == "char" || name == "int8") return ply_type::int8;
+    if (name == "uchar" || name == "uint8") return ply_type::uint8;
+    if (name == "short" || name == "int16") return ply_type::int16;
+    if (name == "ushort" || name == "uint16") return ply_type::uint16;
+    if (name == "int" || name == "int32") return ply_type::int32;
+    if (name == "uint" || name == "uint32") return ply_type::uint32;
+    if (name == "float" || name == "float32") return ply_type::float32;
+    if (name == "double" || name == "float64") return ply_type::float64;
+    return ply_type::invalid;
+}
+
+static std::size_t ply_type_size(const ply_type type)
+{
+    switch (type)
+    {
+    case ply_type::int8:
+    case ply_type::uint8:
+        return 1;
+    case ply_type::int16:
+    case ply_type::uint16:
+        return 2;
+    case ply_type::int32:
+    case ply_type::uint32:
+    case ply_type::float32:
+        return 4;
+    case ply_type::float64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Read a binary PLY scalar, swapping its bytes when the file endianness differs from the host
+template <typename T>
+static T read_swapped(const char* p, const bool swap)
+{
+    std::array<char, sizeof(T)> bytes;
+    std::memcpy(bytes.data(), p, sizeof(T));
+    if (swap)
+        std::ranges::reverse(bytes);
+    return std::bit_cast<T>(bytes);
+}
+
+static double read_ply_value(const char* p, const ply_type type, const bool swap)
+{
+    switch (type)
+    {
+    case ply_type::int8: return static_cast<std::int8_t>(*p);
+    case ply_type::uint8: return static_cast<std::uint8_t>(*p);
+    case ply_type::int16: return read_swapped<std::int16_t>(p, swap);
+    case ply_type::uint16: return read_swapped<std::uint16_t>(p, swap);
+    case ply_type::int32: return read_swapped<std::int32_t>(p, swap);
+    case ply_type::uint32: return read_swapped<std::uint32_t>(p, swap);
+    case ply_type::float32: return read_swapped<float>(p, swap);
+    case ply_type::float64: return read_swapped<double>(p, swap);
+    default: return 0.0;
+    }
+}
+
+// Whether a property holds the vertex list of a face
+static bool is_face_indices(const ply_property& property)
+{
+    return property.is_list && (property.name == "vertex_indices" || property.name == "vertex_index");
+}
+
+bool mesh_importer::load_ply(const std::string_view text, mesh_geometry& geometry, const unsigned thread_count,
+                             std::pmr::memory_resource* scratch)
+{
+    // Parse the header
+    const char* p = text.data();
+    const char* end = text.data() + text.size();
+    if (text.size() < 4 || std::string_view(p, 3) != "ply")
+    {
+        std::cerr << "Missing PLY magic number." << std::endl;
+        return false;
+    }
+
+    enum class ply_format { ascii, binary_little_endian, binary_big_endian } format = ply_format::ascii;
+    std::vector<ply_element> elements;
+    bool header_complete = false;
+
+    for (p = next_line(p, end); p < end && !header_complete; p = next_line(p, end))
+    {
+        const std::string_view line(p, line_end(p, end) - p);
+        std::pmr::vector<std::string_view> words(scratch);
+        for (std::size_t start = 0; start < line.size();)
+        {
+            const std::size_t stop = std::min(line.find_first_of(" \t\r", start), line.size());
+            if (stop > start)
+                words.push_back(line.substr(start, stop - start));
+            start = stop + 1;
+        }
+
+        if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+        {
+            continue;
+        }
+        if (words[0] == "end_header")
+        {
+            header_complete = true;
+        }
+        else if (words[0] == "format" && words.size() >= 2)
+        {
+            if (words[1] == "ascii") format = ply_format::ascii;
+            else if (words[1] == "binary_little_endian") format = ply_format::binary_little_endian;
+            else if (words[1] == "binary_big_endian") format = ply_format::binary_big_endian;
+            else
+            {
+                std::cerr << "Unknown PLY format: " << words[1] << std::endl;
+                return false;
+            }
+        }
+        else if (words[0] == "element" && words.size() >= 3)
+        {
+            ply_element element;
+            element.name = words[1];
+            if (!parse_number(words[2].data(), words[2].data() + words[2].size(), element.count))
+            {
+                std::cerr << "Invalid PLY element count." << std::endl;
+                return false;
+            }
+            elements.push_back(std::move(element));
+        }
+        else if (words[0] == "property" && !elements.empty())
+        {
+            ply_property property;
+            if (words.size() >= 5 && words[1] == "list")
+            {
+                property.is_list = true;
+                property.count_type = parse_ply_type(words[2]);
+                property.type = parse_ply_type(words[3]);
+                property.name = words[4];
+            }
+            else if (words.size() >= 3)
+            {
+                property.type = parse_ply_type(words[1]);
+                property.name = words[2];
+            }
+            if (property.type == ply_type::invalid || (property.is_list && property.count_type == ply_type::invalid))
+            {
+                std::cerr << "Invalid PLY property: " << line << std::endl;
+                return false;
+            }
+            elements.back().properties.push_back(std::move(property));
+        }
+    }
+
+    if (!header_complete)
+    {
+        std::cerr << "Missing PLY end_header." << std::endl;
+        return false;
+    }
+
+    // Locate the vertex positions and the face lists
+    int vertex_element = -1;
+    int face_element = -1;
+    std::array<int, 3> xyz = {-1, -1, -1};
+    for (int e = 0; e < static_cast<int>(elements.size()); e++)
+    {
+        if (elements[e].name == "vertex")
+        {
+            vertex_element = e;
+            for (int i = 0; i < static_cast<int>(elements[e].properties.size()); i++)
+            {
+                const std::string& name = elements[e].properties[i].name;
+                if (name == "x") xyz[0] = i;
+                if (name == "y") xyz[1] = i;
+                if (name == "z") xyz[2] = i;
+            }
+        }
+        else if (elements[e].name == "face")
+        {
+            face_element = e;
+        }
+    }
+    if (vertex_element < 0 || face_element < 0 || std::ranges::find(xyz, -1) != xyz.end())
+    {
+        std::cerr << "PLY file has no vertex positions or no faces." << std::endl;
+        return false;
+    }
+
+    const std::size_t vertex_count = elements[vertex_element].count;
+    geometry.positions.resize(vertex_count);
+
+    const std::string_view body(p, end - p);
+    std::pmr::vector<std::pmr::vector<glm::uvec3>> chunk_triangles(scratch);
+    std::atomic<bool> valid = true;
+
+    if (format == ply_format::ascii)
+    {
+        const std::pmr::vector<std::string_view> chunks = split_lines(body, chunk_count_for(body.size(), thread_count),
+                                                                      scratch);
+        const std::size_t chunk_count = chunks.size();
+        chunk_triangles.resize(chunk_count);
+
+        // First pass: count the lines of every chunk, so each chunk knows which element its lines belong to
+        std::pmr::vector<std::size_t> line_bases(chunk_count + 1, 0, scratch);
+        parallel_for(chunk_count, [&](const std::size_t chunk)
+        {
+            line_bases[chunk + 1] = std::ranges::count(chunks[chunk], '\n') +
+                (chunks[chunk].empty() || chunks[chunk].back() == '\n' ? 0 : 1);
+        });
+        for (std::size_t chunk = 0; chunk < chunk_count; chunk++)
+        {
+            line_bases[chunk + 1] += line_bases[chunk];
+        }
+
+        // Line ranges of every element
+        std::pmr::vector<std::size_t> element_starts(elements.size() + 1, 0, scratch);
+        for (std::size_t e = 0; e < elements.size(); e++)
+        {
+            element_starts[e + 1] = element_starts[e] + elements[e].count;
+        }
+
+        // Second pass: parse the vertex and face lines of every chunk
+        parallel_for(chunk_count, [&](const std::size_t chunk)
+        {
+            std::pmr::vector<glm::uvec3>& triangles = chunk_triangles[chunk];
+            triangles.reserve(chunks[chunk].size() / 16);
+
+            std::size_t line = line_bases[chunk];
+            const char* chunk_end = chunks[chunk].data() + chunks[chunk].size();
+            for (const char* q = chunks[chunk].data(); q < chunk_end; q = next_line(q, chunk_end), line++)
+            {
+                const char* record_end = line_end(q, chunk_end);
+                if (line >= element_starts[vertex_element] && line < element_starts[vertex_element + 1])
+                {
+                    const auto& properties = elements[vertex_element].properties;
+                    glm::vec3& position = geometry.positions[line - element_starts[vertex_element]];
+                    for (int i = 0; i < static_cast<int>(properties.size()) && q; i++)
+                    {
+                        double value = 0.0;
+                        q = parse_number(q, record_end, value);
+                        for (int axis = 0; axis < 3; axis++)
+                        {
+                            if (xyz[axis] == i)
+                                position[axis] = static_cast<float>(value);
+                        }
+                    }
+                    if (!q)
+                    {
+                        valid = false;
+                        return;
+                    }
+                }
+                else if (line >= element_starts[face_element] && line < element_starts[face_element + 1])
+                {
+                    for (const auto& property : elements[face_element].properties)
+                    {
+                        std::size_t count = 1;
+                        if (property.is_list && !(q = parse_number(q, record_end, count)))
+                            break;
+
+                        fan_triangulator fan{triangles};
+                        for (std::size_t i = 0; i < count && q; i++)
+                        {
+                            double value = 0.0;
+                            q = parse_number(q, record_end, value);
+                            if (q && is_face_indices(property))
+                            {
+                                if (value < 0.0 || value >= static_cast<double>(vertex_count))
+                                {
+                                    valid = false;
+                                    return;
+                                }
+                                fan.add(static_cast<unsigned>(value));
+                            }
+                        }
+                        if (!q)
+                            break;
+                    }
+                    if (!q)
+                    {
+                        valid = false;
+                        return;
+                    }
+                }
+            }
+        });
+    }
+    else
+    {
+        const bool swap = (format == ply_format::binary_big_endian) != (std::endian::native == std::endian::big);
+        chunk_triangles.resize(1);
+
+        // Size of a binary record, or 0 when it contains lists
+        const auto record_size = [](const ply_element& element)
+        {
+            std::size_t size = 0;
+            for (const auto& property : element.properties)
+            {
+                if (property.is_list)
+                    return std::size_t{0};
+                size += ply_type_size(property.type);
+            }
+            return size;
+        };
+
+        // Skip one record of an element, returning nullptr if the file is truncated
+        const auto skip_record = [&](const char* q, const ply_element& element) -> const char*
+        {
+            for (const auto& property : element.properties)
+            {
+                std::size_t count = 1;
+                if (property.is_list)
+                {
+                    if (q + ply_type_size(property.count_type) > end)
+                        return nullptr;
+                    count = static_cast<std::size_t>(read_ply_value(q, property.count_type, swap));
+                    q += ply_type_size(property.count_type);
+                }
+                q += count * ply_type_size(property.type);
+                if (q > end)
+                    return nullptr;
+            }
+            return q;
+        };
+
+        const char* q = p;
+        for (int e = 0; e < static_cast<int>(elements.size()) && q; e++)
+        {
+            const ply_element& element = elements[e];
+            const std::size_t fixed_size = record_size(element);
+
+            if (e == vertex_element && fixed_size > 0)
+            {
+                // Fixed-size vertex records are converted in parallel
+                if (q + fixed_size * element.count > end)
+                {
+                    q = nullptr;
+                    break;
+                }
+
+                std::array<std::size_t, 3> offsets{};
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    for (int i = 0; i < xyz[axis]; i++)
+                        offsets[axis] += ply_type_size(element.properties[i].type);
+                }
+
+                const unsigned chunk_count = chunk_count_for(fixed_size * element.count, thread_count);
+                const char* vertices = q;
+                parallel_for(chunk_count, [&](const std::size_t chunk)
+                {
+                    const std::size_t first = element.count * chunk / chunk_count;
+                    const std::size_t last = element.count * (chunk + 1) / chunk_count;
+                    for (std::size_t v = first; v < last; v++)
+                    {
+                        const char* record = vertices + v * fixed_size;
+                        for (int axis = 0; axis < 3; axis++)
+                        {
+                            geometry.positions[v][axis] = static_cast<float>(read_ply_value(
+                                record + offsets[axis], element.properties[xyz[axis]].type, swap));
+                        }
+                    }
+                });
+                q += fixed_size * element.count;
+            }
+            else if (e == vertex_element || e == face_element)
+            {
+                // Variable-size records are walked in order
+                fan_triangulator fan{chunk_triangles[0]};
+                if (e == face_element)
+                    chunk_triangles[0].reserve(element.count);
+
+                for (std::size_t r = 0; r < element.count && q; r++)
+                {
+                    fan.count = 0;
+                    for (int i = 0; i < static_cast<int>(element.properties.size()) && q; i++)
+                    {
+                        const ply_property& property = element.properties[i];
+                        std::size_t count = 1;
+                        if (property.is_list)
+                        {
+                            if (q + ply_type_size(property.count_type) > end)
+                            {
+                                q = nullptr;
+                                break;
+                            }
+                            count = static_cast<std::size_t>(read_ply_value(q, property.count_type, swap));
+                            q += ply_type_size(property.count_type);
+                        }
+                        if (q + count * ply_type_size(property.type) > end)
+                        {
+                            q = nullptr;
+                            break;
+                        }
+
+                        for (std::size_t k = 0; k < count; k++, q += ply_type_size(property.type))
+                        {
+                            const double value = read_ply_value(q, property.type, swap);
+                            if (e == vertex_element)
+                            {
+                                for (int axis = 0; axis < 3; axis++)
+                                {
+                                    if (xyz[axis] == i)
+                                        geometry.positions[r][axis] = static_cast<float>(value);
+                                }
+                            }
+                            else if (is_face_indices(property))
+                            {
+                                if (value < 0.0 || value >= static_cast<double>(vertex_count))
+                                {
+                                    valid = false;
+                                    q = nullptr;
+                                    break;
+                                }
+                                fan.add(static_cast<unsigned>(value));
+                            }
+                        }
+                    }
+                }
+            }
+            else if (fixed_size > 0)
+            {
+                // Skip other fixed-size elements at once
+                q += fixed_size * element.count;
+                if (q > end)
+                    q = nullptr;
+            }
+            else
+            {
+                for (std::size_t r = 0; r < element.count && q; r++)
+                    q = skip_record(q, element);
+            }
+        }
+
+        if (!q)
+            valid = false;
+    }
+
+    if (!valid)
+    {
+        std::cerr << "Malformed or truncated PLY data." << std::endl;
+        return false;
+    }
+
+    // Gather the faces of every chunk in file order
+    std::pmr::vector<std::size_t> triangle_bases(chunk_triangles.size() + 1, 0, scratch);
+    for (std::size_t chunk = 0; chunk < chunk_triangles.size(); chunk++)
+    {
+        triangle_bases[chunk + 1] = triangle_bases[chunk] + chunk_triangles[chunk].size();
+    }
+    geometry.triangles.resize(triangle_bases.back());
+    parallel_for(chunk_triangles.size(), [&](const std::size_t chunk)
+    {
+        std::ranges::copy(chunk_triangles[chunk], geometry.triangles.begin() + triangle_bases[chunk]);
+    });
+
+    return true;
+}
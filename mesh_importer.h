@@ -0,0 +1,59 @@
+#ifndef MESH_IMPORTER_H
+#define MESH_IMPORTER_H
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "scene_data.h"
+#include "glm/vec3.hpp"
+
+// Statistics of a mesh import
+struct import_stats
+{
+    std::size_t bytes = 0; // Size of the parsed file
+    std::size_t vertices = 0;
+    std::size_t triangles = 0;
+    double seconds = 0.0; // Time spent mapping and parsing the file
+    unsigned threads = 0; // Number of parser threads
+
+    // Parsing throughput in MB/s
+    [[nodiscard]] double megabytes_per_second() const
+    {
+        return seconds > 0.0 ? static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds : 0.0;
+    }
+};
+
+// Indexed triangle geometry, as expected by mesh_storage
+struct mesh_geometry
+{
+    std::vector<glm::vec3> positions;
+    std::vector<glm::uvec3> triangles;
+};
+
+// Parallel OBJ and PLY parser working on memory-mapped files
+class mesh_importer
+{
+public:
+    // Parse an OBJ or PLY file, chosen by its extension; parser temporaries come from the scratch resource
+    static bool load(const std::string& path, mesh_geometry& geometry, import_stats& stats,
+                     unsigned thread_count = 0,
+                     std::pmr::memory_resource* scratch = std::pmr::get_default_resource());
+
+    // Parse a file and add it to the scene as a mesh; returns its index or -1
+    static int import_mesh(scene_data& scene, const std::string& path,
+                           const scene_data::scene_objects::material& material, import_stats& stats,
+                           std::pmr::memory_resource* scratch = std::pmr::get_default_resource());
+
+private:
+    // Wavefront OBJ: "v" and "f" records, polygons are triangulated as fans
+    static bool load_obj(std::string_view text, mesh_geometry& geometry, unsigned thread_count,
+                         std::pmr::memory_resource* scratch);
+
+    // Stanford PLY: ascii, binary_little_endian and binary_big_endian
+    static bool load_ply(std::string_view text, mesh_geometry& geometry, unsigned thread_count,
+                         std::pmr::memory_resource* scratch);
+};
+
+
+#endif //MESH_IMPORTER_H
@@ -0,0 +1,498 @@
+#include "mesh_storage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "bvh.h"
+#include "memory_tracker.h"
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include "glm/gtc/packing.hpp"
+
+static_assert(sizeof(mesh_storage::mesh_info) == 128, "mesh_info must match the std430 layout of MeshInfo");
+
+// Largest value of a 16-bit quantized coordinate
+constexpr float QUANTIZATION_MAX = 65535.0f;
+
+// Size of the header preceding the mesh infos in the info SSBO (numMeshes + padding)
+constexpr GLsizeiptr MESH_INFO_HEADER_SIZE = 4 * sizeof(int);
+
+std::uint32_t oct_encode(const glm::vec3& normal)
+{
+    // Project the normal onto the octahedron, then fold the lower hemisphere over the upper one
+    const glm::vec3 n = normal / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+    glm::vec2 encoded(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        encoded = glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                            (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    return glm::packSnorm2x16(encoded);
+}
+
+glm::vec3 oct_decode(const std::uint32_t packed)
+{
+    const glm::vec2 encoded = glm::unpackSnorm2x16(packed);
+    glm::vec3 n(encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+    const float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+// Size of one quantization step on each axis of a mesh
+static glm::vec3 quantization_step(const mesh_storage::mesh_info& info)
+{
+    return (info.aabb_max - info.aabb_min) / QUANTIZATION_MAX;
+}
+
+mesh_storage::~mesh_storage()
+{
+    // Delete SSBOs
+    if (info_SSBO != 0)
+    {
+        memory_tracker::release_buffer(info_SSBO);
+        glDeleteBuffers(1, &info_SSBO);
+    }
+    for (const storage_buffer* buffer : {&nodes_buffer, &triangles_buffer, &vertices_buffer})
+    {
+        if (buffer->handle != 0)
+        {
+            memory_tracker::release_buffer(buffer->handle);
+            glDeleteBuffers(1, &buffer->handle);
+        }
+    }
+}
+
+void mesh_storage::create_buffers()
+{
+    glGenBuffers(1, &info_SSBO);
+    glGenBuffers(1, &nodes_buffer.handle);
+    glGenBuffers(1, &triangles_buffer.handle);
+    glGenBuffers(1, &vertices_buffer.handle);
+    dirty = true;
+    rewrite = true;
+    upload();
+}
+
+void mesh_storage::upload()
+{
+    if (!dirty || info_SSBO == 0)
+        return;
+
+    // Upload the part of a buffer that is not on the GPU yet. The buffer grows geometrically, so appending meshes
+    // one after the other only re-uploads everything a logarithmic number of times.
+    const auto upload_buffer = [this](storage_buffer& buffer, const int binding, const void* data,
+                                       const GLsizeiptr size)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer.handle);
+        if (rewrite || size > buffer.capacity || size < buffer.uploaded)
+        {
+            // Keep a minimal allocation when it is empty so the binding stays valid
+            buffer.capacity = std::max<GLsizeiptr>(size + size / 2, 16);
+            buffer.uploaded = 0;
+            glBufferData(GL_SHADER_STORAGE_BUFFER, buffer.capacity, nullptr, GL_STATIC_DRAW);
+            memory_tracker::track_buffer(buffer.handle, gpu_memory_category::storage_buffer, buffer.capacity);
+        }
+        if (size > buffer.uploaded)
+        {
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, buffer.uploaded, size - buffer.uploaded,
+                            static_cast<const char*>(data) + buffer.uploaded);
+            buffer.uploaded = size;
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer.handle);
+    };
+
+    // Mesh infos are preceded by the number of meshes, they are small enough to always be uploaded whole
+    const auto infos_size = static_cast<GLsizeiptr>(infos.size() * sizeof(mesh_info));
+    const std::array<int, 4> header = {num_meshes(), 0, 0, 0};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, info_SSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, MESH_INFO_HEADER_SIZE + infos_size, nullptr, GL_STATIC_DRAW);
+    memory_tracker::track_buffer(info_SSBO, gpu_memory_category::storage_buffer, MESH_INFO_HEADER_SIZE + infos_size);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, MESH_INFO_HEADER_SIZE, header.data());
+    if (infos_size > 0)
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, MESH_INFO_HEADER_SIZE, infos_size, infos.data());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_INFO_SSBO_BINDING, info_SSBO);
+
+    upload_buffer(nodes_buffer, MESH_NODES_SSBO_BINDING, nodes.data(),
+                  static_cast<GLsizeiptr>(nodes.size() * sizeof(scene_data::bvh_node)));
+    upload_buffer(triangles_buffer, MESH_TRIANGLES_SSBO_BINDING, triangles.data(),
+                  static_cast<GLsizeiptr>(triangles.size() * sizeof(glm::uvec4)));
+    upload_buffer(vertices_buffer, MESH_VERTICES_SSBO_BINDING, vertex_words.data(),
+                  static_cast<GLsizeiptr>(vertex_words.size() * sizeof(std::uint32_t)));
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    dirty = false;
+    rewrite = false;
+}
+
+bool mesh_storage::prepare_mesh(const std::span<const glm::vec3> mesh_positions,
+                                const std::span<const glm::uvec3> mesh_triangles,
+                                const std::span<const glm::vec3> mesh_normals,
+                                prepared_mesh& mesh,
+                                std::pmr::memory_resource* scratch)
+{
+    if (mesh_positions.empty() || mesh_triangles.empty())
+    {
+        std::cerr << "Cannot add an empty mesh." << std::endl;
+        return false;
+    }
+    if (!mesh_normals.empty() && mesh_normals.size() != mesh_positions.size())
+    {
+        std::cerr << "Mesh normals do not match the number of vertices." << std::endl;
+        return false;
+    }
+
+    const auto vertex_count = static_cast<unsigned>(mesh_positions.size());
+    for (const auto& triangle : mesh_triangles)
+    {
+        if (triangle.x >= vertex_count || triangle.y >= vertex_count || triangle.z >= vertex_count)
+        {
+            std::cerr << "Mesh triangle references a vertex out of range." << std::endl;
+            return false;
+        }
+    }
+
+    mesh.positions.assign(mesh_positions.begin(), mesh_positions.end());
+
+    // Bounds of the mesh, which are also its quantization grid
+    mesh.aabb_min = glm::vec3(std::numeric_limits<float>::max());
+    mesh.aabb_max = glm::vec3(std::numeric_limits<float>::lowest());
+    for (const auto& position : mesh_positions)
+    {
+        mesh.aabb_min = glm::min(mesh.aabb_min, position);
+        mesh.aabb_max = glm::max(mesh.aabb_max, position);
+    }
+
+    // Use the given normals, or area-weighted smooth normals computed from the faces
+    if (!mesh_normals.empty())
+    {
+        mesh.normals.resize(mesh_normals.size());
+        for (std::size_t i = 0; i < mesh_normals.size(); i++)
+            mesh.normals[i] = glm::normalize(mesh_normals[i]);
+    }
+    else
+    {
+        compute_normals(mesh_positions, mesh_triangles, mesh.normals);
+    }
+
+    // Build the mesh bvh, which reorders the triangles to match its leaves
+    mesh.triangles.resize(mesh_triangles.size());
+    for (std::size_t i = 0; i < mesh_triangles.size(); i++)
+        mesh.triangles[i] = glm::uvec4(mesh_triangles[i], 0u);
+
+    const std::pmr::vector<scene_data::bvh_node> mesh_nodes = bvh_builder::build_mesh_bvh(mesh_positions,
+        mesh.triangles, scratch);
+
+    // Pad the node bounds by half a quantization step so quantized vertices never fall outside them
+    const glm::vec3 padding = (mesh.aabb_max - mesh.aabb_min) / QUANTIZATION_MAX * 0.5f;
+    mesh.nodes.resize(mesh_nodes.size());
+    for (std::size_t i = 0; i < mesh_nodes.size(); i++)
+    {
+        mesh.nodes[i] = mesh_nodes[i];
+        mesh.nodes[i].aabb_min -= padding;
+        mesh.nodes[i].aabb_max += padding;
+    }
+
+    return true;
+}
+
+void mesh_storage::compute_normals(const std::span<const glm::vec3> mesh_positions,
+                                   const std::span<const glm::uvec3> mesh_triangles,
+                                   std::vector<glm::vec3>& mesh_normals)
+{
+    // Area-weighted sum of the face normals around every vertex
+    mesh_normals.assign(mesh_positions.size(), glm::vec3(0.0f));
+    for (const auto& triangle : mesh_triangles)
+    {
+        const glm::vec3& p0 = mesh_positions[triangle.x];
+        const glm::vec3 face_normal = glm::cross(mesh_positions[triangle.y] - p0, mesh_positions[triangle.z] - p0);
+        mesh_normals[triangle.x] += face_normal;
+        mesh_normals[triangle.y] += face_normal;
+        mesh_normals[triangle.z] += face_normal;
+    }
+    for (auto& normal : mesh_normals)
+    {
+        const float length = glm::length(normal);
+        normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+}
+
+int mesh_storage::add_mesh(const std::span<const glm::vec3> mesh_positions,
+                           const std::span<const glm::uvec3> mesh_triangles,
+                           const scene_data::scene_objects::material& material,
+                           const std::span<const glm::vec3> mesh_normals)
+{
+    if (num_meshes() >= MAX_MESHES)
+    {
+        std::cerr << "Maximum number of meshes reached." << std::endl;
+        return -1;
+    }
+
+    prepared_mesh mesh;
+    build_arena.reset();
+    if (!prepare_mesh(mesh_positions, mesh_triangles, mesh_normals, mesh, &build_arena))
+    {
+        return -1;
+    }
+    return add_mesh(mesh, material);
+}
+
+int mesh_storage::add_mesh(const prepared_mesh& mesh, const scene_data::scene_objects::material& material)
+{
+    if (num_meshes() >= MAX_MESHES)
+    {
+        std::cerr << "Maximum number of meshes reached." << std::endl;
+        return -1;
+    }
+
+    mesh_info info{};
+    info.material = material;
+    info.aabb_min = mesh.aabb_min;
+    info.aabb_max = mesh.aabb_max;
+    info.vertex_count = static_cast<int>(mesh.positions.size());
+    info.triangle_count = static_cast<int>(mesh.triangles.size());
+    info.triangle_offset = static_cast<int>(triangles.size());
+    info.node_offset = static_cast<int>(nodes.size());
+
+    // Keep the full precision source of the mesh
+    const int source_offset = static_cast<int>(positions.size());
+    source_offsets.push_back(source_offset);
+    positions.insert(positions.end(), mesh.positions.begin(), mesh.positions.end());
+    normals.insert(normals.end(), mesh.normals.begin(), mesh.normals.end());
+
+    // Append the reordered triangles and the bvh
+    triangles.insert(triangles.end(), mesh.triangles.begin(), mesh.triangles.end());
+    nodes.insert(nodes.end(), mesh.nodes.begin(), mesh.nodes.end());
+
+    encode_mesh(info, source_offset);
+    infos.push_back(info);
+    dirty = true;
+
+    std::cout << "Added mesh " << num_meshes() - 1 << " with " << info.vertex_count << " vertices, "
+        << info.triangle_count << " triangles and " << mesh.nodes.size() << " bvh nodes" << std::endl;
+
+    return num_meshes() - 1;
+}
+
+void mesh_storage::clear()
+{
+    infos.clear();
+    nodes.clear();
+    triangles.clear();
+    vertex_words.clear();
+    positions.clear();
+    normals.clear();
+    source_offsets.clear();
+    dirty = true;
+    rewrite = true;
+}
+
+bool mesh_storage::set_material(const int mesh, const scene_data::scene_objects::material& material)
+{
+    if (mesh < 0 || mesh >= num_meshes())
+        return false;
+
+    // Mesh infos are uploaded whole, the geometry buffers stay as they are
+    infos[mesh].material = material;
+    dirty = true;
+    return true;
+}
+
+bool mesh_storage::assign(const arrays& data)
+{
+    // Check that every mesh stays within the arrays before taking them
+    if (data.infos.size() > MAX_MESHES || data.infos.size() != data.source_offsets.size() ||
+        data.positions.size() != data.normals.size())
+    {
+        std::cerr << "Inconsistent mesh arrays." << std::endl;
+        return false;
+    }
+    const std::size_t vertex_words_per_vertex = data.encoding == vertex_encoding::quantized
+                                                    ? QUANTIZED_VERTEX_WORDS
+                                                    : FULL_VERTEX_WORDS;
+    for (std::size_t mesh = 0; mesh < data.infos.size(); mesh++)
+    {
+        const mesh_info& info = data.infos[mesh];
+        if (info.encoding != static_cast<int>(data.encoding) || info.node_offset < 0 || info.triangle_offset < 0 ||
+            info.vertex_offset < 0 || info.vertex_count < 0 || info.triangle_count < 0 || data.source_offsets[mesh] < 0 ||
+            static_cast<std::size_t>(info.node_offset) >= data.nodes.size() ||
+            static_cast<std::size_t>(info.triangle_offset) + info.triangle_count > data.triangles.size() ||
+            static_cast<std::size_t>(info.vertex_offset) + info.vertex_count * vertex_words_per_vertex >
+            data.vertex_words.size() ||
+            static_cast<std::size_t>(data.source_offsets[mesh]) + info.vertex_count > data.positions.size())
+        {
+            std::cerr << "Mesh " << mesh << " references data out of range." << std::endl;
+            return false;
+        }
+    }
+
+    infos.assign(data.infos.begin(), data.infos.end());
+    nodes.assign(data.nodes.begin(), data.nodes.end());
+    triangles.assign(data.triangles.begin(), data.triangles.end());
+    vertex_words.assign(data.vertex_words.begin(), data.vertex_words.end());
+    positions.assign(data.positions.begin(), data.positions.end());
+    normals.assign(data.normals.begin(), data.normals.end());
+    source_offsets.assign(data.source_offsets.begin(), data.source_offsets.end());
+    encoding = data.encoding;
+    dirty = true;
+    rewrite = true;
+    return true;
+}
+
+mesh_storage::arrays mesh_storage::get_arrays() const
+{
+    return {infos, nodes, triangles, vertex_words, positions, normals, source_offsets, encoding};
+}
+
+void mesh_storage::set_encoding(const vertex_encoding new_encoding)
+{
+    if (encoding == new_encoding)
+        return;
+
+    encoding = new_encoding;
+    encode_vertices();
+
+    if (encoding == vertex_encoding::quantized)
+    {
+        const quantization_report report = validate_quantization();
+        std::cout << "Quantized mesh geometry: max position error " << report.max_position_error
+            << " (tolerance " << report.position_tolerance << "), max normal error "
+            << report.max_normal_error_deg << " deg (tolerance " << report.normal_tolerance_deg << ")"
+            << std::endl;
+        if (!report.within_tolerance)
+        {
+            std::cerr << "WARNING: quantized mesh geometry exceeds the error tolerance!" << std::endl;
+        }
+    }
+}
+
+mesh_storage::quantization_report mesh_storage::validate_quantization() const
+{
+    // 16-bit octahedral normals stay within a few hundredths of a degree, float rounding included
+    quantization_report report;
+    report.normal_tolerance_deg = 0.05f;
+
+    for (int mesh = 0; mesh < num_meshes(); mesh++)
+    {
+        const mesh_info& info = infos[mesh];
+        const glm::vec3 step = quantization_step(info);
+        const int source_offset = source_offsets[mesh];
+        const auto words = std::span(vertex_words).subspan(info.vertex_offset);
+
+        // Rounding to the nearest grid point is off by at most half a step on each axis
+        report.position_tolerance = std::max(report.position_tolerance, 0.5f * glm::length(step) * 1.001f + 1e-6f);
+
+        for (int v = 0; v < info.vertex_count; v++)
+        {
+            glm::vec3 position;
+            glm::vec3 normal;
+            if (info.encoding == static_cast<int>(vertex_encoding::quantized))
+            {
+                const auto* vertex = &words[v * QUANTIZED_VERTEX_WORDS];
+                const glm::vec3 q(vertex[0] & 0xFFFFu, vertex[0] >> 16, vertex[1] & 0xFFFFu);
+                position = info.aabb_min + q * step;
+                normal = oct_decode(vertex[2]);
+            }
+            else
+            {
+                const auto* vertex = reinterpret_cast<const float*>(&words[v * FULL_VERTEX_WORDS]);
+                position = glm::vec3(vertex[0], vertex[1], vertex[2]);
+                normal = glm::vec3(vertex[3], vertex[4], vertex[5]);
+            }
+
+            const glm::vec3& source_normal = normals[source_offset + v];
+            const double cos_angle = std::clamp(static_cast<double>(source_normal.x) * normal.x +
+                                                static_cast<double>(source_normal.y) * normal.y +
+                                                static_cast<double>(source_normal.z) * normal.z, -1.0, 1.0);
+
+            report.max_position_error = std::max(report.max_position_error,
+                                                 glm::distance(position, positions[source_offset + v]));
+            report.max_normal_error_deg = std::max(report.max_normal_error_deg,
+                                                   static_cast<float>(std::acos(cos_angle) * 180.0 / glm::pi<double>()));
+        }
+    }
+
+    report.within_tolerance = report.max_position_error <= report.position_tolerance &&
+        report.max_normal_error_deg <= report.normal_tolerance_deg;
+    return report;
+}
+
+std::size_t mesh_storage::gpu_bytes() const
+{
+    return MESH_INFO_HEADER_SIZE +
+        infos.size() * sizeof(mesh_info) +
+        nodes.size() * sizeof(scene_data::bvh_node) +
+        triangles.size() * sizeof(glm::uvec4) +
+        vertex_words.size() * sizeof(std::uint32_t);
+}
+
+std::size_t mesh_storage::cpu_bytes() const
+{
+    return infos.capacity() * sizeof(mesh_info) +
+        nodes.capacity() * sizeof(scene_data::bvh_node) +
+        triangles.capacity() * sizeof(glm::uvec4) +
+        vertex_words.capacity() * sizeof(std::uint32_t) +
+        positions.capacity() * sizeof(glm::vec3) +
+        normals.capacity() * sizeof(glm::vec3) +
+        source_offsets.capacity() * sizeof(int);
+}
+
+void mesh_storage::encode_vertices()
+{
+    vertex_words.clear();
+    for (int mesh = 0; mesh < num_meshes(); mesh++)
+    {
+        encode_mesh(infos[mesh], source_offsets[mesh]);
+    }
+    dirty = true;
+    rewrite = true;
+}
+
+void mesh_storage::encode_mesh(mesh_info& info, const int source_offset)
+{
+    info.encoding = static_cast<int>(encoding);
+    info.vertex_offset = static_cast<int>(vertex_words.size());
+
+    // Room for the mesh, growing geometrically as the meshes are appended one by one
+    const std::size_t words_per_vertex = encoding == vertex_encoding::quantized
+                                             ? QUANTIZED_VERTEX_WORDS
+                                             : FULL_VERTEX_WORDS;
+    const std::size_t needed = vertex_words.size() + static_cast<std::size_t>(info.vertex_count) * words_per_vertex;
+    if (needed > vertex_words.capacity())
+    {
+        vertex_words.reserve(std::max(needed, 2 * vertex_words.capacity()));
+    }
+
+    if (encoding == vertex_encoding::quantized)
+    {
+        // Positions as 16-bit offsets on the mesh bounds, normals octahedral-encoded
+        const glm::vec3 extent = info.aabb_max - info.aabb_min;
+        const glm::vec3 scale(extent.x > 0.0f ? QUANTIZATION_MAX / extent.x : 0.0f,
+                              extent.y > 0.0f ? QUANTIZATION_MAX / extent.y : 0.0f,
+                              extent.z > 0.0f ? QUANTIZATION_MAX / extent.z : 0.0f);
+
+        for (int v = 0; v < info.vertex_count; v++)
+        {
+            const glm::vec3 q = glm::clamp(glm::round((positions[source_offset + v] - info.aabb_min) * scale),
+                                           0.0f, QUANTIZATION_MAX);
+            vertex_words.push_back(static_cast<std::uint32_t>(q.x) | static_cast<std::uint32_t>(q.y) << 16);
+            vertex_words.push_back(static_cast<std::uint32_t>(q.z));
+            vertex_words.push_back(oct_encode(normals[source_offset + v]));
+        }
+    }
+    else
+    {
+        // Positions and normals as raw floats
+        for (int v = 0; v < info.vertex_count; v++)
+        {
+            const glm::vec3& position = positions[source_offset + v];
+            const glm::vec3& normal = normals[source_offset + v];
+            for (const float value : {position.x, position.y, position.z, normal.x, normal.y, normal.z})
+            {
+                vertex_words.push_back(std::bit_cast<std::uint32_t>(value));
+            }
+        }
+    }
+}
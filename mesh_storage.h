@@ -0,0 +1,194 @@
+#ifndef MESH_STORAGE_H
+#define MESH_STORAGE_H
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+#include "scene_data.h"
+#include "glm/vec3.hpp"
+#include "glm/vec4.hpp"
+
+// Maximum number of meshes referenced by the top-level bvh
+constexpr int MAX_MESHES = 256;
+
+// Maximum number of triangles in a mesh bvh leaf
+constexpr int MAX_MESH_LEAF_SIZE = 4;
+
+// SSBO binding points
+constexpr int MESH_INFO_SSBO_BINDING = 4;
+constexpr int MESH_NODES_SSBO_BINDING = 5;
+constexpr int MESH_TRIANGLES_SSBO_BINDING = 6;
+constexpr int MESH_VERTICES_SSBO_BINDING = 7;
+
+// Number of 32-bit words used by one vertex in each encoding
+constexpr int FULL_VERTEX_WORDS = 6; // xyz position + xyz normal as floats
+constexpr int QUANTIZED_VERTEX_WORDS = 3; // 16-bit xyz position + octahedral snorm16x2 normal
+
+// A mesh with its normals and bvh already computed, ready to be appended to the storage
+struct prepared_mesh
+{
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::uvec4> triangles; // Reordered to match the bvh leaves
+    std::vector<scene_data::bvh_node> nodes; // Padded for quantization, child indices local to the mesh
+    glm::vec3 aabb_min = glm::vec3(0.0f);
+    glm::vec3 aabb_max = glm::vec3(0.0f);
+};
+
+// Indexed triangle meshes stored in shader storage buffers, each with its own bvh
+class mesh_storage
+{
+public:
+    // How mesh vertices are laid out in the vertex buffer
+    enum class vertex_encoding : int
+    {
+        full_precision = 0,
+        quantized = 1
+    };
+
+    // Per-mesh header, mirrored by MeshInfo in raytracer.comp (std430)
+    struct mesh_info
+    {
+        glm::vec3 aabb_min; // Also the origin of the quantization grid
+        int node_offset = 0; // First node of the mesh bvh in the node buffer
+        glm::vec3 aabb_max;
+        int triangle_offset = 0; // First triangle in the triangle buffer
+        int vertex_offset = 0; // First word of the mesh vertices in the vertex buffer
+        int encoding = 0; // vertex_encoding of the mesh
+        int triangle_count = 0;
+        int vertex_count = 0;
+        scene_data::scene_objects::material material;
+    };
+
+    // Result of comparing the decoded geometry against the full precision source
+    struct quantization_report
+    {
+        float max_position_error = 0.0f; // Largest decoded position error, in world units
+        float position_tolerance = 0.0f; // Half a quantization step on the largest mesh axis
+        float max_normal_error_deg = 0.0f; // Largest decoded normal error, in degrees
+        float normal_tolerance_deg = 0.0f;
+        bool within_tolerance = true;
+    };
+
+    // Views on every array of the storage, as laid out on the GPU, and on the full precision source
+    struct arrays
+    {
+        std::span<const mesh_info> infos;
+        std::span<const scene_data::bvh_node> nodes;
+        std::span<const glm::uvec4> triangles;
+        std::span<const std::uint32_t> vertex_words;
+        std::span<const glm::vec3> positions;
+        std::span<const glm::vec3> normals;
+        std::span<const int> source_offsets;
+        vertex_encoding encoding = vertex_encoding::full_precision;
+    };
+
+    mesh_storage() = default;
+    ~mesh_storage();
+
+    mesh_storage(const mesh_storage&) = delete;
+    mesh_storage& operator=(const mesh_storage&) = delete;
+
+    // Create the shader storage buffers
+    void create_buffers();
+
+    // Upload the encoded meshes if they changed since the last upload
+    void upload();
+
+    // Add a mesh, computing smooth normals when none are given; returns its index or -1
+    int add_mesh(std::span<const glm::vec3> positions, std::span<const glm::uvec3> triangles,
+                 const scene_data::scene_objects::material& material = {},
+                 std::span<const glm::vec3> normals = {});
+
+    // Append a mesh prepared by prepare_mesh; returns its index or -1
+    int add_mesh(const prepared_mesh& mesh, const scene_data::scene_objects::material& material = {});
+
+    // Validate a mesh, compute its normals when none are given and build its bvh. Touches no shared state, so
+    // loader threads can prepare meshes while the storage renders.
+    static bool prepare_mesh(std::span<const glm::vec3> positions, std::span<const glm::uvec3> triangles,
+                             std::span<const glm::vec3> normals, prepared_mesh& mesh,
+                             std::pmr::memory_resource* scratch = std::pmr::get_default_resource());
+
+    // Area-weighted smooth vertex normals
+    static void compute_normals(std::span<const glm::vec3> positions, std::span<const glm::uvec3> triangles,
+                                std::vector<glm::vec3>& normals);
+
+    // Remove all meshes
+    void clear();
+
+    // Change the material of a mesh; returns false if the index is out of range
+    bool set_material(int mesh, const scene_data::scene_objects::material& material);
+
+    // Replace every mesh with prebuilt arrays, copied as they are; returns false if they are inconsistent
+    bool assign(const arrays& data);
+    [[nodiscard]] arrays get_arrays() const;
+
+    // Re-encode every mesh with the given vertex encoding
+    void set_encoding(vertex_encoding encoding);
+    [[nodiscard]] vertex_encoding get_encoding() const { return encoding; }
+
+    // Decode the vertices of every mesh and compare them against the full precision source
+    [[nodiscard]] quantization_report validate_quantization() const;
+
+    // Accessors
+    [[nodiscard]] int num_meshes() const { return static_cast<int>(infos.size()); }
+    [[nodiscard]] const std::vector<mesh_info>& get_infos() const { return infos; }
+    [[nodiscard]] std::vector<mesh_info>& get_infos() { return infos; }
+    [[nodiscard]] std::size_t num_triangles() const { return triangles.size(); }
+    [[nodiscard]] std::size_t num_vertices() const { return positions.size(); }
+
+    // Size of the encoded geometry on the GPU, in bytes
+    [[nodiscard]] std::size_t gpu_bytes() const;
+
+    // Size of the CPU copies of the geometry and of its full precision source, in bytes
+    [[nodiscard]] std::size_t cpu_bytes() const;
+
+    [[nodiscard]] const memory_arena& get_build_arena() const { return build_arena; }
+
+private:
+    // GPU-side arrays
+    std::vector<mesh_info> infos;
+    std::vector<scene_data::bvh_node> nodes;
+    std::vector<glm::uvec4> triangles; // Mesh-local vertex indices, reordered to match the bvh leaves
+    std::vector<std::uint32_t> vertex_words;
+
+    // Full precision source of every mesh, kept to re-encode and validate
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<int> source_offsets; // First source vertex of each mesh
+
+    vertex_encoding encoding = vertex_encoding::full_precision;
+    bool dirty = true;
+    bool rewrite = true; // Data already on the GPU changed, not only appended
+
+    // Scratch memory of the mesh bvh builds
+    memory_arena build_arena;
+
+    // Shader storage buffer extended in place when meshes are appended
+    struct storage_buffer
+    {
+        GLuint handle = 0;
+        GLsizeiptr capacity = 0; // Allocated bytes
+        GLsizeiptr uploaded = 0; // Bytes already on the GPU
+    };
+
+    // SSBO handles
+    GLuint info_SSBO = 0;
+    storage_buffer nodes_buffer;
+    storage_buffer triangles_buffer;
+    storage_buffer vertices_buffer;
+
+    // Rebuild the vertex buffer of every mesh with the current encoding
+    void encode_vertices();
+
+    // Append the encoded vertices of one mesh
+    void encode_mesh(mesh_info& info, int source_offset);
+};
+
+// Octahedral normal encoding, bit-compatible with oct_decode in raytracer.comp
+std::uint32_t oct_encode(const glm::vec3& normal);
+glm::vec3 oct_decode(std::uint32_t packed);
+
+
+#endif //MESH_STORAGE_H
@@ -0,0 +1,260 @@
+#include "mesh_streamer.h"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+
+#include "memory_arena.h"
+#include "mesh_importer.h"
+#include "glm/common.hpp"
+
+// Spread the lower 10 bits of a value so two zero bits separate each of them
+static std::uint32_t expand_bits(std::uint32_t value)
+{
+    value = (value * 0x00010001u) & 0xFF0000FFu;
+    value = (value * 0x00000101u) & 0x0F00F00Fu;
+    value = (value * 0x00000011u) & 0xC30C30C3u;
+    value = (value * 0x00000005u) & 0x49249249u;
+    return value;
+}
+
+// 30-bit Morton code of a point normalized to the unit cube
+static std::uint32_t morton_code(const glm::vec3& point)
+{
+    const glm::vec3 scaled = glm::clamp(point * 1024.0f, 0.0f, 1023.0f);
+    return expand_bits(static_cast<std::uint32_t>(scaled.x)) << 2 |
+        expand_bits(static_cast<std::uint32_t>(scaled.y)) << 1 |
+        expand_bits(static_cast<std::uint32_t>(scaled.z));
+}
+
+mesh_streamer::~mesh_streamer()
+{
+    cancel();
+}
+
+bool mesh_streamer::start(const std::string& path, const scene_data::scene_objects::material& material,
+                          const int free_mesh_slots)
+{
+    if (is_running())
+    {
+        std::cerr << "A mesh is already being streamed." << std::endl;
+        return false;
+    }
+    if (free_mesh_slots <= 0)
+    {
+        std::cerr << "Maximum number of meshes reached." << std::endl;
+        return false;
+    }
+
+    // Join the previous load, if any
+    cancel();
+
+    {
+        std::lock_guard lock(mutex);
+        ready.clear();
+        status = {};
+        status.current = state::parsing;
+        chunk_material = material;
+        start_time = std::chrono::steady_clock::now();
+    }
+
+    const int max_chunks = std::min(free_mesh_slots, MAX_STREAM_CHUNKS);
+    worker = std::jthread([this, path, max_chunks](const std::stop_token& stop) { run(stop, path, max_chunks); });
+    return true;
+}
+
+void mesh_streamer::cancel()
+{
+    if (worker.joinable())
+    {
+        worker.request_stop();
+        worker.join();
+    }
+
+    std::lock_guard lock(mutex);
+    ready.clear();
+    if (status.current == state::parsing || status.current == state::building)
+    {
+        status.current = state::idle;
+    }
+}
+
+int mesh_streamer::poll(scene_data& scene, const int max_chunks)
+{
+    // Take the finished chunks without holding the lock while they are added
+    std::vector<prepared_mesh> chunks;
+    scene_data::scene_objects::material material;
+    {
+        std::lock_guard lock(mutex);
+        while (!ready.empty() && static_cast<int>(chunks.size()) < max_chunks)
+        {
+            chunks.push_back(std::move(ready.front()));
+            ready.pop_front();
+        }
+        material = chunk_material;
+    }
+    if (chunks.empty())
+    {
+        return 0;
+    }
+
+    // One top-level bvh rebuild for every chunk of this frame
+    int added = 0;
+    std::size_t triangles = 0;
+    {
+        scene_data::edit_transaction edit(scene);
+        for (const prepared_mesh& chunk : chunks)
+        {
+            if (scene.add_mesh(chunk, material) < 0)
+                break;
+            added++;
+            triangles += chunk.triangles.size();
+        }
+    }
+
+    std::lock_guard lock(mutex);
+    status.chunks_added += added;
+    status.triangles_added += triangles;
+    if (added < static_cast<int>(chunks.size()))
+    {
+        std::cerr << "Stopped streaming, the scene has no mesh slot left." << std::endl;
+        status.current = state::failed;
+        worker.request_stop();
+        ready.clear();
+    }
+    return added;
+}
+
+mesh_streamer::progress mesh_streamer::get_progress() const
+{
+    std::lock_guard lock(mutex);
+    progress current = status;
+    if (current.current == state::parsing || current.current == state::building)
+    {
+        current.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    }
+    return current;
+}
+
+bool mesh_streamer::is_running() const
+{
+    std::lock_guard lock(mutex);
+    return status.current == state::parsing || status.current == state::building ||
+        (status.current == state::done && !ready.empty());
+}
+
+void mesh_streamer::run(const std::stop_token& stop, const std::string& path, const int max_chunks)
+{
+    const auto fail = [this]
+    {
+        std::lock_guard lock(mutex);
+        status.current = state::failed;
+    };
+
+    // Parse the whole file with the parallel importer
+    mesh_geometry geometry;
+    import_stats stats;
+    if (!mesh_importer::load(path, geometry, stats) || geometry.triangles.empty())
+    {
+        fail();
+        return;
+    }
+    if (stop.stop_requested())
+        return;
+
+    // Smooth normals over the whole mesh, so chunk borders show no seams
+    std::vector<glm::vec3> normals;
+    mesh_storage::compute_normals(geometry.positions, geometry.triangles, normals);
+
+    // Order the triangles along a Morton curve so every chunk covers a compact region
+    auto bounds_min = glm::vec3(std::numeric_limits<float>::max());
+    auto bounds_max = glm::vec3(std::numeric_limits<float>::lowest());
+    for (const auto& position : geometry.positions)
+    {
+        bounds_min = glm::min(bounds_min, position);
+        bounds_max = glm::max(bounds_max, position);
+    }
+    const glm::vec3 extent = glm::max(bounds_max - bounds_min, glm::vec3(1e-6f));
+
+    const std::size_t triangle_count = geometry.triangles.size();
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> order(triangle_count);
+    for (std::size_t i = 0; i < triangle_count; i++)
+    {
+        const glm::uvec3& triangle = geometry.triangles[i];
+        const glm::vec3 centroid = (geometry.positions[triangle.x] + geometry.positions[triangle.y] +
+            geometry.positions[triangle.z]) / 3.0f;
+        order[i] = {morton_code((centroid - bounds_min) / extent), static_cast<std::uint32_t>(i)};
+    }
+    std::ranges::sort(order);
+    if (stop.stop_requested())
+        return;
+
+    const std::size_t chunk_size = std::max<std::size_t>(STREAM_CHUNK_TRIANGLES,
+                                                         (triangle_count + max_chunks - 1) / max_chunks);
+    const int chunk_count = static_cast<int>((triangle_count + chunk_size - 1) / chunk_size);
+    {
+        std::lock_guard lock(mutex);
+        status.current = state::building;
+        status.chunks_total = chunk_count;
+        status.triangles_total = triangle_count;
+    }
+
+    // Build every chunk with its own vertices and bvh
+    memory_arena scratch;
+    std::vector<int> remap(geometry.positions.size(), -1);
+    std::vector<glm::vec3> chunk_positions;
+    std::vector<glm::vec3> chunk_normals;
+    std::vector<glm::uvec3> chunk_triangles;
+    for (int chunk = 0; chunk < chunk_count && !stop.stop_requested(); chunk++)
+    {
+        const std::size_t first = chunk * chunk_size;
+        const std::size_t last = std::min(first + chunk_size, triangle_count);
+
+        // Gather the vertices used by the chunk, in first-use order
+        chunk_positions.clear();
+        chunk_normals.clear();
+        chunk_triangles.clear();
+        const auto local_vertex = [&](const unsigned vertex)
+        {
+            if (remap[vertex] < 0)
+            {
+                remap[vertex] = static_cast<int>(chunk_positions.size());
+                chunk_positions.push_back(geometry.positions[vertex]);
+                chunk_normals.push_back(normals[vertex]);
+            }
+            return static_cast<unsigned>(remap[vertex]);
+        };
+        for (std::size_t i = first; i < last; i++)
+        {
+            const glm::uvec3& triangle = geometry.triangles[order[i].second];
+            chunk_triangles.emplace_back(local_vertex(triangle.x), local_vertex(triangle.y), local_vertex(triangle.z));
+        }
+
+        // Reset the remap for the next chunk, touching only the vertices of this one
+        for (std::size_t i = first; i < last; i++)
+        {
+            const glm::uvec3& triangle = geometry.triangles[order[i].second];
+            remap[triangle.x] = remap[triangle.y] = remap[triangle.z] = -1;
+        }
+
+        prepared_mesh mesh;
+        scratch.reset();
+        if (!mesh_storage::prepare_mesh(chunk_positions, chunk_triangles, chunk_normals, mesh, &scratch))
+        {
+            fail();
+            return;
+        }
+
+        std::lock_guard lock(mutex);
+        ready.push_back(std::move(mesh));
+        status.chunks_built++;
+    }
+
+    std::lock_guard lock(mutex);
+    if (!stop.stop_requested())
+    {
+        status.current = state::done;
+        status.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << "Streamed " << path << " in " << chunk_count << " chunks, " << status.seconds << " s" << std::endl;
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef MESH_STREAMER_H
+#define MESH_STREAMER_H
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "mesh_storage.h"
+#include "scene_data.h"
+
+// Smallest number of triangles in a streamed chunk
+constexpr int STREAM_CHUNK_TRIANGLES = 64 * 1024;
+
+// Largest number of chunks a streamed mesh is split into, each one uses a mesh slot
+constexpr int MAX_STREAM_CHUNKS = MAX_MESHES / 2;
+
+// Loads a large mesh on a background thread and hands it to the scene in spatially coherent chunks, each with its
+// own bvh, so the renderer stays interactive and shows the geometry as it arrives.
+class mesh_streamer
+{
+public:
+    enum class state : int
+    {
+        idle = 0,
+        parsing,
+        building,
+        done,
+        failed
+    };
+
+    // Loading progress, for the UI
+    struct progress
+    {
+        state current = state::idle;
+        int chunks_total = 0; // Known once the file is parsed
+        int chunks_built = 0;
+        int chunks_added = 0;
+        std::size_t triangles_total = 0;
+        std::size_t triangles_added = 0;
+        double seconds = 0.0; // Since the start of the load
+    };
+
+    mesh_streamer() = default;
+    ~mesh_streamer();
+
+    mesh_streamer(const mesh_streamer&) = delete;
+    mesh_streamer& operator=(const mesh_streamer&) = delete;
+
+    // Start loading a file in the background, using at most free_mesh_slots chunks; fails if a load is running
+    bool start(const std::string& path, const scene_data::scene_objects::material& material, int free_mesh_slots);
+
+    // Stop the current load, chunks already added stay in the scene
+    void cancel();
+
+    // Add the chunks that finished building since the last call, at most max_chunks of them, with a single bvh
+    // rebuild. Call once per frame from the thread that owns the scene; returns the number of chunks added.
+    int poll(scene_data& scene, int max_chunks = 8);
+
+    [[nodiscard]] progress get_progress() const;
+    [[nodiscard]] bool is_running() const;
+
+private:
+    std::jthread worker;
+
+    // Chunks waiting to be added to the scene
+    mutable std::mutex mutex;
+    std::deque<prepared_mesh> ready;
+    progress status;
+    scene_data::scene_objects::material chunk_material;
+    std::chrono::steady_clock::time_point start_time;
+
+    // Parse the file, split it and build the chunks
+    void run(const std::stop_token& stop, const std::string& path, int max_chunks);
+};
+
+
+#endif //MESH_STREAMER_H
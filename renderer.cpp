@@ -1,14 +1,31 @@
 #include "renderer.h"
 
 #include <iostream>
-#include <sstream>
 #include <format>
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
+#include "mesh_storage.h"
+#include "scene_file.h"
+#include "scene_snapshot.h"
 #include "glm/gtc/type_ptr.hpp"
 
+// Material given to imported and streamed meshes
+static scene_data::scene_objects::material imported_mesh_material()
+{
+    return {glm::vec3(0.7f), glm::vec3(0.3f), glm::vec3(0.1f)};
+}
+
+// Format a UI string in the per-frame arena
+template <typename... Args>
+static std::pmr::string format_ui(memory_arena& arena, std::format_string<Args...> format, Args&&... args)
+{
+    std::pmr::string text(&arena);
+    std::format_to(std::back_inserter(text), format, std::forward<Args>(args)...);
+    return text;
+}
+
 void gl3::renderer::init_window()
 {
     glfwInit();
@@ -157,6 +174,197 @@ void gl3::renderer::render_ui()
     }
     ImGui::SameLine();
     ImGui::Text("Press R to toggle between compute and fragment shader");
+
+    // Progressive accumulation of the compute shader
+    if (use_compute_shader && compute_rend)
+    {
+        if (bool accumulate = compute_rend->is_accumulating(); ImGui::Checkbox("Accumulate samples", &accumulate))
+        {
+            compute_rend->set_accumulation(accumulate);
+        }
+        if (compute_rend->is_accumulating())
+        {
+            ImGui::SameLine();
+            ImGui::Text("%u / %u frames", compute_rend->get_accumulated_frames(),
+                        compute_rend->get_max_accumulated_frames());
+            if (int max_frames = static_cast<int>(compute_rend->get_max_accumulated_frames()); ImGui::SliderInt(
+                "Max frames", &max_frames, 1, static_cast<int>(MAX_ACCUMULATED_FRAMES)))
+            {
+                compute_rend->set_max_accumulated_frames(static_cast<unsigned>(max_frames));
+            }
+
+            // Adaptive sampling, with the time every pixel took to get below the error threshold
+            if (bool adaptive = compute_rend->is_adaptive_sampling(); ImGui::Checkbox("Adaptive sampling", &adaptive))
+            {
+                compute_rend->set_adaptive_sampling(adaptive);
+            }
+            ImGui::SameLine();
+            if (bool heatmap = compute_rend->is_sample_heatmap_shown(); ImGui::Checkbox("Sample heatmap", &heatmap))
+            {
+                compute_rend->set_sample_heatmap(heatmap);
+            }
+            if (float threshold = compute_rend->get_adaptive_threshold(); ImGui::SliderFloat(
+                "Error threshold", &threshold, 0.001f, 0.2f, "%.3f", ImGuiSliderFlags_Logarithmic))
+            {
+                compute_rend->set_adaptive_threshold(threshold);
+            }
+            if (const double seconds = compute_rend->get_converged_seconds(); seconds >= 0.0)
+            {
+                ImGui::Text("Converged in %.2f s", seconds);
+            }
+            else
+            {
+                ImGui::Text("%u noisy pixels", compute_rend->get_noisy_pixels());
+            }
+        }
+
+        // Tiled dispatch under a GPU time budget
+        if (float budget = compute_rend->get_frame_budget(); ImGui::SliderFloat(
+            "Frame budget (ms)", &budget, 0.0f, 50.0f, "%.1f"))
+        {
+            compute_rend->set_frame_budget(budget);
+        }
+        ImGui::SameLine();
+        ImGui::Text("0 traces the whole image every frame");
+        ImGui::Text("%d / %d tiles per frame", compute_rend->get_last_frame_tiles(), compute_rend->get_tile_count());
+
+        // Dynamic resolution while the view moves
+        if (bool dynamic = compute_rend->is_dynamic_resolution(); ImGui::Checkbox("Dynamic resolution", &dynamic))
+        {
+            compute_rend->set_dynamic_resolution(dynamic);
+        }
+        if (float target = compute_rend->get_target_frame_time(); ImGui::SliderFloat(
+            "Target frame time (ms)", &target, 1.0f, 50.0f, "%.1f"))
+        {
+            compute_rend->set_target_frame_time(target);
+        }
+        const glm::ivec2 render_size = compute_rend->get_render_size();
+        ImGui::Text("Render scale %.2f (%d x %d)", compute_rend->get_render_scale(), render_size.x, render_size.y);
+
+        // Checkerboard rendering of the first pass after a change
+        if (int pattern = static_cast<int>(compute_rend->get_checkerboard()); ImGui::Combo(
+            "Checkerboard", &pattern, "Off\0Half\0Quarter\0"))
+        {
+            compute_rend->set_checkerboard(static_cast<checkerboard_mode>(pattern));
+        }
+
+        // Temporal reprojection, blends the previous frames in while the view moves
+        if (bool temporal = compute_rend->is_temporal(); ImGui::Checkbox("Temporal reprojection", &temporal))
+        {
+            compute_rend->set_temporal(temporal);
+        }
+
+        // A-trous denoiser and its edge-stopping weights
+        if (bool denoise = compute_rend->is_denoising(); ImGui::Checkbox("Denoise", &denoise))
+        {
+            compute_rend->set_denoise(denoise);
+        }
+        if (compute_rend->is_denoising())
+        {
+            if (int iterations = compute_rend->get_denoise_iterations(); ImGui::SliderInt(
+                "Denoise iterations", &iterations, 1, MAX_DENOISE_ITERATIONS))
+            {
+                compute_rend->set_denoise_iterations(iterations);
+            }
+            if (glm::vec3 sigmas = compute_rend->get_denoise_sigmas(); ImGui::DragFloat3(
+                "Normal / depth / luminance", glm::value_ptr(sigmas), 0.1f, 0.0f, 256.0f))
+            {
+                compute_rend->set_denoise_sigmas(sigmas.x, sigmas.y, sigmas.z);
+            }
+        }
+
+        // Format of the displayed image, the 8 bit one is tone mapped before the display pass
+        if (int output = static_cast<int>(compute_rend->get_output_format()); ImGui::Combo(
+            "Output format", &output, "RGBA16F\0R11F_G11F_B10F\0RGBA8 (tone mapped)\0"))
+        {
+            compute_rend->set_output_format(static_cast<output_format>(output));
+        }
+        if (bool tone_mapping = compute_rend->is_tone_mapping(); ImGui::Checkbox("Tone mapping", &tone_mapping))
+        {
+            compute_rend->set_tone_mapping(tone_mapping);
+        }
+        if (compute_rend->is_tone_mapping())
+        {
+            ImGui::SameLine();
+            if (float exposure = compute_rend->get_exposure(); ImGui::SliderFloat(
+                "Exposure", &exposure, 0.1f, 8.0f, "%.2f", ImGuiSliderFlags_Logarithmic))
+            {
+                compute_rend->set_exposure(exposure);
+            }
+        }
+
+        // Tracing mode, with the GPU time of a tile in each mode to compare them
+        if (int mode = static_cast<int>(compute_rend->get_trace_mode()); ImGui::Combo(
+            "Trace mode", &mode, "Megakernel\0Wavefront\0Persistent threads\0"))
+        {
+            compute_rend->set_trace_mode(static_cast<trace_mode>(mode));
+        }
+        if (bool short_stack = compute_rend->is_short_stack_traversal(); ImGui::Checkbox(
+            "Short stack BVH traversal", &short_stack))
+        {
+            compute_rend->set_short_stack_traversal(short_stack);
+        }
+        if (int levels = compute_rend->get_bvh_shared_levels(); ImGui::SliderInt(
+            "BVH levels in shared memory", &levels, 0, MAX_BVH_SHARED_LEVELS))
+        {
+            compute_rend->set_bvh_shared_levels(levels);
+        }
+        if (compute_rend->get_subgroup_size() > 0)
+        {
+            if (bool subgroup = compute_rend->is_subgroup_traversal(); ImGui::Checkbox(
+                "Subgroup BVH traversal", &subgroup))
+            {
+                compute_rend->set_subgroup_traversal(subgroup);
+            }
+            ImGui::SameLine();
+            ImGui::Text("%d lanes", compute_rend->get_subgroup_size());
+            if (ImGui::Button("Check against the scalar traversal"))
+            {
+                compute_rend->check_subgroup_traversal();
+            }
+            if (const int mismatches = compute_rend->get_subgroup_mismatches(); mismatches >= 0)
+            {
+                ImGui::SameLine();
+                ImGui::Text("%d pixels differ", mismatches);
+            }
+        }
+        else
+        {
+            ImGui::TextDisabled("Subgroup BVH traversal: not supported");
+        }
+        if (compute_rend->get_trace_mode() == trace_mode::megakernel)
+        {
+            if (bool frustum = compute_rend->is_tile_frustum(); ImGui::Checkbox(
+                "Frustum traversal of the primary rays", &frustum))
+            {
+                compute_rend->set_tile_frustum(frustum);
+            }
+        }
+        ImGui::Text("Megakernel: %.3f ms per tile, wavefront: %.3f ms per tile",
+                    compute_rend->get_tile_milliseconds(trace_mode::megakernel),
+                    compute_rend->get_tile_milliseconds(trace_mode::wavefront));
+        ImGui::Text("Persistent threads: %.3f ms per tile",
+                    compute_rend->get_tile_milliseconds(trace_mode::persistent));
+        if (compute_rend->get_trace_mode() == trace_mode::wavefront)
+        {
+            // Sorting the rays by bin, with its effect on the throughput and on the work groups
+            if (bool binning = compute_rend->is_ray_binning(); ImGui::Checkbox("Ray binning", &binning))
+            {
+                compute_rend->set_ray_binning(binning);
+            }
+            ImGui::Text("%.1f Mrays/s, %.0f%% of the rays in another bin than their neighbour",
+                        compute_rend->get_rays_per_second() / 1e6, compute_rend->get_ray_divergence() * 100.0);
+            ImGui::Text("%u rays dropped by full queues", compute_rend->get_dropped_rays());
+        }
+        if (compute_rend->get_trace_mode() == trace_mode::persistent)
+        {
+            if (int groups = compute_rend->get_persistent_work_groups(); ImGui::SliderInt(
+                "Work groups", &groups, 1, 4096))
+            {
+                compute_rend->set_persistent_work_groups(groups);
+            }
+        }
+    }
     ImGui::Separator();
 
     // Tab selection
@@ -245,7 +453,7 @@ void gl3::renderer::render_ui()
             {
                 ImGui::PushID(i);
 
-                if (std::string label = std::format("CSG Sphere {}", std::to_string(i + 1)); ImGui::TreeNode(
+                if (std::pmr::string label = format_ui(ui_arena, "CSG Sphere {}", i + 1); ImGui::TreeNode(
                     label.c_str()))
                 {
                     glm::vec3 pos = objects.csg_spheres[i].position;
@@ -270,6 +478,10 @@ void gl3::renderer::render_ui()
             ImGui::Separator();
             ImGui::Text("BVH Settings");
             ImGui::Text("BVH nodes: %d", scene_data.get_bvh().num_nodes);
+            if (const auto snapshot = scene_data.snapshot())
+            {
+                ImGui::Text("Scene version: %llu", static_cast<unsigned long long>(snapshot->version));
+            }
 
             // Button to rebuild BVH
             if (ImGui::Button("Rebuild BVH"))
@@ -279,6 +491,139 @@ void gl3::renderer::render_ui()
             ImGui::SameLine();
             ImGui::Text("Use this to rebuild the BVH when you add or remove objects");
 
+            // Mesh settings
+            ImGui::Separator();
+            ImGui::Text("Meshes");
+            auto& meshes = scene_data.get_meshes();
+            ImGui::Text("Meshes: %d, triangles: %zu, vertices: %zu", meshes.num_meshes(), meshes.num_triangles(),
+                        meshes.num_vertices());
+            ImGui::Text("Geometry size: %.2f MB", static_cast<double>(meshes.gpu_bytes()) / (1024.0 * 1024.0));
+
+            // Compressed geometry encoding
+            if (bool compress = meshes.get_encoding() == mesh_storage::vertex_encoding::quantized; ImGui::Checkbox(
+                "Compress geometry", &compress))
+            {
+                meshes.set_encoding(compress
+                                        ? mesh_storage::vertex_encoding::quantized
+                                        : mesh_storage::vertex_encoding::full_precision);
+                quantization_report = meshes.validate_quantization();
+            }
+            ImGui::SameLine();
+            ImGui::Text("16-bit positions and octahedral normals");
+
+            if (ImGui::Button("Validate geometry"))
+            {
+                quantization_report = meshes.validate_quantization();
+            }
+            ImGui::SameLine();
+            ImGui::Text("Position error: %g (tolerance %g), normal error: %.4f deg (%s)",
+                        quantization_report.max_position_error, quantization_report.position_tolerance,
+                        quantization_report.max_normal_error_deg,
+                        quantization_report.within_tolerance ? "ok" : "out of tolerance");
+
+            // Mesh import
+            ImGui::InputText("Mesh file", mesh_path.data(), mesh_path.size());
+            if (ImGui::Button("Import mesh"))
+            {
+                import_arena.reset();
+                if (mesh_importer::import_mesh(scene_data, mesh_path.data(), imported_mesh_material(), last_import,
+                                               &import_arena) >= 0)
+                {
+                    quantization_report = meshes.validate_quantization();
+                }
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Stream mesh"))
+            {
+                streamer.start(mesh_path.data(), imported_mesh_material(), MAX_MESHES - meshes.num_meshes());
+            }
+            ImGui::SameLine();
+            ImGui::Text("OBJ or PLY, parsed in parallel from a memory-mapped file");
+            if (last_import.bytes > 0)
+            {
+                ImGui::Text("Last import: %zu vertices, %zu triangles, %.1f ms, %.1f MB/s on %u threads",
+                            last_import.vertices, last_import.triangles, last_import.seconds * 1000.0,
+                            last_import.megabytes_per_second(), last_import.threads);
+            }
+
+            // Background streaming progress
+            if (const mesh_streamer::progress stream = streamer.get_progress();
+                stream.current != mesh_streamer::state::idle)
+            {
+                constexpr std::array<const char*, 5> stream_states = {"idle", "parsing", "building", "done", "failed"};
+                const float fraction = stream.chunks_total > 0
+                                           ? static_cast<float>(stream.chunks_added) / static_cast<float>(stream.
+                                               chunks_total)
+                                           : 0.0f;
+                ImGui::ProgressBar(fraction, ImVec2(-1.0f, 0.0f),
+                                   format_ui(ui_arena, "{}: {}/{} chunks", stream_states[static_cast<int>(stream.current)],
+                                             stream.chunks_added, stream.chunks_total).c_str());
+                ImGui::Text("Streamed %zu / %zu triangles in %.1f s", stream.triangles_added, stream.triangles_total,
+                            stream.seconds);
+                if (streamer.is_running() && ImGui::Button("Cancel streaming"))
+                {
+                    streamer.cancel();
+                }
+            }
+
+            // Edits from other threads
+            if (const scene_edit_queue::statistics edits = edit_queue.get_statistics(); edits.pushed > 0)
+            {
+                ImGui::Text("Queued edits: %zu pushed, %zu applied, %zu coalesced, %zu dropped", edits.pushed,
+                            edits.applied, edits.coalesced, edits.dropped);
+            }
+
+            // Memory accounting
+            ImGui::Separator();
+            const memory_tracker::report memory = get_memory_report();
+            constexpr double megabyte = 1024.0 * 1024.0;
+            ImGui::Text("GPU memory: %.2f MB, %zu allocations, %zu releases",
+                        static_cast<double>(memory.gpu.total_bytes()) / megabyte, memory.gpu.allocations,
+                        memory.gpu.releases);
+            for (std::size_t i = 0; i < GPU_MEMORY_CATEGORY_NAMES.size(); i++)
+            {
+                ImGui::BulletText("%s: %.2f MB in %zu objects", GPU_MEMORY_CATEGORY_NAMES[i],
+                                  static_cast<double>(memory.gpu.bytes[i]) / megabyte, memory.gpu.objects[i]);
+            }
+            ImGui::Text("CPU memory: %.2f MB", static_cast<double>(memory.cpu.total_bytes()) / megabyte);
+            ImGui::BulletText("Scene and BVH: %.2f MB", static_cast<double>(memory.cpu.scene) / megabyte);
+            ImGui::BulletText("Published snapshot: %.2f MB", static_cast<double>(memory.cpu.snapshots) / megabyte);
+            ImGui::BulletText("Meshes: %.2f MB", static_cast<double>(memory.cpu.meshes) / megabyte);
+            ImGui::BulletText("Arenas: %.2f MB", static_cast<double>(memory.cpu.arenas) / megabyte);
+
+            // Scratch memory
+            ImGui::Separator();
+            ImGui::Text("Memory arenas");
+            const auto arena_text = [](const char* name, const memory_arena& arena)
+            {
+                const memory_arena::statistics stats = arena.get_statistics();
+                ImGui::Text("%s: %zu allocations, %zu from the heap, %.1f / %.1f KB (peak %.1f KB)", name,
+                            stats.allocations, stats.heap_allocations, static_cast<double>(stats.bytes) / 1024.0,
+                            static_cast<double>(stats.capacity) / 1024.0, static_cast<double>(stats.peak_bytes) / 1024.0);
+            };
+            arena_text("BVH build", scene_data.get_build_arena());
+            arena_text("Mesh BVH build", meshes.get_build_arena());
+            arena_text("Mesh import", import_arena);
+            arena_text("UI strings", ui_arena);
+
+            // Binary scene file
+            ImGui::Separator();
+            ImGui::Text("Scene file");
+            ImGui::InputText("Scene path", scene_path.data(), scene_path.size());
+            if (ImGui::Button("Save scene"))
+            {
+                scene_file::save(scene_data, scene_path.data());
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Load scene") && scene_file::load(scene_data, scene_path.data()))
+            {
+                // Move the interactive camera to the loaded one
+                const auto& camera_data = scene_data.get_camera();
+                camera.position = camera_data.position;
+                camera.orientation = glm::normalize(camera_data.target - camera_data.position);
+                quantization_report = meshes.validate_quantization();
+            }
+
             ImGui::EndTabItem();
         }
 
@@ -375,7 +720,7 @@ void gl3::renderer::render_ui()
                 {
                     ImGui::PushID(i);
 
-                    if (std::string label = std::format("Sphere {}", std::to_string(i + 1)); ImGui::TreeNode(
+                    if (std::pmr::string label = format_ui(ui_arena, "Sphere {}", i + 1); ImGui::TreeNode(
                         label.c_str()))
                     {
                         glm::vec3 pos = objects.spheres[i].position;
@@ -409,7 +754,7 @@ void gl3::renderer::render_ui()
                 {
                     ImGui::PushID(i);
 
-                    if (std::string label = std::format("Plane {}", std::to_string(i + 1)); ImGui::TreeNode(
+                    if (std::pmr::string label = format_ui(ui_arena, "Plane {}", i + 1); ImGui::TreeNode(
                         label.c_str()))
                     {
                         glm::vec3 pos = objects.planes[i].position;
@@ -449,7 +794,7 @@ void gl3::renderer::render_ui()
                 for (int i = 0; i < std::min(objects.num_spheres, 6); i++)
                 {
                     ImGui::PushID(i);
-                    if (std::string label = std::format("Sphere material {}", std::to_string(i + 1)); ImGui::TreeNode(
+                    if (std::pmr::string label = format_ui(ui_arena, "Sphere material {}", i + 1); ImGui::TreeNode(
                         label.c_str()))
                     {
                         auto& sphere_material = objects.sphere_materials[i];
@@ -494,7 +839,7 @@ void gl3::renderer::render_ui()
                 for (int i = 0; i < std::min(objects.num_planes, 6); i++)
                 {
                     ImGui::PushID(i);
-                    if (std::string label = std::format("Planes material {}", std::to_string(i + 1)); ImGui::TreeNode(
+                    if (std::pmr::string label = format_ui(ui_arena, "Planes material {}", i + 1); ImGui::TreeNode(
                         label.c_str()))
                     {
                         auto& plane_material = objects.plane_materials[i];
@@ -541,7 +886,7 @@ void gl3::renderer::render_ui()
                 for (int i = 0; i < std::min(objects.num_triangles, 6); i++)
                 {
                     ImGui::PushID(i);
-                    if (std::string label = std::format("Triangle material {}", std::to_string(i + 1)); ImGui::TreeNode(
+                    if (std::pmr::string label = format_ui(ui_arena, "Triangle material {}", i + 1); ImGui::TreeNode(
                         label.c_str()))
                     {
                         auto& triangle_material = objects.triangle_materials[i];
@@ -589,7 +934,7 @@ void gl3::renderer::render_ui()
                 for (int i = 0; i < MAX_CSG_SPHERES; i++)
                 {
                     ImGui::PushID(i);
-                    if (std::string label = std::format("CSG Sphere material {}", std::to_string(i + 1));
+                    if (std::pmr::string label = format_ui(ui_arena, "CSG Sphere material {}", i + 1);
                         ImGui::TreeNode(label.c_str()))
                     {
                         auto& csg_sphere_material = objects.csg_sphere_materials[i];
@@ -659,13 +1004,19 @@ void gl3::renderer::render_ui()
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
-gl3::renderer::renderer()
+gl3::renderer::renderer(const std::string& mesh_path)
 {
     init_window();
 
     // Initialize scene data
     scene_data.initialize();
 
+    // Stream the startup mesh in the background, it appears chunk by chunk while rendering
+    if (!mesh_path.empty())
+    {
+        streamer.start(mesh_path, imported_mesh_material(), MAX_MESHES - scene_data.get_meshes().num_meshes());
+    }
+
     // Set up the camera to its initial position from scene data
     const auto& camera_data = scene_data.get_camera();
     camera.position = camera_data.position;
@@ -701,6 +1052,9 @@ gl3::renderer::~renderer()
 
 void gl3::renderer::render_frame()
 {
+    // Strings of the previous frame are no longer referenced
+    ui_arena.reset();
+
     // Update viewport
     int width;
     int height;
@@ -710,6 +1064,12 @@ void gl3::renderer::render_frame()
     // Clear buffers
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    // Add the streamed mesh chunks that finished loading
+    streamer.poll(scene_data);
+
+    // Apply the edits queued by other threads
+    edit_queue.drain(scene_data);
+
     // If in camera mode, update the scene camera from the interactive camera
     if (camera_mode)
     {
@@ -751,9 +1111,15 @@ void gl3::renderer::render_frame()
 
     // Update FPS counter
     update_fps();
-    std::stringstream ss;
-    ss << WINDOW_TITLE << ": " << current_FPS << " fps";
-    glfwSetWindowTitle(window, ss.str().c_str());
+    const std::pmr::string title = format_ui(ui_arena, "{}: {} fps", WINDOW_TITLE, current_FPS);
+    glfwSetWindowTitle(window, title.c_str());
+}
+
+memory_tracker::report gl3::renderer::get_memory_report() const
+{
+    memory_tracker::report report{memory_tracker::get_gpu_usage(), scene_data.memory_usage()};
+    report.cpu.arenas += ui_arena.get_statistics().capacity + import_arena.get_statistics().capacity;
+    return report;
 }
 
 bool gl3::renderer::should_close() const
@@ -1,9 +1,17 @@
 #ifndef RENDERER_H
 #define RENDERER_H
+#include <array>
 #include <memory>
+#include <string>
 
 #include "camera.h"
 #include "compute_renderer.h"
+#include "memory_arena.h"
+#include "memory_tracker.h"
+#include "mesh_importer.h"
+#include "mesh_storage.h"
+#include "mesh_streamer.h"
+#include "scene_edit_queue.h"
 #include "scene_data.h"
 #include "vao.h"
 #include "GLFW/glfw3.h"
@@ -30,6 +38,16 @@ namespace gl3
         bool show_ui = true;
         bool camera_mode = false;
         bool use_compute_shader = true; // Flag to toggle between compute and fragment shader
+        mesh_storage::quantization_report quantization_report{}; // Last check of the compressed geometry
+        std::array<char, 256> mesh_path{}; // OBJ or PLY file to import
+        import_stats last_import{}; // Statistics of the last mesh import
+        mesh_streamer streamer; // Background loading of large meshes
+        scene_edit_queue edit_queue; // Edits pushed by other threads, applied once per frame
+        std::array<char, 256> scene_path{"scene.rtscene"}; // Binary scene file to save or load
+
+        // Scratch memory reused across frames and imports
+        memory_arena ui_arena;
+        memory_arena import_arena{ARENA_INITIAL_CAPACITY, 256 * 1024 * 1024};
 
         // Rendering state
         std::unique_ptr<shader_class> shader_program;
@@ -60,13 +78,20 @@ namespace gl3
         void init_quad();
 
     public:
-        renderer();
+        // Optionally streams a mesh file into the scene once the window is up
+        explicit renderer(const std::string& mesh_path = {});
     
         ~renderer();
 
         void render_frame();
 
         [[nodiscard]] bool should_close() const;
+
+        // GPU allocations and CPU memory of the scene, its meshes and the arenas
+        [[nodiscard]] memory_tracker::report get_memory_report() const;
+
+        // Queue for simulation or network threads to edit the scene while it renders
+        scene_edit_queue& get_edit_queue() { return edit_queue; }
     };
 }
 
@@ -1,11 +1,19 @@
 #include "scene_data.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <type_traits>
 
 #include "bvh.h"
+#include "memory_tracker.h"
+#include "mesh_storage.h"
 #include "renderer.h"
+#include "scene_snapshot.h"
 
-scene_data::scene_data() : camera_UBO(0), objects_UBO(0), lighting_UBO(0), bvh_UBO(0)
+scene_data::scene_data() : meshes(std::make_unique<mesh_storage>()), camera_UBO(0), objects_UBO(0), lighting_UBO(0),
+                           bvh_UBO(0)
 {
     // Initialize default camera settings
     camera.window_size = {INITIAL_WIDTH, INITIAL_HEIGHT};
@@ -35,13 +43,25 @@ scene_data::~scene_data()
 {
     // Delete UBOs
     if (camera_UBO != 0)
+    {
+        memory_tracker::release_buffer(camera_UBO);
         glDeleteBuffers(1, &camera_UBO);
+    }
     if (objects_UBO != 0)
+    {
+        memory_tracker::release_buffer(objects_UBO);
         glDeleteBuffers(1, &objects_UBO);
+    }
     if (lighting_UBO != 0)
+    {
+        memory_tracker::release_buffer(lighting_UBO);
         glDeleteBuffers(1, &lighting_UBO);
+    }
     if (bvh_UBO != 0)
+    {
+        memory_tracker::release_buffer(bvh_UBO);
         glDeleteBuffers(1, &bvh_UBO);
+    }
 }
 
 void scene_data::initialize()
@@ -62,6 +82,7 @@ void scene_data::create_UBOs()
     glGenBuffers(1, &camera_UBO);
     glBindBuffer(GL_UNIFORM_BUFFER, camera_UBO);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(camera_data), nullptr, GL_DYNAMIC_DRAW);
+    memory_tracker::track_buffer(camera_UBO, gpu_memory_category::uniform_buffer, sizeof(camera_data));
     glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_UBO_BINDING, camera_UBO);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
@@ -69,6 +90,7 @@ void scene_data::create_UBOs()
     glGenBuffers(1, &objects_UBO);
     glBindBuffer(GL_UNIFORM_BUFFER, objects_UBO);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(scene_objects), nullptr, GL_DYNAMIC_DRAW);
+    memory_tracker::track_buffer(objects_UBO, gpu_memory_category::uniform_buffer, sizeof(scene_objects));
     glBindBufferBase(GL_UNIFORM_BUFFER, OBJECTS_UBO_BINDING, objects_UBO);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
@@ -76,6 +98,7 @@ void scene_data::create_UBOs()
     glGenBuffers(1, &lighting_UBO);
     glBindBuffer(GL_UNIFORM_BUFFER, lighting_UBO);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(lighting_data), nullptr, GL_DYNAMIC_DRAW);
+    memory_tracker::track_buffer(lighting_UBO, gpu_memory_category::uniform_buffer, sizeof(lighting_data));
     glBindBufferBase(GL_UNIFORM_BUFFER, LIGHTING_UBO_BINDING, lighting_UBO);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
@@ -83,39 +106,181 @@ void scene_data::create_UBOs()
     glGenBuffers(1, &bvh_UBO);
     glBindBuffer(GL_UNIFORM_BUFFER, bvh_UBO);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(bvh_data), nullptr, GL_DYNAMIC_DRAW);
+    memory_tracker::track_buffer(bvh_UBO, gpu_memory_category::uniform_buffer, sizeof(bvh_data));
     glBindBufferBase(GL_UNIFORM_BUFFER, BVH_UBO_BINDING, bvh_UBO);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);   
+
+    // Create mesh SSBOs
+    meshes->create_buffers();
 }
 
-void scene_data::update_UBOs() const
+void scene_data::update_UBOs()
 {
-    // Update Camera UBO
-    glBindBuffer(GL_UNIFORM_BUFFER, camera_UBO);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(camera_data), &camera);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    const std::shared_ptr<const scene_snapshot> snapshot = publish();
 
-    // Update Objects UBO
-    glBindBuffer(GL_UNIFORM_BUFFER, objects_UBO);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(scene_objects), &objects);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    // Upload a section to its range of a UBO if it is not the one already on the GPU
+    const auto upload = [this](const GLuint buffer, const GLintptr offset, const auto& section, const auto& current)
+    {
+        if (uploaded && uploaded.get()->*section == current)
+            return;
+        const auto& data = *(current);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(data), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    };
+
+    // Update Camera UBO
+    upload(camera_UBO, 0, &scene_snapshot::camera, snapshot->camera);
+
+    // Update Objects UBO, array by array
+    upload(objects_UBO, offsetof(scene_objects, spheres), &scene_snapshot::spheres, snapshot->spheres);
+    upload(objects_UBO, offsetof(scene_objects, planes), &scene_snapshot::planes, snapshot->planes);
+    upload(objects_UBO, offsetof(scene_objects, triangles), &scene_snapshot::triangles, snapshot->triangles);
+    upload(objects_UBO, offsetof(scene_objects, csg_spheres), &scene_snapshot::csg_spheres, snapshot->csg_spheres);
+    upload(objects_UBO, offsetof(scene_objects, sphere_materials), &scene_snapshot::sphere_materials,
+           snapshot->sphere_materials);
+    upload(objects_UBO, offsetof(scene_objects, plane_materials), &scene_snapshot::plane_materials,
+           snapshot->plane_materials);
+    upload(objects_UBO, offsetof(scene_objects, triangle_materials), &scene_snapshot::triangle_materials,
+           snapshot->triangle_materials);
+    upload(objects_UBO, offsetof(scene_objects, csg_sphere_materials), &scene_snapshot::csg_sphere_materials,
+           snapshot->csg_sphere_materials);
+    if (!uploaded || uploaded->num_spheres != snapshot->num_spheres || uploaded->num_planes != snapshot->num_planes ||
+        uploaded->num_triangles != snapshot->num_triangles)
+    {
+        const std::array<int, 3> counts = {snapshot->num_spheres, snapshot->num_planes, snapshot->num_triangles};
+        glBindBuffer(GL_UNIFORM_BUFFER, objects_UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, offsetof(scene_objects, num_spheres), sizeof(counts), counts.data());
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
 
     // Update Lighting UBO
-    glBindBuffer(GL_UNIFORM_BUFFER, lighting_UBO);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(lighting_data), &lighting);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    upload(lighting_UBO, 0, &scene_snapshot::lighting, snapshot->lighting);
 
     // Update BVH UBO
-    glBindBuffer(GL_UNIFORM_BUFFER, bvh_UBO);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(bvh_data), &bvh);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);   
+    upload(bvh_UBO, 0, &scene_snapshot::bvh, snapshot->bvh);
+
+    uploaded = snapshot;
+
+    // Update mesh SSBOs if meshes changed
+    meshes->upload();
+}
+
+// Keep a section of the previous snapshot if it holds the same bytes, or replace it by a copy of the current data
+template <typename T>
+static bool share_section(std::shared_ptr<const T>& section, const T& current)
+{
+    static_assert(std::is_trivially_copyable_v<T>, "snapshot sections are compared and copied bytewise");
+    if (section && std::memcmp(section.get(), &current, sizeof(T)) == 0)
+    {
+        return false;
+    }
+
+    // Copied bytewise so the padding matches too and the next comparison succeeds
+    auto copy = std::make_shared<T>();
+    std::memcpy(static_cast<void*>(copy.get()), &current, sizeof(T));
+    section = std::move(copy);
+    return true;
+}
+
+// Keep an object count of the previous snapshot, or take the current one
+static bool share_count(int& count, const int current)
+{
+    const bool changed = count != current;
+    count = current;
+    return changed;
+}
+
+std::shared_ptr<const scene_snapshot> scene_data::publish()
+{
+    const std::shared_ptr<const scene_snapshot> previous = published.load();
+
+    // Mesh infos are a variable-size array, edited by the mesh storage rather than through the scene
+    const std::vector<mesh_storage::mesh_info>& infos = meshes->get_infos();
+    const bool same_infos = previous && previous->mesh_infos && previous->mesh_infos->size() == infos.size() &&
+        std::memcmp(previous->mesh_infos->data(), infos.data(), infos.size() * sizeof(mesh_storage::mesh_info)) == 0;
+    if (previous && same_infos && pending == 0)
+    {
+        return previous;
+    }
+
+    // The sections start as those of the previous version, only the pending ones are compared and copied if they
+    // changed. Nothing is allocated when the writes left the data as it was.
+    scene_snapshot next = previous ? *previous : scene_snapshot{};
+    bool changed = !previous;
+    if (pending & pending_camera)
+    {
+        changed |= share_section(next.camera, camera);
+    }
+    if (pending & pending_objects)
+    {
+        changed |= share_section(next.spheres, objects.spheres);
+        changed |= share_section(next.planes, objects.planes);
+        changed |= share_section(next.triangles, objects.triangles);
+        changed |= share_section(next.csg_spheres, objects.csg_spheres);
+        changed |= share_section(next.sphere_materials, objects.sphere_materials);
+        changed |= share_section(next.plane_materials, objects.plane_materials);
+        changed |= share_section(next.triangle_materials, objects.triangle_materials);
+        changed |= share_section(next.csg_sphere_materials, objects.csg_sphere_materials);
+        changed |= share_count(next.num_spheres, objects.num_spheres);
+        changed |= share_count(next.num_planes, objects.num_planes);
+        changed |= share_count(next.num_triangles, objects.num_triangles);
+    }
+    if (pending & pending_lighting)
+    {
+        changed |= share_section(next.lighting, lighting);
+    }
+    if (pending & pending_bvh)
+    {
+        changed |= share_section(next.bvh, bvh);
+    }
+    if (!same_infos)
+    {
+        next.mesh_infos = std::make_shared<const std::vector<mesh_storage::mesh_info>>(infos);
+        changed = true;
+    }
+    pending = 0;
+
+    if (!changed)
+    {
+        return previous;
+    }
+
+    next.version++;
+    auto snapshot = std::make_shared<const scene_snapshot>(std::move(next));
+    published.store(snapshot);
+    return snapshot;
+}
+
+memory_tracker::cpu_usage scene_data::memory_usage() const
+{
+    memory_tracker::cpu_usage usage;
+    usage.scene = sizeof(camera) + sizeof(objects) + sizeof(lighting) + sizeof(bvh);
+    usage.meshes = meshes->cpu_bytes();
+    usage.arenas = build_arena.get_statistics().capacity + meshes->get_build_arena().get_statistics().capacity;
+
+    // The latest snapshot holds its own copy of every section, older versions are freed once unused
+    if (const std::shared_ptr<const scene_snapshot> current = published.load())
+    {
+        usage.snapshots = sizeof(scene_snapshot) + sizeof(camera_data) + sizeof(scene_objects) +
+            sizeof(lighting_data) + sizeof(bvh_data) +
+            (current->mesh_infos ? current->mesh_infos->capacity() * sizeof(mesh_storage::mesh_info) : 0);
+    }
+    return usage;
 }
 
 void scene_data::build_bvh()
 {
+    bvh_dirty = false;
+    pending |= pending_bvh;
+
+    // Temporaries of the previous build are no longer referenced
+    build_arena.reset();
+
     // Build the BVH using the bvh builder
-    std::vector<bvh_node> nodes = bvh_builder::build_bvh(objects.spheres, objects.num_spheres, 
+    const std::pmr::vector<bvh_node> nodes = bvh_builder::build_bvh(objects.spheres, objects.num_spheres, 
         objects.planes, objects.num_planes, objects.triangles, objects.num_triangles, 
-        objects.csg_spheres);
+        objects.csg_spheres, meshes->get_infos(), &build_arena);
 
     // Copy the nodes to the BVH data
     bvh.num_nodes = std::min(static_cast<int>(nodes.size()), MAX_BVH_NODES);
@@ -133,6 +298,8 @@ void scene_data::build_bvh()
 
 void scene_data::reset_to_default()
 {
+    pending = pending_all;
+
     // Reset camera
     camera.position = glm::vec3(0.0f, 1.0f, 1.0f);
     camera.target = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -216,16 +383,56 @@ void scene_data::reset_to_default()
     objects.csg_sphere_materials[2] = {{0.2f, 0.2f, 0.8f}, {1.0f, 1.0f, 1.0f}, {0.1f, 0.1f, 0.1f}, 32.0f};
     objects.csg_sphere_materials[3] = {{0.2f, 0.8f, 0.2f}, {1.0f, 1.0f, 1.0f}, {0.1f, 0.1f, 0.1f}, 32.0f};
 
+    // Remove loaded meshes
+    meshes->clear();
+
     // Rebuild the BVH after resetting the scene
     build_bvh();
 }
 
+void scene_data::begin_edit()
+{
+    edit_depth++;
+}
+
+void scene_data::commit_edit()
+{
+    if (edit_depth == 0)
+    {
+        std::cerr << "commit_edit called without a matching begin_edit." << std::endl;
+        return;
+    }
+
+    // Only the outermost edit rebuilds
+    edit_depth--;
+    if (edit_depth == 0 && bvh_dirty)
+    {
+        build_bvh();
+    }
+}
+
+void scene_data::request_bvh_rebuild()
+{
+    if (edit_depth > 0)
+    {
+        bvh_dirty = true;
+    }
+    else
+    {
+        build_bvh();
+    }
+}
+
 void scene_data::add_sphere(const glm::vec3& position, const float radius)
 {
     if (objects.num_spheres < MAX_SPHERES)
     {
+        pending |= pending_objects;
         objects.spheres[objects.num_spheres] = {position, radius};
         objects.num_spheres++;
+
+        // Rebuild BVH when adding a new object
+        request_bvh_rebuild();
     }
     else
     {
@@ -237,11 +444,12 @@ void scene_data::add_plane(const glm::vec3& position, const glm::vec3& normal)
 {
     if (objects.num_planes < MAX_PLANES)
     {
+        pending |= pending_objects;
         objects.planes[objects.num_planes] = {position, normal};
         objects.num_planes++;
 
         // Rebuild BVH when adding a new object
-        build_bvh();
+        request_bvh_rebuild();
     }
     else
     {
@@ -253,11 +461,12 @@ void scene_data::add_triangle(const glm::vec3& v1, const glm::vec3& v2, const gl
 {
     if (objects.num_triangles < MAX_TRIANGLES)
     {
+        pending |= pending_objects;
         objects.triangles[objects.num_triangles] = {v1, v2, v3};
         objects.num_triangles++;
 
         // Rebuild BVH when adding a new object
-        build_bvh();
+        request_bvh_rebuild();
     }
     else
     {
@@ -267,16 +476,213 @@ void scene_data::add_triangle(const glm::vec3& v1, const glm::vec3& v2, const gl
 
 void scene_data::update_csg_spheres(const std::array<csg_sphere_data, MAX_CSG_SPHERES>& csg_spheres)
 {
+    pending |= pending_objects;
     for (int i = 0; i < MAX_CSG_SPHERES; i++)
     {
         objects.csg_spheres[i] = csg_spheres[i];
     }
 
     // Rebuild BVH when adding a new object
-    build_bvh();
+    request_bvh_rebuild();
+}
+
+bool scene_data::set_sphere(const int index, const sphere_data& sphere)
+{
+    if (index < 0 || index >= objects.num_spheres)
+        return false;
+
+    pending |= pending_objects;
+    objects.spheres[index] = sphere;
+    request_bvh_rebuild();
+    return true;
+}
+
+bool scene_data::set_plane(const int index, const plane_data& plane)
+{
+    if (index < 0 || index >= objects.num_planes)
+        return false;
+
+    pending |= pending_objects;
+    objects.planes[index] = plane;
+    request_bvh_rebuild();
+    return true;
+}
+
+bool scene_data::set_triangle(const int index, const triangle_data& triangle)
+{
+    if (index < 0 || index >= objects.num_triangles)
+        return false;
+
+    pending |= pending_objects;
+    objects.triangles[index] = triangle;
+    request_bvh_rebuild();
+    return true;
+}
+
+bool scene_data::set_csg_sphere(const int index, const csg_sphere_data& sphere)
+{
+    if (index < 0 || index >= MAX_CSG_SPHERES)
+        return false;
+
+    pending |= pending_objects;
+    objects.csg_spheres[index] = sphere;
+    request_bvh_rebuild();
+    return true;
+}
+
+bool scene_data::set_material(const object_type type, const int index, const scene_objects::material& material)
+{
+    // Materials do not change the bvh
+    if (type != object_type::mesh)
+        pending |= pending_objects;
+    switch (type)
+    {
+    case object_type::sphere:
+        if (index < 0 || index >= objects.num_spheres)
+            return false;
+        objects.sphere_materials[index] = material;
+        return true;
+    case object_type::plane:
+        if (index < 0 || index >= objects.num_planes)
+            return false;
+        objects.plane_materials[index] = material;
+        return true;
+    case object_type::triangle:
+        if (index < 0 || index >= objects.num_triangles)
+            return false;
+        objects.triangle_materials[index] = material;
+        return true;
+    case object_type::csg_sphere:
+        if (index < 0 || index >= MAX_CSG_SPHERES)
+            return false;
+        objects.csg_sphere_materials[index] = material;
+        return true;
+    case object_type::mesh:
+        return meshes->set_material(index, material);
+    }
+    return false;
+}
+
+// Remove an element of a fixed-size array by moving the last one in its place
+template <typename T, std::size_t N>
+static bool swap_remove(std::array<T, N>& array, std::array<scene_data::scene_objects::material, N>& materials,
+                        int& count, const int index)
+{
+    if (index < 0 || index >= count)
+        return false;
+
+    count--;
+    array[index] = array[count];
+    materials[index] = materials[count];
+    return true;
+}
+
+bool scene_data::remove_object(const object_type type, const int index)
+{
+    pending |= pending_objects;
+    bool removed = false;
+    switch (type)
+    {
+    case object_type::sphere:
+        removed = swap_remove(objects.spheres, objects.sphere_materials, objects.num_spheres, index);
+        break;
+    case object_type::plane:
+        removed = swap_remove(objects.planes, objects.plane_materials, objects.num_planes, index);
+        break;
+    case object_type::triangle:
+        removed = swap_remove(objects.triangles, objects.triangle_materials, objects.num_triangles, index);
+        break;
+    default:
+        std::cerr << "Only spheres, planes and triangles can be removed." << std::endl;
+        return false;
+    }
+
+    if (removed)
+        request_bvh_rebuild();
+    return removed;
 }
 
+// Append objects and their materials to fixed-size arrays; returns the number appended
+template <typename T, std::size_t N>
+static int append_objects(std::array<T, N>& array, std::array<scene_data::scene_objects::material, N>& array_materials,
+                          int& count, const std::span<const T> added,
+                          const std::span<const scene_data::scene_objects::material> materials, const char* name)
+{
+    const int appended = std::min(static_cast<int>(added.size()), static_cast<int>(N) - count);
+    if (appended < static_cast<int>(added.size()))
+    {
+        std::cerr << "Maximum number of " << name << " reached, " << added.size() - appended << " dropped."
+            << std::endl;
+    }
+
+    std::copy_n(added.begin(), appended, array.begin() + count);
+    if (!materials.empty())
+    {
+        std::copy_n(materials.begin(), std::min(appended, static_cast<int>(materials.size())),
+                    array_materials.begin() + count);
+    }
+    count += appended;
+    return appended;
+}
+
+int scene_data::add_spheres(const std::span<const sphere_data> spheres,
+                            const std::span<const scene_objects::material> materials)
+{
+    const int added = append_objects(objects.spheres, objects.sphere_materials, objects.num_spheres, spheres, materials,
+                                     "spheres");
+    if (added > 0)
+    {
+        pending |= pending_objects;
+        request_bvh_rebuild();
+    }
+    return added;
+}
 
+int scene_data::add_planes(const std::span<const plane_data> planes,
+                           const std::span<const scene_objects::material> materials)
+{
+    const int added = append_objects(objects.planes, objects.plane_materials, objects.num_planes, planes, materials,
+                                     "planes");
+    if (added > 0)
+    {
+        pending |= pending_objects;
+        request_bvh_rebuild();
+    }
+    return added;
+}
 
+int scene_data::add_triangles(const std::span<const triangle_data> triangles,
+                              const std::span<const scene_objects::material> materials)
+{
+    const int added = append_objects(objects.triangles, objects.triangle_materials, objects.num_triangles, triangles,
+                                     materials, "triangles");
+    if (added > 0)
+    {
+        pending |= pending_objects;
+        request_bvh_rebuild();
+    }
+    return added;
+}
 
+int scene_data::add_mesh(const std::span<const glm::vec3> positions, const std::span<const glm::uvec3> triangles,
+                         const scene_objects::material& material)
+{
+    const int mesh_index = meshes->add_mesh(positions, triangles, material);
+    if (mesh_index >= 0)
+    {
+        // Rebuild BVH when adding a new object
+        request_bvh_rebuild();
+    }
+    return mesh_index;
+}
 
+int scene_data::add_mesh(const prepared_mesh& mesh, const scene_objects::material& material)
+{
+    const int mesh_index = meshes->add_mesh(mesh, material);
+    if (mesh_index >= 0)
+    {
+        // Rebuild BVH when adding a new object
+        request_bvh_rebuild();
+    }
+    return mesh_index;
+}
@@ -1,6 +1,12 @@
 #ifndef SCENE_DATA_H
 #define SCENE_DATA_H
+#include <atomic>
+#include <memory>
+#include <span>
+
 #include "camera.h"
+#include "memory_arena.h"
+#include "memory_tracker.h"
 #include "glm/vec2.hpp"
 #include "glm/vec3.hpp"
 #include "glm/vec4.hpp"
@@ -21,10 +27,24 @@ constexpr int OBJECTS_UBO_BINDING = 1;
 constexpr int LIGHTING_UBO_BINDING = 2;
 constexpr int BVH_UBO_BINDING = 3;
 
+class mesh_storage;
+struct prepared_mesh;
+struct scene_snapshot;
+
 // SceneData class to manage all scene objects and UBOs
 class scene_data
 {
 public:
+    // Object types, as stored in the bvh leaves
+    enum class object_type : int
+    {
+        sphere = 0,
+        plane = 1,
+        triangle = 2,
+        csg_sphere = 3,
+        mesh = 4
+    };
+
     // Camera and view data
     struct camera_data
     {
@@ -212,14 +232,32 @@ public:
     // Initialize UBOs and default scene
     void initialize();
 
-    // Update UBOs with current data
-    void update_UBOs() const;
-
-    // Accessors for scene data
-    camera_data& get_camera() { return camera; }
-    scene_objects& get_objects() { return objects; }
-    lighting_data& get_lighting() { return lighting; }
-    bvh_data& get_bvh() { return bvh; }
+    // Publish the current data and upload the sections that changed since the last upload
+    void update_UBOs();
+
+    // Publish the current data as a new snapshot version, sharing the sections that did not change. Called by the
+    // thread that edits the scene; returns the latest snapshot.
+    std::shared_ptr<const scene_snapshot> publish();
+
+    // Latest published snapshot, safe to read from any thread
+    [[nodiscard]] std::shared_ptr<const scene_snapshot> snapshot() const { return published.load(); }
+
+    // Accessors for scene data; the mutable ones mark their section for the next publish, as the callers write
+    // through the reference
+    camera_data& get_camera() { pending |= pending_camera; return camera; }
+    scene_objects& get_objects() { pending |= pending_objects; return objects; }
+    lighting_data& get_lighting() { pending |= pending_lighting; return lighting; }
+    bvh_data& get_bvh() { pending |= pending_bvh; return bvh; }
+    mesh_storage& get_meshes() { return *meshes; }
+    [[nodiscard]] const camera_data& get_camera() const { return camera; }
+    [[nodiscard]] const scene_objects& get_objects() const { return objects; }
+    [[nodiscard]] const lighting_data& get_lighting() const { return lighting; }
+    [[nodiscard]] const bvh_data& get_bvh() const { return bvh; }
+    [[nodiscard]] const mesh_storage& get_meshes() const { return *meshes; }
+    [[nodiscard]] const memory_arena& get_build_arena() const { return build_arena; }
+
+    // CPU memory held by the scene, its meshes, its published snapshot and its build arenas
+    [[nodiscard]] memory_tracker::cpu_usage memory_usage() const;
 
     // Reset to the default scene
     void reset_to_default();
@@ -227,11 +265,49 @@ public:
     // Build BVH from the current scene
     void build_bvh();
 
+    // Batch edits: the BVH is rebuilt once when the outermost edit is committed instead of after every change
+    void begin_edit();
+    void commit_edit();
+    [[nodiscard]] bool in_edit() const { return edit_depth > 0; }
+
+    // Begins an edit on construction and commits it on destruction
+    class edit_transaction
+    {
+    public:
+        explicit edit_transaction(scene_data& scene) : scene(scene) { scene.begin_edit(); }
+        ~edit_transaction() { scene.commit_edit(); }
+
+        edit_transaction(const edit_transaction&) = delete;
+        edit_transaction& operator=(const edit_transaction&) = delete;
+
+    private:
+        scene_data& scene;
+    };
+
     // Add/modify objects
     void add_sphere(const glm::vec3& position, float radius);
     void add_plane(const glm::vec3& position, const glm::vec3& normal);
     void add_triangle(const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3);
     void update_csg_spheres(const std::array<csg_sphere_data, MAX_CSG_SPHERES>& csg_spheres);
+    int add_mesh(std::span<const glm::vec3> positions, std::span<const glm::uvec3> triangles,
+                 const scene_objects::material& material = {});
+    int add_mesh(const prepared_mesh& mesh, const scene_objects::material& material = {});
+
+    // Replace a single object; return false if the index is out of range
+    bool set_sphere(int index, const sphere_data& sphere);
+    bool set_plane(int index, const plane_data& plane);
+    bool set_triangle(int index, const triangle_data& triangle);
+    bool set_csg_sphere(int index, const csg_sphere_data& sphere);
+    bool set_material(object_type type, int index, const scene_objects::material& material);
+
+    // Remove a sphere, plane or triangle by moving the last one of its type in its place
+    bool remove_object(object_type type, int index);
+
+    // Bulk inserts with optional per-object materials; return the number of objects added
+    int add_spheres(std::span<const sphere_data> spheres, std::span<const scene_objects::material> materials = {});
+    int add_planes(std::span<const plane_data> planes, std::span<const scene_objects::material> materials = {});
+    int add_triangles(std::span<const triangle_data> triangles,
+                      std::span<const scene_objects::material> materials = {});
 
 private:
     camera_data camera{};
@@ -239,6 +315,35 @@ private:
     lighting_data lighting{};
     bvh_data bvh{};
 
+    // Indexed meshes, stored in SSBOs
+    std::unique_ptr<mesh_storage> meshes;
+
+    // Scratch memory of the BVH builds, reused from one build to the next
+    memory_arena build_arena;
+
+    // Sections written since the last publish, the others are shared with the published snapshot without comparing
+    // them
+    enum pending_section : unsigned
+    {
+        pending_camera = 1u << 0,
+        pending_objects = 1u << 1,
+        pending_lighting = 1u << 2,
+        pending_bvh = 1u << 3,
+        pending_all = pending_camera | pending_objects | pending_lighting | pending_bvh
+    };
+    unsigned pending = pending_all;
+
+    // Snapshots
+    std::atomic<std::shared_ptr<const scene_snapshot>> published;
+    std::shared_ptr<const scene_snapshot> uploaded; // Last snapshot sent to the UBOs
+
+    // Batch edit state
+    int edit_depth = 0; // Number of nested begin_edit calls
+    bool bvh_dirty = false; // Objects changed during the current edit
+
+    // Rebuild the BVH now, or when the current edit is committed
+    void request_bvh_rebuild();
+
     // UBO handles
     GLuint camera_UBO;
     GLuint objects_UBO;
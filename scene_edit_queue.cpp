@@ -0,0 +1,240 @@
+#include "scene_edit_queue.h"
+
+#include <bit>
+#include <iostream>
+
+scene_edit scene_edit::move_sphere(const int index, const glm::vec3& position, const float radius,
+                                   const glm::vec3& velocity)
+{
+    scene_edit edit;
+    edit.type = kind::move;
+    edit.object = scene_data::object_type::sphere;
+    edit.index = index;
+    edit.vectors = {position, glm::vec3(0.0f), velocity};
+    edit.radius = radius;
+    return edit;
+}
+
+scene_edit scene_edit::add_sphere(const glm::vec3& position, const float radius,
+                                  const scene_data::scene_objects::material& material)
+{
+    scene_edit edit;
+    edit.type = kind::add;
+    edit.object = scene_data::object_type::sphere;
+    edit.vectors[0] = position;
+    edit.radius = radius;
+    edit.material = material;
+    return edit;
+}
+
+scene_edit scene_edit::remove(const scene_data::object_type object, const int index)
+{
+    scene_edit edit;
+    edit.type = kind::remove;
+    edit.object = object;
+    edit.index = index;
+    return edit;
+}
+
+scene_edit scene_edit::set_material(const scene_data::object_type object, const int index,
+                                    const scene_data::scene_objects::material& material)
+{
+    scene_edit edit;
+    edit.type = kind::set_material;
+    edit.object = object;
+    edit.index = index;
+    edit.material = material;
+    return edit;
+}
+
+scene_edit_queue::scene_edit_queue(const std::size_t capacity) :
+    cells(std::make_unique<cell[]>(std::bit_ceil(capacity))), mask(std::bit_ceil(capacity) - 1)
+{
+    // Every slot starts free for the producer at its own position
+    for (std::size_t i = 0; i <= mask; i++)
+    {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    for (auto& type : latest_move)
+        type.fill(-1);
+    for (auto& type : latest_material)
+        type.fill(-1);
+
+    batch.reserve(mask + 1);
+    pending.reserve(mask + 1);
+}
+
+bool scene_edit_queue::push(const scene_edit& edit)
+{
+    // Claim a position, then fill its slot and publish it through the sequence
+    std::size_t position = enqueue_position.load(std::memory_order_relaxed);
+    cell* slot;
+    for (;;)
+    {
+        slot = &cells[position & mask];
+        const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+        if (difference == 0)
+        {
+            if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (difference < 0)
+        {
+            // The consumer has not freed this slot yet, the queue is full
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            // Another producer took this position
+            position = enqueue_position.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->edit = edit;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    pushed.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool scene_edit_queue::pop(scene_edit& edit)
+{
+    cell& slot = cells[dequeue_position & mask];
+    if (slot.sequence.load(std::memory_order_acquire) != dequeue_position + 1)
+    {
+        // Empty, or the producer of the next edit has not finished writing it
+        return false;
+    }
+
+    edit = slot.edit;
+
+    // Free the slot for the producer one lap later
+    slot.sequence.store(dequeue_position + mask + 1, std::memory_order_release);
+    dequeue_position++;
+    return true;
+}
+
+int scene_edit_queue::drain(scene_data& scene)
+{
+    // Take at most one queue worth of edits, so busy producers cannot hold the frame
+    batch.clear();
+    scene_edit edit;
+    while (batch.size() <= mask && pop(edit))
+    {
+        batch.push_back(edit);
+    }
+    if (batch.empty())
+    {
+        return 0;
+    }
+
+    const std::size_t applied_before = applied;
+    scene_data::edit_transaction transaction(scene);
+    for (int i = 0; i < static_cast<int>(batch.size()); i++)
+    {
+        const scene_edit& current = batch[i];
+        const auto type = static_cast<std::size_t>(current.object);
+        const bool coalescable = (current.type == scene_edit::kind::move ||
+                current.type == scene_edit::kind::set_material) && type < latest_move.size() &&
+            current.index >= 0 && current.index < MAX_OBJECTS_PER_TYPE;
+
+        if (!coalescable)
+        {
+            // Structural edits change indices, apply everything queued before them first
+            flush(scene);
+            if (apply(scene, current))
+                applied++;
+            continue;
+        }
+
+        // Keep only the last update of every object, at the place of the first one
+        int& latest = current.type == scene_edit::kind::move
+                          ? latest_move[type][current.index]
+                          : latest_material[type][current.index];
+        if (latest >= 0)
+        {
+            pending[latest] = i;
+            coalesced++;
+        }
+        else
+        {
+            latest = static_cast<int>(pending.size());
+            pending.push_back(i);
+        }
+    }
+    flush(scene);
+
+    return static_cast<int>(applied - applied_before);
+}
+
+void scene_edit_queue::flush(scene_data& scene)
+{
+    for (const int i : pending)
+    {
+        const scene_edit& edit = batch[i];
+        if (apply(scene, edit))
+            applied++;
+
+        auto& latest = edit.type == scene_edit::kind::move ? latest_move : latest_material;
+        latest[static_cast<std::size_t>(edit.object)][edit.index] = -1;
+    }
+    pending.clear();
+}
+
+bool scene_edit_queue::apply(scene_data& scene, const scene_edit& edit)
+{
+    using object_type = scene_data::object_type;
+    const auto& [v0, v1, v2] = edit.vectors;
+
+    switch (edit.type)
+    {
+    case scene_edit::kind::move:
+        switch (edit.object)
+        {
+        case object_type::sphere:
+            return scene.set_sphere(edit.index, {v0, edit.radius, v2});
+        case object_type::plane:
+            return scene.set_plane(edit.index, {v0, v1});
+        case object_type::triangle:
+            return scene.set_triangle(edit.index, {v0, v1, v2});
+        case object_type::csg_sphere:
+            return scene.set_csg_sphere(edit.index, {v0, edit.radius});
+        default:
+            return false;
+        }
+    case scene_edit::kind::add:
+        switch (edit.object)
+        {
+        case object_type::sphere:
+        {
+            const scene_data::sphere_data sphere(v0, edit.radius, v2);
+            return scene.add_spheres({&sphere, 1}, {&edit.material, 1}) > 0;
+        }
+        case object_type::plane:
+        {
+            const scene_data::plane_data plane(v0, v1);
+            return scene.add_planes({&plane, 1}, {&edit.material, 1}) > 0;
+        }
+        case object_type::triangle:
+        {
+            const scene_data::triangle_data triangle(v0, v1, v2);
+            return scene.add_triangles({&triangle, 1}, {&edit.material, 1}) > 0;
+        }
+        default:
+            std::cerr << "Only spheres, planes and triangles can be added through the edit queue." << std::endl;
+            return false;
+        }
+    case scene_edit::kind::remove:
+        return scene.remove_object(edit.object, edit.index);
+    case scene_edit::kind::set_material:
+        return scene.set_material(edit.object, edit.index, edit.material);
+    }
+    return false;
+}
+
+scene_edit_queue::statistics scene_edit_queue::get_statistics() const
+{
+    return {pushed.load(std::memory_order_relaxed), dropped.load(std::memory_order_relaxed), applied, coalesced};
+}
@@ -0,0 +1,120 @@
+#ifndef SCENE_EDIT_QUEUE_H
+#define SCENE_EDIT_QUEUE_H
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "mesh_storage.h"
+#include "scene_data.h"
+#include "glm/vec3.hpp"
+
+// Number of edits the queue holds between two drains, a power of two
+constexpr std::size_t SCENE_EDIT_QUEUE_CAPACITY = 4096;
+
+// Size of a cache line, keeps the producer and consumer counters apart
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+// Largest number of objects of a single type
+constexpr int MAX_OBJECTS_PER_TYPE = std::max({MAX_SPHERES, MAX_PLANES, MAX_TRIANGLES, MAX_CSG_SPHERES, MAX_MESHES});
+
+// Typed scene edit, produced by any thread and applied by the render loop
+struct scene_edit
+{
+    enum class kind : int
+    {
+        move = 0, // Replace the geometry of an object: position and radius, normal or vertices
+        add = 1, // Append an object with its material
+        remove = 2, // Remove an object, the last one of its type takes its index
+        set_material = 3
+    };
+
+    kind type = kind::move;
+    scene_data::object_type object = scene_data::object_type::sphere;
+    int index = 0; // Ignored when adding
+
+    // Sphere and CSG sphere: position, radius and velocity. Plane: position and normal. Triangle: v1, v2, v3.
+    std::array<glm::vec3, 3> vectors{};
+    float radius = 0.0f;
+
+    scene_data::scene_objects::material material;
+
+    // Shorthands for the common edits
+    static scene_edit move_sphere(int index, const glm::vec3& position, float radius,
+                                  const glm::vec3& velocity = glm::vec3(0.0f));
+    static scene_edit add_sphere(const glm::vec3& position, float radius,
+                                 const scene_data::scene_objects::material& material = {});
+    static scene_edit remove(scene_data::object_type object, int index);
+    static scene_edit set_material(scene_data::object_type object, int index,
+                                   const scene_data::scene_objects::material& material);
+};
+
+// Bounded multi-producer single-consumer queue of scene edits. Producers never block or allocate: a full queue
+// rejects the edit. The render loop drains the queue once per frame, keeping only the last geometry and material
+// update of every object between two structural edits, and applies everything with a single bvh rebuild.
+class scene_edit_queue
+{
+public:
+    // Queue counters, for the UI
+    struct statistics
+    {
+        std::size_t pushed = 0;
+        std::size_t dropped = 0; // Rejected because the queue was full
+        std::size_t applied = 0;
+        std::size_t coalesced = 0; // Superseded by a later update of the same object
+    };
+
+    explicit scene_edit_queue(std::size_t capacity = SCENE_EDIT_QUEUE_CAPACITY);
+
+    scene_edit_queue(const scene_edit_queue&) = delete;
+    scene_edit_queue& operator=(const scene_edit_queue&) = delete;
+
+    // Producer side, safe from any number of threads; returns false if the queue is full
+    bool push(const scene_edit& edit);
+
+    // Consumer side, from the thread that owns the scene; returns the number of edits applied
+    int drain(scene_data& scene);
+
+    [[nodiscard]] statistics get_statistics() const;
+
+private:
+    // Ring buffer slot, its sequence tells whether it is free for the producer at a position or ready for the
+    // consumer
+    struct cell
+    {
+        std::atomic<std::size_t> sequence;
+        scene_edit edit;
+    };
+
+    std::unique_ptr<cell[]> cells;
+    std::size_t mask;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> enqueue_position = 0;
+    alignas(CACHE_LINE_SIZE) std::size_t dequeue_position = 0;
+
+    // Counters
+    std::atomic<std::size_t> pushed = 0;
+    std::atomic<std::size_t> dropped = 0;
+    std::size_t applied = 0;
+    std::size_t coalesced = 0;
+
+    // Drain state, reused from frame to frame
+    std::vector<scene_edit> batch;
+    std::vector<int> pending; // Edits of batch waiting to be applied, in order
+    std::array<std::array<int, MAX_OBJECTS_PER_TYPE>, 5> latest_move{}; // Slot in pending of the move per object
+    std::array<std::array<int, MAX_OBJECTS_PER_TYPE>, 5> latest_material{};
+
+    // Take the next edit, if any
+    bool pop(scene_edit& edit);
+
+    // Apply the pending edits and forget them
+    void flush(scene_data& scene);
+
+    // Apply one edit
+    static bool apply(scene_data& scene, const scene_edit& edit);
+};
+
+
+#endif //SCENE_EDIT_QUEUE_H
@@ -0,0 +1,336 @@
+#include "scene_file.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <vector>
+
+#include "mapped_file.h"
+#include "mesh_storage.h"
+
+static_assert(sizeof(scene_file::header) == 40, "scene file header must have no implicit padding");
+static_assert(sizeof(scene_file::section) == 32, "scene file section must have no implicit padding");
+
+// FNV-1a parameters
+constexpr std::uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+constexpr std::uint64_t FNV_PRIME = 1099511628211ull;
+
+std::uint64_t scene_file::checksum(const void* data, const std::size_t size)
+{
+    // FNV-1a over 64-bit words, then over the remaining bytes
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    std::uint64_t hash = FNV_OFFSET_BASIS;
+    std::size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t))
+    {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * FNV_PRIME;
+    }
+    for (; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+std::uint32_t scene_file::layout_hash()
+{
+    const std::array<std::uint64_t, 8> sizes = {
+        sizeof(scene_data::camera_data), sizeof(scene_data::scene_objects), sizeof(scene_data::lighting_data),
+        sizeof(scene_data::bvh_data), sizeof(mesh_storage::mesh_info), sizeof(scene_data::bvh_node),
+        sizeof(glm::uvec4), sizeof(glm::vec3)
+    };
+    const std::uint64_t hash = checksum(sizes.data(), sizeof(sizes));
+    return static_cast<std::uint32_t>(hash ^ hash >> 32);
+}
+
+bool scene_file::save(const scene_data& scene, const std::string& path, const bool include_bvh)
+{
+    const mesh_storage::arrays meshes = scene.get_meshes().get_arrays();
+
+    // Sections to write, in file order
+    struct section_source
+    {
+        section_id id;
+        const void* data;
+        std::size_t size;
+    };
+    std::vector<section_source> sources = {
+        {section_id::camera, &scene.get_camera(), sizeof(scene_data::camera_data)},
+        {section_id::objects, &scene.get_objects(), sizeof(scene_data::scene_objects)},
+        {section_id::lighting, &scene.get_lighting(), sizeof(scene_data::lighting_data)},
+        {section_id::mesh_infos, meshes.infos.data(), meshes.infos.size_bytes()},
+        {section_id::mesh_nodes, meshes.nodes.data(), meshes.nodes.size_bytes()},
+        {section_id::mesh_triangles, meshes.triangles.data(), meshes.triangles.size_bytes()},
+        {section_id::mesh_vertices, meshes.vertex_words.data(), meshes.vertex_words.size_bytes()},
+        {section_id::mesh_positions, meshes.positions.data(), meshes.positions.size_bytes()},
+        {section_id::mesh_normals, meshes.normals.data(), meshes.normals.size_bytes()},
+        {section_id::mesh_source_offsets, meshes.source_offsets.data(), meshes.source_offsets.size_bytes()}
+    };
+    if (include_bvh)
+    {
+        sources.push_back({section_id::bvh, &scene.get_bvh(), sizeof(scene_data::bvh_data)});
+    }
+
+    // Lay the sections out after the header and the section table
+    const auto align = [](const std::uint64_t offset)
+    {
+        return (offset + SCENE_FILE_ALIGNMENT - 1) / SCENE_FILE_ALIGNMENT * SCENE_FILE_ALIGNMENT;
+    };
+    std::vector<section> table(sources.size());
+    std::uint64_t offset = align(sizeof(header) + table.size() * sizeof(section));
+    for (std::size_t i = 0; i < sources.size(); i++)
+    {
+        table[i] = {static_cast<std::uint32_t>(sources[i].id), 0, offset, sources[i].size,
+                    checksum(sources[i].data, sources[i].size)};
+        offset = align(offset + sources[i].size);
+    }
+
+    header file_header{};
+    file_header.magic = SCENE_FILE_MAGIC;
+    file_header.version = SCENE_FILE_VERSION;
+    file_header.section_count = static_cast<std::uint32_t>(table.size());
+    file_header.file_size = offset;
+    file_header.layout_hash = layout_hash();
+    file_header.vertex_encoding = static_cast<std::uint32_t>(meshes.encoding);
+    file_header.table_checksum = checksum(table.data(), table.size() * sizeof(section));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cerr << "Could not open scene file for writing: " << path << std::endl;
+        return false;
+    }
+
+    // Write the header, the table and every section with its alignment padding
+    constexpr std::array<char, SCENE_FILE_ALIGNMENT> zeros{};
+    const auto pad_to = [&](const std::uint64_t position)
+    {
+        const auto current = static_cast<std::uint64_t>(file.tellp());
+        file.write(zeros.data(), static_cast<std::streamsize>(position - current));
+    };
+    file.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+    file.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(section)));
+    for (std::size_t i = 0; i < sources.size(); i++)
+    {
+        pad_to(table[i].offset);
+        file.write(static_cast<const char*>(sources[i].data), static_cast<std::streamsize>(sources[i].size));
+    }
+    pad_to(file_header.file_size);
+
+    if (!file)
+    {
+        std::cerr << "Could not write scene file: " << path << std::endl;
+        return false;
+    }
+
+    std::cout << "Saved scene to " << path << " (" << file_header.file_size << " bytes, "
+        << table.size() << " sections)" << std::endl;
+    return true;
+}
+
+// Whether the object counts fit in the arrays of the objects section
+static bool valid_objects(const scene_data::scene_objects& objects)
+{
+    return objects.num_spheres >= 0 && objects.num_spheres <= MAX_SPHERES &&
+        objects.num_planes >= 0 && objects.num_planes <= MAX_PLANES &&
+        objects.num_triangles >= 0 && objects.num_triangles <= MAX_TRIANGLES;
+}
+
+// Whether every node of a BVH stays within the nodes, the objects and the meshes. Children come after their parent,
+// as the builder lays them out, so the traversal cannot loop.
+static bool valid_bvh(const scene_data::bvh_data& bvh, const scene_data::scene_objects& objects,
+                      const std::size_t mesh_count)
+{
+    if (bvh.num_nodes < 0 || bvh.num_nodes > MAX_BVH_NODES ||
+        (bvh.num_nodes > 0 && (bvh.root_node < 0 || bvh.root_node >= bvh.num_nodes)))
+    {
+        return false;
+    }
+    for (int i = 0; i < bvh.num_nodes; i++)
+    {
+        const scene_data::bvh_node& node = bvh.nodes[i];
+        if (node.left_child >= 0)
+        {
+            if (node.left_child <= i || node.left_child >= bvh.num_nodes ||
+                node.right_child <= i || node.right_child >= bvh.num_nodes)
+            {
+                return false;
+            }
+            continue;
+        }
+        if (node.object_count == 0)
+        {
+            continue;
+        }
+
+        long long object_limit;
+        switch (static_cast<scene_data::object_type>(node.object_type))
+        {
+        case scene_data::object_type::sphere:
+            object_limit = objects.num_spheres;
+            break;
+        case scene_data::object_type::plane:
+            object_limit = objects.num_planes;
+            break;
+        case scene_data::object_type::triangle:
+            object_limit = objects.num_triangles;
+            break;
+        case scene_data::object_type::csg_sphere:
+            object_limit = MAX_CSG_SPHERES;
+            break;
+        case scene_data::object_type::mesh:
+            object_limit = static_cast<long long>(mesh_count);
+            break;
+        default:
+            return false;
+        }
+        if (node.object_index < 0 || node.object_count < 0 ||
+            static_cast<long long>(node.object_index) + node.object_count > object_limit)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool scene_file::load(scene_data& scene, const std::string& path)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+
+    const mapped_file file(path);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // Validate the header and the section table
+    header file_header{};
+    if (file.size() < sizeof(header))
+    {
+        std::cerr << "Scene file is too small: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(&file_header, file.begin(), sizeof(header));
+
+    if (file_header.magic != SCENE_FILE_MAGIC)
+    {
+        std::cerr << "Not a scene file: " << path << std::endl;
+        return false;
+    }
+    if (file_header.version != SCENE_FILE_VERSION)
+    {
+        std::cerr << "Unsupported scene file version " << file_header.version << " (expected "
+            << SCENE_FILE_VERSION << ")" << std::endl;
+        return false;
+    }
+    if (file_header.layout_hash != layout_hash())
+    {
+        std::cerr << "Scene file was written with a different data layout: " << path << std::endl;
+        return false;
+    }
+    if (file_header.file_size != file.size() ||
+        sizeof(header) + static_cast<std::uint64_t>(file_header.section_count) * sizeof(section) > file.size())
+    {
+        std::cerr << "Scene file is truncated: " << path << std::endl;
+        return false;
+    }
+
+    std::vector<section> table(file_header.section_count);
+    std::memcpy(table.data(), file.begin() + sizeof(header), table.size() * sizeof(section));
+    if (checksum(table.data(), table.size() * sizeof(section)) != file_header.table_checksum)
+    {
+        std::cerr << "Scene file section table is corrupted: " << path << std::endl;
+        return false;
+    }
+
+    // Locate and verify every section
+    std::array<std::span<const char>, 12> sections{};
+    std::array<bool, 12> present{};
+    for (const section& entry : table)
+    {
+        if (entry.offset % SCENE_FILE_ALIGNMENT != 0 || entry.offset > file.size() ||
+            entry.size > file.size() - entry.offset)
+        {
+            std::cerr << "Scene file section " << entry.id << " is out of bounds." << std::endl;
+            return false;
+        }
+        if (checksum(file.begin() + entry.offset, entry.size) != entry.checksum)
+        {
+            std::cerr << "Scene file section " << entry.id << " is corrupted." << std::endl;
+            return false;
+        }
+        if (entry.id < sections.size())
+        {
+            sections[entry.id] = {file.begin() + entry.offset, entry.size};
+            present[entry.id] = true;
+        }
+    }
+
+    // Typed view of a section, empty if its size does not match the element type
+    const auto view = [&]<typename T>(const section_id id, std::span<const T>& out)
+    {
+        const std::span<const char> bytes = sections[static_cast<std::uint32_t>(id)];
+        if (!present[static_cast<std::uint32_t>(id)] || bytes.size() % sizeof(T) != 0)
+            return false;
+        out = {reinterpret_cast<const T*>(bytes.data()), bytes.size() / sizeof(T)};
+        return true;
+    };
+
+    std::span<const scene_data::camera_data> camera;
+    std::span<const scene_data::scene_objects> objects;
+    std::span<const scene_data::lighting_data> lighting;
+    std::span<const scene_data::bvh_data> bvh;
+    mesh_storage::arrays meshes;
+    meshes.encoding = static_cast<mesh_storage::vertex_encoding>(file_header.vertex_encoding);
+
+    if (!view(section_id::camera, camera) || camera.size() != 1 ||
+        !view(section_id::objects, objects) || objects.size() != 1 ||
+        !view(section_id::lighting, lighting) || lighting.size() != 1 ||
+        !view(section_id::mesh_infos, meshes.infos) || !view(section_id::mesh_nodes, meshes.nodes) ||
+        !view(section_id::mesh_triangles, meshes.triangles) || !view(section_id::mesh_vertices, meshes.vertex_words) ||
+        !view(section_id::mesh_positions, meshes.positions) || !view(section_id::mesh_normals, meshes.normals) ||
+        !view(section_id::mesh_source_offsets, meshes.source_offsets))
+    {
+        std::cerr << "Scene file is missing a required section: " << path << std::endl;
+        return false;
+    }
+    const bool has_bvh = view(section_id::bvh, bvh) && bvh.size() == 1;
+    if (!valid_objects(objects[0]))
+    {
+        std::cerr << "Scene file has more objects than the scene holds: " << path << std::endl;
+        return false;
+    }
+    if (has_bvh && !valid_bvh(bvh[0], objects[0], meshes.infos.size()))
+    {
+        std::cerr << "Scene file BVH references data out of range: " << path << std::endl;
+        return false;
+    }
+
+    // Everything is checked, replace the scene
+    if (!scene.get_meshes().assign(meshes))
+    {
+        return false;
+    }
+    const glm::vec2 window_size = scene.get_camera().window_size;
+    scene.get_camera() = camera[0];
+    scene.get_camera().window_size = window_size;
+    scene.get_objects() = objects[0];
+    scene.get_lighting() = lighting[0];
+    if (has_bvh)
+    {
+        scene.get_bvh() = bvh[0];
+    }
+    else
+    {
+        scene.build_bvh();
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << "Loaded scene " << path << " (" << file.size() << " bytes) in " << seconds * 1000.0 << " ms"
+        << std::endl;
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "scene_data.h"
+
+// Magic number and version of binary scene files
+constexpr std::array<char, 8> SCENE_FILE_MAGIC = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+constexpr std::uint32_t SCENE_FILE_VERSION = 1;
+
+// Alignment of every section in the file, enough for any GPU-side struct
+constexpr std::uint64_t SCENE_FILE_ALIGNMENT = 16;
+
+// Native binary scene container. Sections hold the UBO and SSBO contents exactly as the GPU expects them, so
+// loading is a memory mapping followed by plain copies, with no parsing.
+class scene_file
+{
+public:
+    // Contents of a section
+    enum class section_id : std::uint32_t
+    {
+        camera = 1, // camera_data
+        objects = 2, // scene_objects
+        lighting = 3, // lighting_data
+        bvh = 4, // bvh_data, optional
+        mesh_infos = 5, // mesh_storage::mesh_info[]
+        mesh_nodes = 6, // bvh_node[]
+        mesh_triangles = 7, // uvec4[]
+        mesh_vertices = 8, // Encoded vertex words
+        mesh_positions = 9, // Full precision source positions
+        mesh_normals = 10, // Full precision source normals
+        mesh_source_offsets = 11 // First source vertex of each mesh
+    };
+
+    // File header, followed by the section table
+    struct header
+    {
+        std::array<char, 8> magic;
+        std::uint32_t version;
+        std::uint32_t section_count;
+        std::uint64_t file_size;
+        std::uint32_t layout_hash; // Sizes of the GPU structs, rejects files written by another layout
+        std::uint32_t vertex_encoding; // mesh_storage::vertex_encoding of the mesh vertices
+        std::uint64_t table_checksum; // Checksum of the section table
+    };
+
+    // Entry of the section table
+    struct section
+    {
+        std::uint32_t id;
+        std::uint32_t padding;
+        std::uint64_t offset; // From the start of the file, aligned on SCENE_FILE_ALIGNMENT
+        std::uint64_t size;
+        std::uint64_t checksum; // Checksum of the section contents
+    };
+
+    // Write the current scene, with its bvh unless include_bvh is false
+    static bool save(const scene_data& scene, const std::string& path, bool include_bvh = true);
+
+    // Replace the scene with the contents of a file; rebuilds the bvh if the file has none.
+    // The window size of the current camera is kept.
+    static bool load(scene_data& scene, const std::string& path);
+
+    // 64-bit checksum of a block of bytes
+    static std::uint64_t checksum(const void* data, std::size_t size);
+
+    // Hash of the sizes of every struct stored in a file
+    static std::uint32_t layout_hash();
+};
+
+
+#endif //SCENE_FILE_H
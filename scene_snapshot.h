@@ -0,0 +1,58 @@
+#ifndef SCENE_SNAPSHOT_H
+#define SCENE_SNAPSHOT_H
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "mesh_storage.h"
+#include "scene_data.h"
+
+// Immutable, versioned copy of the scene published by scene_data::publish. Sections that did not change between
+// two versions point to the same data, so publishing copies only what was edited and readers on any thread can
+// keep a snapshot for as long as they need without locking the scene.
+struct scene_snapshot
+{
+    using objects_type = scene_data::scene_objects;
+    template <typename T>
+    using section = std::shared_ptr<const T>;
+
+    std::uint64_t version = 0; // Increases every time a section changes
+
+    section<scene_data::camera_data> camera;
+
+    // Objects, one section per array of the objects UBO: moving a sphere copies the spheres only
+    section<decltype(objects_type::spheres)> spheres;
+    section<decltype(objects_type::planes)> planes;
+    section<decltype(objects_type::triangles)> triangles;
+    section<decltype(objects_type::csg_spheres)> csg_spheres;
+    section<decltype(objects_type::sphere_materials)> sphere_materials;
+    section<decltype(objects_type::plane_materials)> plane_materials;
+    section<decltype(objects_type::triangle_materials)> triangle_materials;
+    section<decltype(objects_type::csg_sphere_materials)> csg_sphere_materials;
+    int num_spheres = 0;
+    int num_planes = 0;
+    int num_triangles = 0;
+
+    section<scene_data::lighting_data> lighting;
+    section<scene_data::bvh_data> bvh;
+    section<std::vector<mesh_storage::mesh_info>> mesh_infos;
+
+    // Whether the objects differ from those of another snapshot
+    [[nodiscard]] bool same_objects(const scene_snapshot& other) const
+    {
+        return spheres == other.spheres && planes == other.planes && triangles == other.triangles &&
+            csg_spheres == other.csg_spheres && sphere_materials == other.sphere_materials &&
+            plane_materials == other.plane_materials && triangle_materials == other.triangle_materials &&
+            csg_sphere_materials == other.csg_sphere_materials && num_spheres == other.num_spheres &&
+            num_planes == other.num_planes && num_triangles == other.num_triangles;
+    }
+
+    // Whether anything but the camera differs from another snapshot
+    [[nodiscard]] bool same_content(const scene_snapshot& other) const
+    {
+        return same_objects(other) && lighting == other.lighting && bvh == other.bvh && mesh_infos == other.mesh_infos;
+    }
+};
+
+
+#endif //SCENE_SNAPSHOT_H
@@ -1,5 +1,7 @@
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 
 #include "shader_class.h"
@@ -19,10 +21,45 @@ std::string get_file_contents(const char *filename) {
     throw std::runtime_error("Could not open file: " + std::string(filename));
 }
 
+std::string get_shader_source(const char* filename, const int depth)
+{
+    if (depth > MAX_SHADER_INCLUDE_DEPTH)
+    {
+        throw std::runtime_error("Too many nested includes in: " + std::string(filename));
+    }
+
+    // Replace every #include "file" line by the content of the file, relative to the including one
+    const std::filesystem::path path(filename);
+    std::istringstream lines(get_file_contents(filename));
+    std::string source;
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        if (const std::size_t start = line.find_first_not_of(" \t");
+            start != std::string::npos && line.compare(start, 8, "#include") == 0)
+        {
+            const std::size_t first = line.find('"', start);
+            const std::size_t last = first == std::string::npos ? first : line.find('"', first + 1);
+            if (last == std::string::npos)
+            {
+                throw std::runtime_error("Malformed include in " + std::string(filename) + ": " + line);
+            }
+            const std::filesystem::path included = path.parent_path() / line.substr(first + 1, last - first - 1);
+            source += get_shader_source(included.string().c_str(), depth + 1);
+        }
+        else
+        {
+            source += line;
+        }
+        source += '\n';
+    }
+    return source;
+}
+
 
 gl3::shader_class::shader_class(const char *vertex_file, const char *fragment_file) {
-    const std::string vertexCode = get_file_contents(vertex_file);
-    const std::string fragmentCode = get_file_contents(fragment_file);
+    const std::string vertexCode = get_shader_source(vertex_file);
+    const std::string fragmentCode = get_shader_source(fragment_file);
 
     const char *vertexSource = vertexCode.c_str();
     const char *fragmentSource = fragmentCode.c_str();
@@ -58,9 +95,15 @@ gl3::shader_class::shader_class(const char *vertex_file, const char *fragment_fi
     glDeleteShader(fragmentShader);
 }
 
-gl3::shader_class::shader_class(const char* compute_file)
+gl3::shader_class::shader_class(const char* compute_file, const std::string& defines)
 {
-    const std::string compute_code = get_file_contents(compute_file);
+    std::string compute_code = get_shader_source(compute_file);
+    if (!defines.empty())
+    {
+        // #version has to stay the first line
+        const std::size_t version_end = compute_code.find('\n');
+        compute_code.insert(version_end == std::string::npos ? compute_code.size() : version_end + 1, defines);
+    }
 
     const char* compute_source = compute_code.c_str();
 
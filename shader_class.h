@@ -5,8 +5,14 @@
 #include <GL/glew.h>
 
 
+// Deepest chain of nested includes in a shader
+constexpr int MAX_SHADER_INCLUDE_DEPTH = 8;
+
 std::string get_file_contents(const char* filename);
 
+// Shader source with its #include "file" lines expanded, paths are relative to the including file
+std::string get_shader_source(const char* filename, int depth = 0);
+
 namespace gl3
 {
     class shader_class
@@ -17,8 +23,8 @@ namespace gl3
         // Constructor for graphics shaders (vertex + fragment)
         shader_class(const char* vertex_file, const char* fragment_file);
 
-        // Constructor for compute shaders
-        explicit shader_class(const char* compute_file);
+        // Constructor for compute shaders, the defines are lines inserted after the #version line
+        explicit shader_class(const char* compute_file, const std::string& defines = "");
 
         void activate() const;
         static void deactivate();
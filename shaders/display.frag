@@ -5,16 +5,51 @@ out vec4 FragColor;
 
 uniform sampler2D rendered_texture;
 
+// The render is smaller than the window and needs upscaling
+uniform bool upscale;
+
+// How fast the weight of a texel falls with its difference to the nearest texel
+const float EDGE_SHARPNESS = 8.0;
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Bilinear upscaling where the texels that differ from the nearest one lose their weight, so edges stay sharp
+// instead of blurring across
+vec4 edge_aware_sample(vec2 uv) {
+    ivec2 size = textureSize(rendered_texture, 0);
+    vec2 position = uv * vec2(size) - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 fraction = position - vec2(base);
+    float nearest = luminance(texelFetch(rendered_texture, clamp(ivec2(round(position)), ivec2(0), size - 1), 0).rgb);
+
+    vec4 sum = vec4(0.0);
+    float total_weight = 0.0;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        vec4 texel = texelFetch(rendered_texture, clamp(base + offset, ivec2(0), size - 1), 0);
+        vec2 bilinear = mix(1.0 - fraction, fraction, vec2(offset));
+        float difference = (luminance(texel.rgb) - nearest) / (nearest + 0.1);
+        float weight = bilinear.x * bilinear.y * exp(-difference * difference * EDGE_SHARPNESS);
+        sum += texel * weight;
+        total_weight += weight;
+    }
+
+    // The nearest texel always keeps its bilinear weight, at least a quarter
+    return sum / total_weight;
+}
+
+#include "tone_mapping.glsl"
+
+// The output pass already tone mapped the image
+uniform bool tone_mapped;
+
 void main() {
-    // Apply the tone mapping and gamma correction
-    vec3 hdr_color = texture(rendered_texture, texture_coords).rgb;
-    
-    // Exposure tone mapping
-    vec3 mapped = vec3(1.0f) - exp(-hdr_color * 1.0f);
-    
-    // Gamma correction
-    const float gamma = 1.0f;
-    mapped = pow(mapped, vec3(1.0 / gamma));
-    
-    FragColor = vec4(hdr_color, 1.0f);
-}
\ No newline at end of file
+    vec3 color = (upscale ? edge_aware_sample(texture_coords) : texture(rendered_texture, texture_coords)).rgb;
+    if (!tone_mapped) {
+        color = map_tone(color);
+    }
+
+    FragColor = vec4(color, 1.0f);
+}
@@ -0,0 +1,1883 @@
+// Scene data, intersection and shading code shared by the ray tracing kernels
+
+// Camera UBO
+layout (std140, binding = 0) uniform CameraBlock {
+    vec2 windowSize;
+    vec3 cameraPosition;
+    vec3 cameraTarget;
+    float cameraFov;
+    float exposure_time;
+    int time_samples;
+    float focalDistance;
+    float apertureSize;
+} camera;
+
+// Scene Objects UBO
+struct Material {
+    vec3 diffuse;
+    vec3 specular;
+    vec3 ambient;
+    float shininess;
+    float reflection_coef;
+    float refraction_coef;
+    float refraction_index;
+    float glossiness;
+    vec3 absorption;
+};
+
+struct Sphere {
+    vec3 position;
+    float radius;
+    vec3 velocity;
+};
+
+layout (std140, binding = 1) uniform ObjectsBlock {
+    Sphere spheres[256];
+    vec3 planes[256];
+    vec3 triangles[768];
+    vec4 csgSpheres[4];
+    int numSpheres;
+    int numPlanes;
+    int numTriangles;
+    Material sphere_materials[256];
+    Material plane_materials[128];
+    Material triangle_materials[256];
+    Material csg_sphere_materials[4];
+} objects;
+
+// Lighting UBO
+layout (std140, binding = 2) uniform LightingBlock {
+    vec4 lightPosition;// xyz position, w intensity
+    vec3 lightColor;
+    vec3 ambientLight;
+    int lightType;
+    int sampleRate;
+    uint recursionDepth;
+    bool use_fresnel;
+    float light_radius;
+    int shadow_samples;
+} lighting;
+
+// BVH UBO
+struct BVHNode {
+    vec3 aabb_min;
+    int left_child;
+    vec3 aabb_max;
+    int right_child;
+    int object_index;
+    int object_count;
+    int object_type;
+    int split_axis;
+};
+
+layout (std140, binding = 3) uniform BVHBlock {
+    BVHNode nodes[1024];
+    int numNodes;
+    int rootNode;
+    vec2 padding;
+} bvh;
+
+#ifdef BVH_SHARED_LEVELS
+// Top levels of the BVH, which every ray of a work group visits, copied to shared memory by load_bvh_cache. The nodes
+// are in breadth-first order, so these levels are the first nodes.
+const int BVH_SHARED_NODES = (1 << BVH_SHARED_LEVELS) - 1;
+shared BVHNode bvh_cache[BVH_SHARED_NODES];
+#endif
+
+// Copy the top levels of the BVH to shared memory; every invocation of the work group calls it before tracing
+void load_bvh_cache() {
+#ifdef BVH_SHARED_LEVELS
+    uint group_size = gl_WorkGroupSize.x * gl_WorkGroupSize.y * gl_WorkGroupSize.z;
+    uint count = uint(clamp(bvh.numNodes, 0, BVH_SHARED_NODES));
+    for (uint i = gl_LocalInvocationIndex; i < count; i += group_size) {
+        bvh_cache[i] = bvh.nodes[i];
+    }
+    memoryBarrierShared();
+    barrier();
+#endif
+}
+
+BVHNode fetch_bvh_node(int index) {
+#ifdef BVH_SHARED_LEVELS
+    if (index < BVH_SHARED_NODES) {
+        return bvh_cache[index];
+    }
+#endif
+    return bvh.nodes[index];
+}
+
+// Decisions of the scene BVH traversal. With BVH_SUBGROUP, defined with the GL_KHR_shader_subgroup extensions when the
+// device has them, the invocations of a subgroup traverse the tree together: one of them fetches each node for all,
+// the subgroup enters a node when any of its rays hits it and votes on the child to visit first. The traversal state
+// stays the same in the whole subgroup, and invocations whose ray is finished leave the loop and the votes.
+#ifdef BVH_SUBGROUP
+BVHNode traversal_node(int index) {
+    int node_index = subgroupBroadcastFirst(index);
+    BVHNode node;
+    if (subgroupElect()) {
+        node = fetch_bvh_node(node_index);
+    }
+    node.aabb_min = subgroupBroadcastFirst(node.aabb_min);
+    node.left_child = subgroupBroadcastFirst(node.left_child);
+    node.aabb_max = subgroupBroadcastFirst(node.aabb_max);
+    node.right_child = subgroupBroadcastFirst(node.right_child);
+    node.object_index = subgroupBroadcastFirst(node.object_index);
+    node.object_count = subgroupBroadcastFirst(node.object_count);
+    node.object_type = subgroupBroadcastFirst(node.object_type);
+    node.split_axis = subgroupBroadcastFirst(node.split_axis);
+    return node;
+}
+
+bool traversal_visit(bool hit) {
+    return subgroupAny(hit);
+}
+
+// Majority of the rays of the subgroup, ties go to the left child. The vote only depends on the directions of the rays,
+// not on their hits so far, so a restart of the short stack descends the same children again.
+bool traversal_left_first(bool left_first) {
+    uint voters = subgroupBallotBitCount(subgroupBallot(true));
+    uint left_votes = subgroupBallotBitCount(subgroupBallot(left_first));
+    return 2u * left_votes >= voters;
+}
+#else
+BVHNode traversal_node(int index) {
+    return fetch_bvh_node(index);
+}
+
+bool traversal_visit(bool hit) {
+    return hit;
+}
+
+bool traversal_left_first(bool left_first) {
+    return left_first;
+}
+#endif
+
+// Mesh SSBOs
+struct MeshInfo {
+    vec3 aabb_min;// Also the origin of the quantization grid
+    int node_offset;
+    vec3 aabb_max;
+    int triangle_offset;
+    int vertex_offset;
+    int encoding;// 0 = full precision, 1 = quantized
+    int triangle_count;
+    int vertex_count;
+    Material material;
+};
+
+layout (std430, binding = 4) readonly buffer MeshInfoBlock {
+    int numMeshes;
+    MeshInfo meshes[];
+} mesh_infos;
+
+layout (std430, binding = 5) readonly buffer MeshNodeBlock {
+    BVHNode nodes[];
+} mesh_nodes;
+
+layout (std430, binding = 6) readonly buffer MeshTriangleBlock {
+    uvec4 triangles[];// Mesh-local vertex indices
+} mesh_triangles;
+
+layout (std430, binding = 7) readonly buffer MeshVertexBlock {
+    uint words[];// 6 words per full precision vertex, 3 per quantized vertex
+} mesh_vertices;
+
+const int MESH_ENCODING_QUANTIZED = 1;
+const int MESH_STACK_SIZE = 32;
+
+// Running average of the samples of every pixel, the alpha channel holds the sample count
+layout(rgba32f, binding = 0) uniform image2D outputImage;
+
+// Running average of the squared luminance of the samples of every pixel, for their variance
+layout(r32f, binding = 1) uniform image2D momentsImage;
+
+// Samples every pixel gets in the current pass, chosen by the sample allocation pass; 0 once it has converged
+layout(r8ui, binding = 2) uniform uimage2D sampleMap;
+
+// Primary hit of every pixel for the temporal reprojection and the denoiser: position and object key, -1 for a miss,
+// then normal and diffuse albedo
+layout(rgba32f, binding = 4) uniform image2D primaryHitImage;
+layout(rgba16f, binding = 5) uniform image2D primaryNormalImage;
+layout(rgba8, binding = 3) uniform image2D primaryAlbedoImage;
+
+// Number of frames already accumulated in outputImage, 0 to start over
+uniform uint accumulated_frames;
+
+// First pixel of the tile covered by this dispatch
+uniform ivec2 tile_offset;
+
+// Checkerboard rendering of the current pass: 0 traces every pixel, 1 half of them in a checkerboard and 2 a quarter
+// in a 2x2 rotation. The phase changes every pass so the skipped pixels come next.
+uniform int checkerboard_pattern;
+uniform uint checkerboard_phase;
+
+bool is_checkerboard_pixel(ivec2 pixel_coord) {
+    if (checkerboard_pattern == 1) {
+        return ((uint(pixel_coord.x + pixel_coord.y) + checkerboard_phase) & 1u) == 0u;
+    }
+    if (checkerboard_pattern == 2) {
+        return uint((pixel_coord.x & 1) + 2 * (pixel_coord.y & 1)) == (checkerboard_phase & 3u);
+    }
+    return true;
+}
+
+// Pixel traced by a thread when the threads only cover the traced pixels, relative to an even pixel
+ivec2 checkerboard_pixel(ivec2 thread_coord) {
+    if (checkerboard_pattern == 1) {
+        return ivec2(2 * thread_coord.x + int((uint(thread_coord.y) + checkerboard_phase) & 1u), thread_coord.y);
+    }
+    if (checkerboard_pattern == 2) {
+        return 2 * thread_coord + ivec2(checkerboard_phase & 1u, (checkerboard_phase >> 1) & 1u);
+    }
+    return thread_coord;
+}
+
+// Ray and Hit structures
+struct Ray {
+    vec3 origin;
+    vec3 direction;
+    vec3 inv_direction;
+    ivec3 direction_sign;
+    vec3 mask;
+    float current_ior;
+    int depth;
+    bool is_active;
+};
+
+// Initialize optimized ray
+Ray create_ray(vec3 origin, vec3 direction){
+    Ray ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    ray.inv_direction = 1.0 / direction;
+    ray.direction_sign.x = (direction.x < 0.0) ? 1 : 0;
+    ray.direction_sign.y = (direction.y < 0.0) ? 1 : 0;
+    ray.direction_sign.z = (direction.z < 0.0) ? 1 : 0;
+    ray.mask = vec3(1.0f);
+    ray.current_ior = 1.0f;
+    ray.depth = 0;
+    ray.is_active = true;
+    return ray;
+}
+
+bool rayIntersectsAABB(Ray ray, vec3 aabb_min, vec3 aabb_max, float max_dist) {
+    // X-axis
+    float t1 = (aabb_min.x - ray.origin.x) * ray.inv_direction.x;
+    float t2 = (aabb_max.x - ray.origin.x) * ray.inv_direction.x;
+
+    float t_min = ray.direction_sign.x > 0 ? t2 : t1;
+    float t_max = ray.direction_sign.x > 0 ? t1 : t2;
+
+    // Y-axis
+    t1 = (aabb_min.y - ray.origin.y) * ray.inv_direction.y;
+    t2 = (aabb_max.y - ray.origin.y) * ray.inv_direction.y;
+
+    t_min = max(t_min, ray.direction_sign.y > 0 ? t2 : t1);
+    t_max = min(t_max, ray.direction_sign.y > 0 ? t1 : t2);
+
+    // Z-axis
+    t1 = (aabb_min.z - ray.origin.z) * ray.inv_direction.z;
+    t2 = (aabb_max.z - ray.origin.z) * ray.inv_direction.z;
+
+    t_min = max(t_min, ray.direction_sign.z > 0 ? t2 : t1);
+    t_max = min(t_max, ray.direction_sign.z > 0 ? t1 : t2);
+
+    return t_max >= t_min && t_min < max_dist && t_max > 0.0;
+}
+
+struct Hit {
+    float distance;
+    vec3 surface_normal;
+    int surface_material_index;
+};
+
+struct Roth {
+    int nb_hits;
+    Hit hits[8];
+};
+
+// BVH traversal state. Every traversal starts with traversal_begin, goes down an internal node with
+// traversal_descend and on to the next pending node with traversal_next after a miss or a leaf, -1 once done.
+#ifdef BVH_SHORT_STACK
+// Short stack with a restart trail (Laine 2010): only the last few pending nodes are kept. When the one needed was
+// dropped, the traversal starts over from the root and follows the trail, one bit per level that tells whether the
+// second child was already reached. The trees are at most 31 levels deep, MAX_BVH_DEPTH and the median split of
+// the meshes keep them under that.
+const int SHORT_STACK_SIZE = 4;
+const uint TRAIL_ROOT_LEVEL = 0x80000000u;
+
+struct BVHTraversal {
+    int nodes[SHORT_STACK_SIZE];
+    uint levels[SHORT_STACK_SIZE];
+    int top;// Ring buffer, a push on a full stack drops the oldest entry
+    int count;
+    uint trail;
+    uint level;// Bit of the next choice between two children
+};
+
+// Meshes use the same short stack
+#define MeshTraversal BVHTraversal
+
+void traversal_begin(out BVHTraversal traversal) {
+    traversal.top = 0;
+    traversal.count = 0;
+    traversal.trail = 0u;
+    traversal.level = TRAIL_ROOT_LEVEL;
+}
+
+int traversal_descend(inout BVHTraversal traversal, int first_child, int second_child) {
+    int next = first_child;
+    if ((traversal.trail & traversal.level) != 0u) {
+        // Restarting past a first child that is done
+        next = second_child;
+    } else {
+        traversal.top = (traversal.top + 1) % SHORT_STACK_SIZE;
+        traversal.nodes[traversal.top] = second_child;
+        traversal.levels[traversal.top] = traversal.level;
+        traversal.count = min(traversal.count + 1, SHORT_STACK_SIZE);
+    }
+    traversal.level >>= 1;
+    return next;
+}
+
+int traversal_next(inout BVHTraversal traversal, int root) {
+    // The levels already at their second child are done, the deepest one left moves to its second child
+    uint parent_level = traversal.level << 1;
+    traversal.trail = (traversal.trail & ~(parent_level - 1u)) + parent_level;
+    if (traversal.trail == 0u) {
+        return -1;
+    }
+    traversal.level = traversal.trail & (~traversal.trail + 1u);
+
+    if (traversal.count > 0 && traversal.levels[traversal.top] == traversal.level) {
+        int node = traversal.nodes[traversal.top];
+        traversal.top = (traversal.top + SHORT_STACK_SIZE - 1) % SHORT_STACK_SIZE;
+        traversal.count--;
+        traversal.level >>= 1;
+        return node;
+    }
+
+    // The pending node was dropped
+    traversal.count = 0;
+    traversal.level = TRAIL_ROOT_LEVEL;
+    return root;
+}
+#else
+// Full stacks, a push on a full stack is dropped
+const int MAX_STACK_SIZE = 64;
+struct BVHTraversal {
+    int stack[MAX_STACK_SIZE];
+    int size;
+};
+
+struct MeshTraversal {
+    int stack[MESH_STACK_SIZE];
+    int size;
+};
+
+void traversal_begin(out BVHTraversal traversal) {
+    traversal.size = 0;
+}
+
+void traversal_begin(out MeshTraversal traversal) {
+    traversal.size = 0;
+}
+
+int traversal_descend(inout BVHTraversal traversal, int first_child, int second_child) {
+    if (traversal.size < MAX_STACK_SIZE) {
+        traversal.stack[traversal.size++] = second_child;
+    }
+    return first_child;
+}
+
+int traversal_descend(inout MeshTraversal traversal, int first_child, int second_child) {
+    if (traversal.size < MESH_STACK_SIZE) {
+        traversal.stack[traversal.size++] = second_child;
+    }
+    return first_child;
+}
+
+int traversal_next(inout BVHTraversal traversal, int root) {
+    return traversal.size > 0 ? traversal.stack[--traversal.size] : -1;
+}
+
+int traversal_next(inout MeshTraversal traversal, int root) {
+    return traversal.size > 0 ? traversal.stack[--traversal.size] : -1;
+}
+#endif
+
+// Random number generation
+int seed = 0;
+
+int xorshift(int value) {
+    value ^= value << 13;
+    value ^= value >> 17;
+    value ^= value << 5;
+    return value;
+}
+
+float random() {
+    seed = xorshift(seed);
+    return abs(fract(float(seed) / 3141.592653589793238));
+}
+
+// Scramble an integer, so neighbouring pixels and frames start from unrelated seeds
+uint hash(uint value) {
+    value = (value ^ 61u) ^ (value >> 16);
+    value *= 9u;
+    value ^= value >> 4;
+    value *= 0x27d4eb2du;
+    value ^= value >> 15;
+    return value;
+}
+
+// Initialize the seed for a pixel, different for every accumulated frame and every stream of the pixel. Xorshift
+// never leaves zero, so it is avoided.
+void seed_random(uint pixel_index, uint stream) {
+    seed = int(hash(pixel_index ^ hash(accumulated_frames + stream * 0x9e3779b9u)) | 1u);
+}
+
+// Function to create a random direction in the hemisphere around a normal
+vec3 random_hemisphere_direction(vec3 normal) {
+    float theta = 2.0f * 3.14159265359f * random();
+    float phi = acos(2.0f * random() - 1.0f);
+
+    vec3 random_dir = vec3(sin(phi) * cos(theta), sin(phi) * sin(phi), cos(phi));
+
+    if (dot(random_dir, normal) < 0.0f) {
+        random_dir = -random_dir;
+    }
+
+    return normalize(random_dir);
+}
+
+// Generate a random point on a disk
+vec2 random_disk() {
+    float r = sqrt(random());
+    float theta = 2.0 * 3.14159265359 * random();
+    return vec2(r * cos(theta), r * sin(theta));
+}
+
+// Test if a ray intersects an AABB
+bool ray_aabb_intersection(vec3 ray_origin, vec3 ray_dir, vec3 box_min, vec3 box_max) {
+    vec3 inv_dir = 1.0 / ray_dir;
+    vec3 t_min = (box_min - ray_origin) * inv_dir;
+    vec3 t_max = (box_max - ray_origin) * inv_dir;
+
+    vec3 t1 = min(t_min, t_max);
+    vec3 t2 = max(t_min, t_max);
+
+    float t_near = max(max(t1.x, t1.y), t1.z);
+    float t_far = min(min(t2.x, t2.y), t2.z);
+
+    return t_near <= t_far && t_far > 0.0;
+}
+
+// Ray-Sphere intersection
+float ray_sphere(vec3 ray_pos, vec3 ray_dir, int sphere_index, float time, out vec3 intersect_pt, out vec3 normal) {
+    vec3 sphere_pos = objects.spheres[sphere_index].position + objects.spheres[sphere_index].velocity * time;
+    vec3 oc = ray_pos - sphere_pos;
+
+    float a = dot(ray_dir, ray_dir);
+    float b = 2.0 * dot(oc, ray_dir);
+    float c = dot(oc, oc) - objects.spheres[sphere_index].radius * objects.spheres[sphere_index].radius;
+
+    float discriminant = b * b - 4.0 * a * c;
+
+    if (discriminant < 0.0) {
+        return -2.0;// No intersection
+    }
+
+    float t = (-b - sqrt(discriminant)) / (2.0 * a);
+
+    if (t < 0.0) {
+        t = (-b + sqrt(discriminant)) / (2.0 * a);
+        if (t < 0.0) {
+            return -1.0;// Both intersections are behind the ray
+        }
+    }
+
+    intersect_pt = ray_pos + t * ray_dir;
+    normal = normalize(intersect_pt - sphere_pos);
+
+    return t;
+}
+
+// Ray-Triangle intersection
+float ray_triangle(vec3 ray_pos, vec3 ray_dir, vec3 p0, vec3 p1, vec3 p2, out vec3 intersect_pt, out vec3 normal) {
+    vec3 edge1 = p1 - p0;
+    vec3 edge2 = p2 - p0;
+    normal = normalize(cross(edge1, edge2));
+
+    float ndotray = dot(normal, ray_dir);
+    if (abs(ndotray) < 0.000001)
+    return -1.0;// They are parallel, no intersection
+
+    float d = dot(normal, p0);
+    float t = (dot(normal, ray_pos) - d) / -ndotray;
+
+    if (t < 0.0)
+    return -1.0;
+
+    intersect_pt = ray_pos + t * ray_dir;
+
+    vec3 c0 = cross(p1 - intersect_pt, p2 - intersect_pt);
+    vec3 c1 = cross(p2 - intersect_pt, p0 - intersect_pt);
+    vec3 c2 = cross(p0 - intersect_pt, p1 - intersect_pt);
+
+    if (dot(normal, c0) < 0.0 || dot(normal, c1) < 0.0 || dot(normal, c2) < 0.0)
+    return -1.0;
+
+    return t;
+}
+
+// Ray-Triangle intersection returning barycentric coordinates (Moller-Trumbore)
+float ray_triangle_barycentric(vec3 ray_pos, vec3 ray_dir, vec3 p0, vec3 p1, vec3 p2, out vec2 barycentric) {
+    vec3 edge1 = p1 - p0;
+    vec3 edge2 = p2 - p0;
+    vec3 p_vec = cross(ray_dir, edge2);
+    float det = dot(edge1, p_vec);
+    if (abs(det) < 1e-12)
+    return -1.0;// They are parallel, no intersection
+
+    float inv_det = 1.0 / det;
+    vec3 t_vec = ray_pos - p0;
+    float u = dot(t_vec, p_vec) * inv_det;
+    if (u < 0.0 || u > 1.0)
+    return -1.0;
+
+    vec3 q_vec = cross(t_vec, edge1);
+    float v = dot(ray_dir, q_vec) * inv_det;
+    if (v < 0.0 || u + v > 1.0)
+    return -1.0;
+
+    barycentric = vec2(u, v);
+    return dot(edge2, q_vec) * inv_det;
+}
+
+// Ray-Plane intersection
+float ray_plane(vec3 ray_pos, vec3 ray_dir, vec3 plane_pos, vec3 plane_normal, out vec3 intersec_pt, out vec3 normal) {
+    plane_normal = normalize(plane_normal);
+
+    float denom = dot(plane_normal, ray_dir);
+    if (abs(denom) < 0.000001) {
+        return -1.0;// No intersection, ray is parallel to plane
+    }
+
+    float t = dot(plane_normal, plane_pos - ray_pos) / denom;
+
+    if (t < 0.0) {
+        return -1.0;
+    }
+
+    intersec_pt = ray_pos + t * ray_dir;
+    normal = denom < 0.0 ? plane_normal : -plane_normal;
+
+    return t;
+}
+
+// Ray-CSG operations
+Roth ray_sphere_roth(vec3 ray_pos, vec3 ray_dir, vec3 sphere_pos, float sphere_radius, int material_index) {
+    Roth result;
+    result.nb_hits = 0;
+
+    vec3 oc = ray_pos - sphere_pos;
+
+    float a = dot(ray_dir, ray_dir);
+    float b = 2.0 * dot(oc, ray_dir);
+    float c = dot(oc, oc) - sphere_radius * sphere_radius;
+
+    float discriminant = b * b - 4.0 * a * c;
+
+    if (discriminant < 0.0) {
+        return result;// No intersection
+    }
+
+    // Calculate the two intersection distances
+    float t1 = (-b - sqrt(discriminant)) / (2.0 * a);
+    float t2 = (-b + sqrt(discriminant)) / (2.0 * a);
+
+    // Add entry point
+    vec3 intersect_pt1 = ray_pos + t1 * ray_dir;
+    vec3 normal1 = normalize(intersect_pt1 - sphere_pos);
+
+    result.hits[result.nb_hits].distance = t1;
+    result.hits[result.nb_hits].surface_normal = normal1;
+    result.hits[result.nb_hits].surface_material_index = material_index;
+    result.nb_hits++;
+
+    // Add exit point
+    vec3 intersect_pt2 = ray_pos + t2 * ray_dir;
+    vec3 normal2 = normalize(intersect_pt2 - sphere_pos);
+
+    result.hits[result.nb_hits].distance = t2;
+    result.hits[result.nb_hits].surface_normal = -normal2;// Negative normal for exit point
+    result.hits[result.nb_hits].surface_material_index = material_index;
+    result.nb_hits++;
+
+    return result;
+}
+
+// Union operation: Combines two objects, returns all intersection points sorted by distance
+Roth unionCSG(Roth roth1, Roth roth2) {
+    Roth result;
+    result.nb_hits = 0;
+
+    int i = 0, j = 0;
+
+    // Merge hits from both roths, keeping them ordered by distance
+    int inside_count = 0;
+    while (i < roth1.nb_hits && j < roth2.nb_hits && result.nb_hits < 8) {
+        if (roth1.hits[i].distance < roth2.hits[j].distance) {
+            if (i % 2 != 0) {
+                if (inside_count == 1) {
+                    result.hits[result.nb_hits] = roth1.hits[i];
+                    result.nb_hits++;
+                }
+                inside_count--;
+            }
+            else {
+                if (inside_count == 0) {
+                    result.hits[result.nb_hits] = roth1.hits[i];
+                    result.nb_hits++;
+                }
+                inside_count++;
+            }
+            i++;
+        } else {
+            if (j % 2 != 0) {
+                if (inside_count == 1) {
+                    result.hits[result.nb_hits] = roth2.hits[j];
+                    result.nb_hits++;
+                }
+                inside_count--;
+            }
+            else {
+                if (inside_count == 0) {
+                    result.hits[result.nb_hits] = roth2.hits[j];
+                    result.nb_hits++;
+                }
+                inside_count++;
+            }
+            j++;
+        }
+    }
+
+    // Add remaining hits from roth1
+    while (i < roth1.nb_hits && result.nb_hits < 8) {
+        result.hits[result.nb_hits] = roth1.hits[i];
+        i++;
+        result.nb_hits++;
+    }
+
+    // Add remaining hits from roth2
+    while (j < roth2.nb_hits && result.nb_hits < 8) {
+        result.hits[result.nb_hits] = roth2.hits[j];
+        j++;
+        result.nb_hits++;
+    }
+
+    return result;
+}
+
+// Intersection operation: Returns intersection points where both objects overlap
+Roth intersectionCSG(Roth roth1, Roth roth2, vec3 ray_dir) {
+    Roth result;
+    result.nb_hits = 0;
+
+    int i = 0, j = 0;
+
+    // Merge hits from both roths, keeping them ordered by distance
+    int inside_count = 0;
+    while (i < roth1.nb_hits && j < roth2.nb_hits && result.nb_hits < 8) {
+        if (roth1.hits[i].distance < roth2.hits[j].distance) {
+            if (i % 2 != 0) {
+                if (inside_count == 2) {
+                    result.hits[result.nb_hits] = roth1.hits[i];
+                    result.nb_hits++;
+                }
+                inside_count--;
+            }
+            else {
+                if (inside_count == 1) {
+                    result.hits[result.nb_hits] = roth1.hits[i];
+                    result.nb_hits++;
+                }
+                inside_count++;
+            }
+            i++;
+        } else {
+            if (j % 2 != 0) {
+                if (inside_count == 2) {
+                    result.hits[result.nb_hits] = roth2.hits[j];
+                    result.nb_hits++;
+                }
+                inside_count--;
+            }
+            else {
+                if (inside_count == 1) {
+                    result.hits[result.nb_hits] = roth2.hits[j];
+                    result.nb_hits++;
+                }
+                inside_count++;
+            }
+            j++;
+        }
+    }
+
+    return result;
+}
+
+// Complement operation: Inverts an object, turning inside to outside
+Roth complementCSG(Roth roth) {
+    Roth result;
+
+    // For empty Roth, complement is a special case
+    if (roth.nb_hits == 0) {
+        // Create a "universe" hit at infinity
+        result.nb_hits = 2;
+        result.hits[0].distance = 0.0;
+        result.hits[0].surface_normal = vec3(0.0, 0.0, 0.0);
+        result.hits[0].surface_material_index = 0;
+
+        result.hits[1].distance = 1.0e30;// Very far away
+        result.hits[1].surface_normal = vec3(0.0, 0.0, 0.0);
+        result.hits[1].surface_material_index = 0;
+        return result;
+    }
+
+    result.nb_hits = roth.nb_hits;
+
+    // Swap entry and exit points by reversing the array
+    for (int i = 0; i < roth.nb_hits; i++) {
+        result.hits[i] = roth.hits[roth.nb_hits - 1 - i];
+    }
+
+    return result;
+}
+
+// Difference operation: Subtracts the second object from the first
+Roth differenceCSG(Roth roth1, Roth roth2, vec3 ray_dir) {
+    Roth complement = complementCSG(roth2);
+    return intersectionCSG(roth1, complement, ray_dir);
+}
+
+// Main CSG ray function that performs (Sphere1 ∩ Sphere2) + Sphere3) – Sphere4
+float rayCSG(vec3 ray_pos, vec3 ray_dir, out vec3 intersect_point, out vec3 normal, out int object_id, out int object_type) {
+    // Get sphere data from uniform array
+    vec3 sphere1_pos = objects.csgSpheres[0].xyz;
+    float sphere1_radius = objects.csgSpheres[0].w;
+
+    vec3 sphere2_pos = objects.csgSpheres[1].xyz;
+    float sphere2_radius = objects.csgSpheres[1].w;
+
+    vec3 sphere3_pos = objects.csgSpheres[2].xyz;
+    float sphere3_radius = objects.csgSpheres[2].w;
+
+    vec3 sphere4_pos = objects.csgSpheres[3].xyz;
+    float sphere4_radius = objects.csgSpheres[3].w;
+
+    // Calculate CSG operations step by step
+    // 1. Get intersections with each sphere
+    Roth roth1 = ray_sphere_roth(ray_pos, ray_dir, sphere1_pos, sphere1_radius, 0);
+    Roth roth2 = ray_sphere_roth(ray_pos, ray_dir, sphere2_pos, sphere2_radius, 1);
+    Roth roth3 = ray_sphere_roth(ray_pos, ray_dir, sphere3_pos, sphere3_radius, 2);
+    Roth roth4 = ray_sphere_roth(ray_pos, ray_dir, sphere4_pos, sphere4_radius, 3);
+
+    // 2. Perform (Sphere1 ∩ Sphere2) + Sphere3) – Sphere4
+    Roth intersection_result = intersectionCSG(roth1, roth2, ray_dir);// Sphere1 ∩ Sphere2
+    Roth union_result = unionCSG(intersection_result, roth3);// (Sphere1 ∩ Sphere2) + Sphere3
+    Roth final_result = differenceCSG(union_result, roth4, ray_dir);// ((Sphere1 ∩ Sphere2) + Sphere3) - Sphere4
+
+    // 3. Find closest hit point in the final result
+    if (final_result.nb_hits > 0) {
+        intersect_point = ray_pos + final_result.hits[0].distance * ray_dir;
+        normal = final_result.hits[0].surface_normal;
+        object_id = final_result.hits[0].surface_material_index;
+        object_type = 3;// Special type for CSG objects
+        return final_result.hits[0].distance;
+    }
+
+    return -1.0;// No intersection
+}
+
+// Decode an octahedral-encoded snorm16x2 normal
+vec3 oct_decode(uint packed_normal) {
+    vec2 e = unpackSnorm2x16(packed_normal);
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// Fetch and decode the position of a mesh vertex
+vec3 mesh_vertex_position(int encoding, uint vertex_offset, vec3 grid_min, vec3 grid_step, uint vertex) {
+    if (encoding == MESH_ENCODING_QUANTIZED) {
+        uint base = vertex_offset + vertex * 3u;
+        uint xy = mesh_vertices.words[base];
+        uint z = mesh_vertices.words[base + 1u];
+        return grid_min + vec3(float(xy & 0xFFFFu), float(xy >> 16), float(z & 0xFFFFu)) * grid_step;
+    }
+
+    uint base = vertex_offset + vertex * 6u;
+    return uintBitsToFloat(uvec3(mesh_vertices.words[base], mesh_vertices.words[base + 1u], mesh_vertices.words[base + 2u]));
+}
+
+// Fetch and decode the normal of a mesh vertex
+vec3 mesh_vertex_normal(int encoding, uint vertex_offset, uint vertex) {
+    if (encoding == MESH_ENCODING_QUANTIZED) {
+        return oct_decode(mesh_vertices.words[vertex_offset + vertex * 3u + 2u]);
+    }
+
+    uint base = vertex_offset + vertex * 6u + 3u;
+    return uintBitsToFloat(uvec3(mesh_vertices.words[base], mesh_vertices.words[base + 1u], mesh_vertices.words[base + 2u]));
+}
+
+// Test if a ray hits an AABB closer than max_dist
+bool ray_box(vec3 ray_pos, vec3 inv_ray_dir, vec3 box_min, vec3 box_max, float max_dist) {
+    vec3 t1 = (box_min - ray_pos) * inv_ray_dir;
+    vec3 t2 = (box_max - ray_pos) * inv_ray_dir;
+
+    vec3 t_min = min(t1, t2);
+    vec3 t_max = max(t1, t2);
+
+    float t_near = max(max(t_min.x, t_min.y), t_min.z);
+    float t_far = min(min(t_max.x, t_max.y), t_max.z);
+
+    return t_near <= t_far && t_far > 0.0 && t_near < max_dist;
+}
+
+// Find the nearest intersection with a mesh closer than max_dist, traversing its own BVH. With any_hit, the first
+// triangle found closer than max_dist is returned, without its normal.
+float intersect_mesh(int mesh_index, vec3 ray_pos, vec3 ray_dir, vec3 inv_ray_dir, float max_dist, bool any_hit,
+out vec3 normal) {
+    int node_offset = mesh_infos.meshes[mesh_index].node_offset;
+    uint triangle_offset = uint(mesh_infos.meshes[mesh_index].triangle_offset);
+    uint vertex_offset = uint(mesh_infos.meshes[mesh_index].vertex_offset);
+    int encoding = mesh_infos.meshes[mesh_index].encoding;
+    vec3 grid_min = mesh_infos.meshes[mesh_index].aabb_min;
+    vec3 grid_step = (mesh_infos.meshes[mesh_index].aabb_max - grid_min) / 65535.0;
+
+    float closest_dist = max_dist;
+    bool hit_found = false;
+    uvec3 hit_triangle = uvec3(0u);
+    vec2 hit_barycentric = vec2(0.0);
+
+    MeshTraversal traversal;
+    traversal_begin(traversal);
+    int current_node = 0;
+
+    while (current_node >= 0) {
+        BVHNode node = mesh_nodes.nodes[node_offset + current_node];
+
+        if (!ray_box(ray_pos, inv_ray_dir, node.aabb_min, node.aabb_max, closest_dist)) {
+            current_node = traversal_next(traversal, 0);
+            continue;
+        }
+
+        if (node.left_child < 0) {
+            // Leaf node - test its triangles, decoding the vertices on the fly
+            for (int i = 0; i < node.object_count; i++) {
+                uvec3 triangle = mesh_triangles.triangles[triangle_offset + uint(node.object_index + i)].xyz;
+                vec3 p0 = mesh_vertex_position(encoding, vertex_offset, grid_min, grid_step, triangle.x);
+                vec3 p1 = mesh_vertex_position(encoding, vertex_offset, grid_min, grid_step, triangle.y);
+                vec3 p2 = mesh_vertex_position(encoding, vertex_offset, grid_min, grid_step, triangle.z);
+
+                vec2 barycentric;
+                float dist = ray_triangle_barycentric(ray_pos, ray_dir, p0, p1, p2, barycentric);
+                if (dist > 0.0 && dist < closest_dist) {
+                    if (any_hit) {
+                        return dist;
+                    }
+                    closest_dist = dist;
+                    hit_triangle = triangle;
+                    hit_barycentric = barycentric;
+                    hit_found = true;
+                }
+            }
+            current_node = traversal_next(traversal, 0);
+        }
+        else {
+            // Internal node - visit the child on the near side of the split first
+            bool left_first = ray_dir[max(node.split_axis, 0)] >= 0.0;
+            int first_child = left_first ? node.left_child : node.right_child;
+            int second_child = left_first ? node.right_child : node.left_child;
+            current_node = traversal_descend(traversal, first_child, second_child);
+        }
+    }
+
+    if (!hit_found) return -1.0;
+
+    // Interpolate the vertex normals
+    vec3 n0 = mesh_vertex_normal(encoding, vertex_offset, hit_triangle.x);
+    vec3 n1 = mesh_vertex_normal(encoding, vertex_offset, hit_triangle.y);
+    vec3 n2 = mesh_vertex_normal(encoding, vertex_offset, hit_triangle.z);
+    normal = normalize(n0 * (1.0 - hit_barycentric.x - hit_barycentric.y) + n1 * hit_barycentric.x + n2 * hit_barycentric.y);
+
+    return closest_dist;
+}
+
+// Test intersection between a ray and a single object (used within BVH traversal)
+float intersect_object(vec3 ray_pos, vec3 ray_dir, int object_index, int object_type, float time,
+out vec3 intersect_point, out vec3 normal) {
+    if (object_type == 0) { // Sphere
+        return ray_sphere(ray_pos, ray_dir, object_index, time, intersect_point, normal);
+    }
+    else if (object_type == 1) { // Plane
+        vec3 plane_pos = objects.planes[object_index * 2];
+        vec3 plane_normal = objects.planes[object_index * 2 + 1];
+        return ray_plane(ray_pos, ray_dir, plane_pos, plane_normal, intersect_point, normal);
+    }
+    else if (object_type == 2) { // Triangle
+        vec3 p0 = objects.triangles[object_index * 3];
+        vec3 p1 = objects.triangles[object_index * 3 + 1];
+        vec3 p2 = objects.triangles[object_index * 3 + 2];
+        return ray_triangle(ray_pos, ray_dir, p0, p1, p2, intersect_point, normal);
+    }
+    else if (object_type == 4) { // Mesh
+        float dist = intersect_mesh(object_index, ray_pos, ray_dir, 1.0 / ray_dir, 1e30f, false, normal);
+        intersect_point = ray_pos + dist * ray_dir;
+        return dist;
+    }
+
+    return -1.0;// Invalid object type
+}
+
+// Test the objects of a BVH leaf, keeping the nearest hit closer than closest_dist; returns whether one was found
+bool intersect_leaf(BVHNode node, vec3 ray_pos, vec3 ray_dir, vec3 inv_ray_dir, float time, inout float closest_dist,
+inout vec3 intersec_i, inout vec3 normal_i, inout int object_id, inout int object_type) {
+    bool hit_found = false;
+    for (int i = 0; i < node.object_count; i++) {
+        int obj_idx = node.object_index + i;
+        vec3 intersect_point;
+        vec3 normal;
+
+        float dist = -1.0;
+
+        // Handle different object types
+        if (node.object_type == 0) { // Sphere
+            dist = ray_sphere(ray_pos, ray_dir, obj_idx, time, intersect_point, normal);
+        }
+        else if (node.object_type == 1) { // Plane
+            vec3 plane_pos = objects.planes[obj_idx * 2];
+            vec3 plane_normal = objects.planes[obj_idx * 2 + 1];
+            dist = ray_plane(ray_pos, ray_dir, plane_pos, plane_normal, intersect_point, normal);
+        }
+        else if (node.object_type == 2) { // Triangle
+            vec3 p0 = objects.triangles[obj_idx * 3];
+            vec3 p1 = objects.triangles[obj_idx * 3 + 1];
+            vec3 p2 = objects.triangles[obj_idx * 3 + 2];
+            dist = ray_triangle(ray_pos, ray_dir, p0, p1, p2, intersect_point, normal);
+        }
+        else if (node.object_type == 4) { // Mesh
+            dist = intersect_mesh(obj_idx, ray_pos, ray_dir, inv_ray_dir, closest_dist, false, normal);
+            intersect_point = ray_pos + dist * ray_dir;
+        }
+
+        if (dist > 0.0 && dist < closest_dist) {
+            closest_dist = dist;
+            intersec_i = intersect_point;
+            normal_i = normal;
+            object_id = obj_idx;
+            object_type = node.object_type;
+            hit_found = true;
+        }
+    }
+    return hit_found;
+}
+
+// Keep the hit of the CSG object when it is nearer than closest_dist; returns whether it was
+bool intersect_csg(vec3 ray_pos, vec3 ray_dir, inout float closest_dist, inout vec3 intersec_i, inout vec3 normal_i,
+inout int object_id, inout int object_type) {
+    vec3 csg_intersect_point;
+    vec3 csg_normal;
+    int csg_object_id, csg_object_type;
+    float csg_dist = rayCSG(ray_pos, ray_dir, csg_intersect_point, csg_normal,
+    csg_object_id, csg_object_type);
+
+    if (csg_dist <= 0.0 || csg_dist >= closest_dist) {
+        return false;
+    }
+
+    intersec_i = csg_intersect_point;
+    normal_i = csg_normal;
+    object_id = csg_object_id;
+    object_type = csg_object_type;
+    closest_dist = csg_dist;
+    return true;
+}
+
+// Find the nearest intersection using BVH traversal
+float compute_nearest_intersection(vec3 ray_pos, vec3 ray_dir, float time,
+out vec3 intersec_i, out vec3 normal_i,
+out int object_id, out int object_type) {
+    // Default to no intersection
+    float closest_dist = 1e30f;
+    bool hit_found = false;
+
+    // Precompute inverse ray direction for faster AABB tests
+    vec3 inv_ray_dir = 1.0 / ray_dir;
+
+    // For faster ray-AABB tests (SIMD optimizations)
+    ivec3 ray_dir_sign = ivec3(
+    ray_dir.x < 0.0 ? 1 : 0,
+    ray_dir.y < 0.0 ? 1 : 0,
+    ray_dir.z < 0.0 ? 1 : 0
+    );
+
+    // Initialize BVH traversal
+    BVHTraversal traversal;
+    traversal_begin(traversal);
+
+    // Start with the root node
+    int current_node = bvh.rootNode;
+
+    // Check if BVH is valid
+    if (current_node < 0 || current_node >= bvh.numNodes) {
+        // BVH is invalid or empty, fall back to direct object testing
+        // Test all spheres directly
+        for (int i = 0; i < objects.numSpheres && i < 256; i++) {
+            vec3 intersect_point_sphere;
+            vec3 normal_sphere;
+            float sphere_dist = ray_sphere(ray_pos, ray_dir, i, time, intersect_point_sphere, normal_sphere);
+
+            if (sphere_dist > 0.0 && sphere_dist < closest_dist) {
+                intersec_i = intersect_point_sphere;
+                normal_i = normal_sphere;
+                closest_dist = sphere_dist;
+                object_id = i;
+                object_type = 0;
+                hit_found = true;
+            }
+        }
+
+        // Test all planes directly
+        // ... (keeping the other direct intersection tests)
+
+        if (!hit_found) return -1.0;
+        return closest_dist;
+    }
+
+    // Non-recursive traversal
+    while (current_node >= 0) {
+        // If current_node is invalid, move on to the next pending one
+        if (current_node >= bvh.numNodes) {
+            current_node = traversal_next(traversal, bvh.rootNode);
+            continue;
+        }
+
+        BVHNode node = traversal_node(current_node);
+
+        // Optimized ray-AABB intersection test
+        vec3 t_min = (node.aabb_min - ray_pos) * inv_ray_dir;
+        vec3 t_max = (node.aabb_max - ray_pos) * inv_ray_dir;
+
+        // Handle negative ray directions
+        if (ray_dir_sign.x > 0) { float tmp = t_min.x; t_min.x = t_max.x; t_max.x = tmp; }
+        if (ray_dir_sign.y > 0) { float tmp = t_min.y; t_min.y = t_max.y; t_max.y = tmp; }
+        if (ray_dir_sign.z > 0) { float tmp = t_min.z; t_min.z = t_max.z; t_max.z = tmp; }
+
+        float t_near = max(max(t_min.x, t_min.y), t_min.z);
+        float t_far = min(min(t_max.x, t_max.y), t_max.z);
+
+        // No intersection with this node's AABB or intersection is beyond current closest hit
+        bool hit = !(t_near > t_far || t_far < 0.0 || t_near > closest_dist);
+        if (!traversal_visit(hit)) {
+            current_node = traversal_next(traversal, bvh.rootNode);
+            continue;
+        }
+
+        // Check if this is a leaf node (left_child < 0)
+        if (node.left_child < 0) {
+            // Leaf node - test all objects in this leaf, when this ray hits it
+            if (hit && intersect_leaf(node, ray_pos, ray_dir, inv_ray_dir, time, closest_dist, intersec_i, normal_i,
+                object_id, object_type)) {
+                hit_found = true;
+            }
+
+            // Done with this leaf node, move on to the next pending one
+            current_node = traversal_next(traversal, bvh.rootNode);
+        }
+        else {
+            // Internal node - determine which child to visit first
+            int first_child, second_child;
+
+            // Use split axis to determine traversal order
+            int axis = node.split_axis;
+            if (axis < 0 || axis > 2) {
+                // Invalid split axis, just use the longest axis
+                vec3 extent = node.aabb_max - node.aabb_min;
+                axis = 0;
+                if (extent.y > extent.x) axis = 1;
+                if (extent.z > extent[axis]) axis = 2;
+            }
+
+            // Find midpoint on split axis
+            float midpoint = (node.aabb_min[axis] + node.aabb_max[axis]) * 0.5;
+
+            bool left_first = (ray_pos[axis] < midpoint && ray_dir[axis] >= 0.0) ||
+            (ray_pos[axis] >= midpoint && ray_dir[axis] < 0.0);
+            if (traversal_left_first(left_first)) {
+                // Left child is closer
+                first_child = node.left_child;
+                second_child = node.right_child;
+            } else {
+                // Right child is closer
+                first_child = node.right_child;
+                second_child = node.left_child;
+            }
+
+            // Children out of range are skipped when they are reached
+            current_node = traversal_descend(traversal, first_child, second_child);
+        }
+    }
+
+    // Check for CSG objects after BVH traversal
+    if (intersect_csg(ray_pos, ray_dir, closest_dist, intersec_i, normal_i, object_id, object_type)) {
+        hit_found = true;
+    }
+
+    if (!hit_found) return -1.0;
+    return closest_dist;
+}
+
+// Whether anything blocks a ray before t_max, for shadow rays. The traversal stops at the first hit, visits the nodes
+// in any order and only evaluates the CSG object when the BVH found nothing.
+bool compute_occlusion(vec3 ray_pos, vec3 ray_dir, float time, float t_max) {
+    vec3 inv_ray_dir = 1.0 / ray_dir;
+    vec3 intersect_point;
+    vec3 normal;
+
+    int current_node = bvh.rootNode;
+    if (current_node < 0 || current_node >= bvh.numNodes) {
+        // Without a BVH, the spheres are tested directly as in compute_nearest_intersection
+        for (int i = 0; i < objects.numSpheres && i < 256; i++) {
+            float dist = ray_sphere(ray_pos, ray_dir, i, time, intersect_point, normal);
+            if (dist > 0.0 && dist < t_max) {
+                return true;
+            }
+        }
+    }
+    else {
+        BVHTraversal traversal;
+        traversal_begin(traversal);
+
+        while (current_node >= 0) {
+            if (current_node >= bvh.numNodes) {
+                current_node = traversal_next(traversal, bvh.rootNode);
+                continue;
+            }
+
+            BVHNode node = traversal_node(current_node);
+            bool hit = ray_box(ray_pos, inv_ray_dir, node.aabb_min, node.aabb_max, t_max);
+            if (!traversal_visit(hit)) {
+                current_node = traversal_next(traversal, bvh.rootNode);
+                continue;
+            }
+
+            if (node.left_child < 0) {
+                for (int i = 0; i < node.object_count && hit; i++) {
+                    int obj_idx = node.object_index + i;
+                    float dist;
+                    if (node.object_type == 4) {
+                        dist = intersect_mesh(obj_idx, ray_pos, ray_dir, inv_ray_dir, t_max, true, normal);
+                    } else {
+                        dist = intersect_object(ray_pos, ray_dir, obj_idx, node.object_type, time, intersect_point,
+                            normal);
+                    }
+                    if (dist > 0.0 && dist < t_max) {
+                        return true;
+                    }
+                }
+                current_node = traversal_next(traversal, bvh.rootNode);
+            }
+            else {
+                // Any hit ends the traversal, the order of the children does not matter
+                current_node = traversal_descend(traversal, node.left_child, node.right_child);
+            }
+        }
+    }
+
+    int csg_object_id, csg_object_type;
+    float csg_dist = rayCSG(ray_pos, ray_dir, intersect_point, normal, csg_object_id, csg_object_type);
+    return csg_dist > 0.0 && csg_dist < t_max;
+}
+
+// Get material for a hit point
+Material get_material(int object_type, int object_id, vec3 position) {
+    Material mat;
+    mat.reflection_coef = 0.0f;
+    mat.refraction_coef = 0.0f;
+    mat.refraction_index = 1.0f;
+    mat.absorption = vec3(0.0);
+
+    if (object_type == 0) { // Sphere
+        return objects.sphere_materials[object_id];
+    }
+    else if (object_type == 1) { // Plane
+        // Create checkerboard pattern based on the position
+        vec3 plane_pos = objects.planes[object_id * 2];
+        vec3 plane_normal = normalize(objects.planes[object_id * 2 + 1]);
+
+        vec3 u_axis = normalize(cross(plane_normal, abs(plane_normal.y) < 0.999 ? vec3(0, 1, 0) : vec3(1, 0, 0)));
+        vec3 v_axis = normalize(cross(plane_normal, u_axis));
+
+        float u = dot(position - plane_pos, u_axis);
+        float v = dot(position - plane_pos, v_axis);
+
+        float scale = 1.0;
+        bool isEvenU = mod(floor(u * scale), 2.0) < 1.0;
+        bool isEvenV = mod(floor(v * scale), 2.0) < 1.0;
+        bool isBlack = isEvenU != isEvenV;
+
+        mat.ambient = vec3(0.1, 0.1, 0.1);
+        mat.specular = vec3(0.2, 0.2, 0.2);
+        mat.shininess = 4.0;
+
+        if (isBlack) {
+            mat.diffuse = vec3(0.1, 0.1, 0.1);
+        } else {
+            mat.diffuse = vec3(0.9, 0.9, 0.9);
+        }
+    }
+    else if (object_type == 2) { // Triangle
+        return objects.triangle_materials[object_id];
+    }
+    else if (object_type == 4) { // Mesh
+        return mesh_infos.meshes[object_id].material;
+    }
+    else {
+        return objects.csg_sphere_materials[object_id];
+    }
+
+    return mat;
+}
+
+// Unshadowed lighting of a point: the ambient term, and the diffuse and specular terms scaled by the light intensity
+void lighting_terms(vec3 position, vec3 normal, vec3 view_dir, Material material,
+out vec3 ambient, out vec3 direct, out vec3 light_dir, out float light_distance) {
+    // Ambient
+    ambient = material.ambient * lighting.ambientLight;
+
+    vec3 light_pos = lighting.lightPosition.xyz;
+    float light_intensity = lighting.lightPosition.w;
+
+    light_dir = normalize(light_pos - position);
+    light_distance = distance(light_pos, position);
+
+    // Diffuse
+    float diff = max(dot(normal, light_dir), 0.0);
+    vec3 diffuse = diff * material.diffuse * vec3(1.0);
+
+    // Specular
+    vec3 specular;
+    if (lighting.lightType == 0) {
+        // Phong
+        vec3 reflect_dir = reflect(-light_dir, normal);
+        float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
+        specular = spec * material.specular;
+    } else {
+        // Blinn-Phong
+        vec3 halfway = normalize(light_dir + view_dir);
+        float spec = pow(max(dot(halfway, normal), 0.0), material.shininess);
+        specular = spec * material.specular;
+    }
+
+    direct = diffuse + specular * light_intensity;
+}
+
+// Random point of the light, a disc of radius light_radius facing the shaded point, for soft shadows
+vec3 sample_light_point(vec3 light_dir) {
+    vec3 up = vec3(0.0f, 1.0f, 0.0f);
+    if (abs(dot(light_dir, up)) > 0.99f) {
+        up = vec3(1.0f, 0.0f, 0.0f);
+    }
+    vec3 right = normalize(cross(up, light_dir));
+    up = normalize(cross(light_dir, right));
+
+    vec2 disk = random_disk() * lighting.light_radius;
+    return lighting.lightPosition.xyz + right * disk.x + up * disk.y;
+}
+
+// Fraction of the area light seen from a point, as in default.frag: shadow_samples occlusion rays towards random points
+// of the light, for each of the time samples of the exposure
+float calculate_shadows(vec3 position, vec3 normal, vec3 light_dir) {
+    const int time_samples = camera.exposure_time < 0.0001 && camera.time_samples > 0 ? 1 : camera.time_samples;
+
+    // Offset position slightly to avoid self-intersection
+    vec3 offset_pos = position + normal * 0.001;
+
+    float lit = 0.0;
+    for (int t = 0; t < time_samples; t++) {
+        float time = camera.exposure_time * random();
+        for (int i = 0; i < lighting.shadow_samples; i++) {
+            vec3 to_light = sample_light_point(light_dir) - offset_pos;
+            float light_distance = length(to_light);
+            if (!compute_occlusion(offset_pos, to_light / light_distance, time, light_distance)) {
+                lit += 1.0;
+            }
+        }
+    }
+    return lit / float(time_samples * lighting.shadow_samples);
+}
+
+// Calculate lighting
+vec3 calculate_lighting(vec3 position, vec3 normal, vec3 view_dir, Material material, vec3 light_color) {
+    vec3 ambient, direct, light_dir;
+    float light_distance;
+    lighting_terms(position, normal, view_dir, material, ambient, direct, light_dir, light_distance);
+
+    float shadow = lighting.shadow_samples > 0 ? calculate_shadows(position, normal, light_dir) : 1.0;
+    vec3 result = ambient + shadow * direct;
+    result *= light_color;
+    return result;
+}
+
+// Axes of the camera, the ray through the screen position uv goes along uv.x * right + uv.y * up - dist * forward
+void camera_frame(out vec3 forward, out vec3 right, out vec3 up, out float dist) {
+    float aspect = camera.windowSize.x / camera.windowSize.y;
+    vec2 uv_size;
+    if (aspect >= 1.0) {
+        uv_size = vec2(2.0 * aspect, 2.0);
+    } else {
+        uv_size = vec2(2.0, 2.0 / aspect);
+    }
+
+    forward = normalize(camera.cameraPosition - camera.cameraTarget);
+    right = normalize(cross(vec3(0.0f, 1.0f, 0.0f), forward));
+    up = cross(forward, right);
+    dist = uv_size.y / tan(camera.cameraFov / 2);
+}
+
+// Calculate primary ray direction for a pixel
+void compute_primary_ray(vec2 uv, out vec3 ray_pos, out vec3 ray_dir) {
+    vec3 from = camera.cameraPosition;
+
+    vec3 forward, right, up;
+    float dist;
+    camera_frame(forward, right, up, dist);
+    vec3 direction = normalize(uv.x * right + uv.y * up - dist * forward);
+
+    // Handle depth of field
+    if (camera.apertureSize < 0.001) {
+        ray_pos = from;
+        ray_dir = direction;
+        return;
+    }
+
+    vec3 focal_point = from + direction * camera.focalDistance;
+    vec2 lens_offset = random_disk() * camera.apertureSize;
+    vec3 lens_pos = from + lens_offset.x * right + lens_offset.y * up;
+
+    ray_pos = lens_pos;
+    ray_dir = normalize(focal_point - lens_pos);
+}
+
+// Create a glossy reflection direction with randomness
+vec3 glossy_reflect(vec3 incident, vec3 normal, float glossiness) {
+    vec3 reflection = reflect(incident, normal);
+
+    if (glossiness < 0.001f) {
+        return reflection;
+    }
+
+    vec3 random_dir = random_hemisphere_direction(normal);
+    return normalize(mix(reflection, random_dir, glossiness));
+}
+
+// Color of the rays that leave the scene
+const vec3 BACKGROUND_COLOR = vec3(0.2f, 0.3f, 0.4f);
+
+// Screen position of a point of the image, in pixels
+vec2 screen_uv(vec2 sample_coord) {
+    vec2 sample_uv = (sample_coord / camera.windowSize - 0.5) * 2.0;
+
+    float aspect = camera.windowSize.x / camera.windowSize.y;
+    if (aspect >= 1.0) {
+        sample_uv.x *= aspect;
+    } else {
+        sample_uv.y /= aspect;
+    }
+    return sample_uv;
+}
+
+// Screen position of a sample of a pixel, in the stratum s of a grid of samples x samples
+vec2 compute_sample_uv(vec2 pixel_coord, int s, int samples) {
+    int x = s % samples;
+    int y = s / samples;
+    float step_size = 1.0 / samples;
+
+    // Sample the center of each stratum first, then jitter inside it so accumulated frames also converge
+    // the antialiasing
+    vec2 jitter = accumulated_frames == 0u ? vec2(0.5) : vec2(random(), random());
+    vec2 offset = vec2(
+    (float(x) + jitter.x) * step_size - 0.5,
+    (float(y) + jitter.y) * step_size - 0.5
+    ) / camera.windowSize;
+
+    return screen_uv(pixel_coord + offset * camera.windowSize);
+}
+
+#ifdef TILE_FRUSTUM
+// Frustum traversal of the primary rays, for the kernels whose work groups cover a tile of pixels and define
+// TILE_FRUSTUM: the work group culls the BVH against the frustum of its pixels together, one level of the tree at a
+// time, and every primary ray then tests the leaves left instead of traversing the tree on its own.
+uniform bool tile_frustum;
+
+// A binary tree of the nodes of the BVH block has no more leaves, nor nodes on one level
+const uint TILE_FRUSTUM_MAX_NODES = 512u;
+
+// Nodes of the level being culled and of the next one, and the leaves of the frustum
+shared int frustum_levels[2][TILE_FRUSTUM_MAX_NODES];
+shared uint frustum_level_sizes[2];
+shared int frustum_leaves[TILE_FRUSTUM_MAX_NODES];
+shared float frustum_leaf_distances[TILE_FRUSTUM_MAX_NODES];
+shared uint frustum_leaf_count;
+shared bool frustum_overflow;
+
+// Pixels of the work group inside the image: min x, min y, max x, max y
+shared int frustum_pixels[4];
+
+// Whether the leaves of the frustum are ready for the primary rays of this invocation, the same in the whole group
+bool tile_frustum_ready = false;
+
+// Whether an AABB is on the inner side of the four planes of the frustum, which all go through the camera
+bool box_in_frustum(vec3 box_min, vec3 box_max, vec3 planes[4]) {
+    for (int i = 0; i < 4; i++) {
+        // Corner of the box the furthest along the normal
+        vec3 corner = mix(box_min, box_max, greaterThanEqual(planes[i], vec3(0.0)));
+        if (dot(planes[i], corner - camera.cameraPosition) < 0.0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Distance from a point to an AABB, zero inside. A ray from the point enters the box no closer than that.
+float box_distance(vec3 point, vec3 box_min, vec3 box_max) {
+    return length(max(box_min - point, 0.0) + max(point - box_max, 0.0));
+}
+
+// Build the leaves of the frustum of the work group; every invocation calls it, inside the image or not
+void build_tile_frustum(ivec2 pixel_coord) {
+    // The condition is the same in the whole group, which reaches the barriers below together or not at all. A lens
+    // moves the origin of the rays out of the frustum.
+    if (!tile_frustum || camera.apertureSize >= 0.001 || bvh.rootNode < 0 || bvh.rootNode >= bvh.numNodes) {
+        return;
+    }
+
+    uint index = gl_LocalInvocationIndex;
+    uint group_size = gl_WorkGroupSize.x * gl_WorkGroupSize.y * gl_WorkGroupSize.z;
+    if (index == 0u) {
+        frustum_pixels[0] = frustum_pixels[1] = 0x7fffffff;
+        frustum_pixels[2] = frustum_pixels[3] = -1;
+        frustum_levels[0][0] = bvh.rootNode;
+        frustum_level_sizes[0] = 1u;
+        frustum_level_sizes[1] = 0u;
+        frustum_leaf_count = 0u;
+        frustum_overflow = false;
+    }
+    memoryBarrierShared();
+    barrier();
+
+    // The pixels of a checkerboard pass are spread over more than the group size, the bounds cover them all
+    if (pixel_coord.x < int(camera.windowSize.x) && pixel_coord.y < int(camera.windowSize.y)) {
+        atomicMin(frustum_pixels[0], pixel_coord.x);
+        atomicMin(frustum_pixels[1], pixel_coord.y);
+        atomicMax(frustum_pixels[2], pixel_coord.x);
+        atomicMax(frustum_pixels[3], pixel_coord.y);
+    }
+    memoryBarrierShared();
+    barrier();
+
+    // No pixel of the group in the image
+    if (frustum_pixels[2] < 0) {
+        return;
+    }
+
+    // Rays through the corners of the pixels, their samples are jittered up to half a pixel
+    vec3 forward, right, up;
+    float dist;
+    camera_frame(forward, right, up, dist);
+    vec2 low = screen_uv(vec2(frustum_pixels[0], frustum_pixels[1]) - 0.5);
+    vec2 high = screen_uv(vec2(frustum_pixels[2], frustum_pixels[3]) + 0.5);
+    vec3 corners[4] = vec3[](
+    low.x * right + low.y * up - dist * forward,
+    high.x * right + low.y * up - dist * forward,
+    high.x * right + high.y * up - dist * forward,
+    low.x * right + high.y * up - dist * forward
+    );
+
+    // Planes through two neighbouring corners, oriented towards the center of the tile
+    vec3 center = corners[0] + corners[2];
+    vec3 planes[4];
+    for (int i = 0; i < 4; i++) {
+        planes[i] = cross(corners[i], corners[(i + 1) % 4]);
+        if (dot(planes[i], center) < 0.0) {
+            planes[i] = -planes[i];
+        }
+    }
+
+    uint level = 0u;
+    while (true) {
+        uint size = frustum_level_sizes[level];
+        if (size == 0u) {
+            break;
+        }
+
+        // Every invocation culls a share of the level, the nodes inside add their children to the next one
+        for (uint i = index; i < min(size, TILE_FRUSTUM_MAX_NODES); i += group_size) {
+            int node_index = frustum_levels[level][i];
+            if (node_index < 0 || node_index >= bvh.numNodes) {
+                continue;
+            }
+
+            BVHNode node = fetch_bvh_node(node_index);
+            if (!box_in_frustum(node.aabb_min, node.aabb_max, planes)) {
+                continue;
+            }
+
+            if (node.left_child < 0) {
+                uint slot = atomicAdd(frustum_leaf_count, 1u);
+                if (slot < TILE_FRUSTUM_MAX_NODES) {
+                    frustum_leaves[slot] = node_index;
+                } else {
+                    frustum_overflow = true;
+                }
+            } else {
+                uint slot = atomicAdd(frustum_level_sizes[1u - level], 2u);
+                if (slot + 1u < TILE_FRUSTUM_MAX_NODES) {
+                    frustum_levels[1u - level][slot] = node.left_child;
+                    frustum_levels[1u - level][slot + 1u] = node.right_child;
+                } else {
+                    frustum_overflow = true;
+                }
+            }
+        }
+        memoryBarrierShared();
+        barrier();
+
+        // The level is done, its array takes the level after the next one
+        if (index == 0u) {
+            frustum_level_sizes[level] = 0u;
+        }
+        memoryBarrierShared();
+        barrier();
+        level = 1u - level;
+    }
+
+    // Too many nodes for the shared arrays, e.g. a BVH larger than the block; the rays traverse the tree instead
+    if (frustum_overflow) {
+        return;
+    }
+
+    // Sort the leaves from near to far, by their distance to the camera: the rays of the tile then find their closest
+    // hit early and skip the leaves behind it. Every leaf goes to its rank, the level arrays are free by now.
+    uint leaf_count = frustum_leaf_count;
+    for (uint i = index; i < leaf_count; i += group_size) {
+        BVHNode node = fetch_bvh_node(frustum_leaves[i]);
+        frustum_leaf_distances[i] = box_distance(camera.cameraPosition, node.aabb_min, node.aabb_max);
+    }
+    memoryBarrierShared();
+    barrier();
+
+    for (uint i = index; i < leaf_count; i += group_size) {
+        float leaf_distance = frustum_leaf_distances[i];
+        uint rank = 0u;
+        for (uint j = 0u; j < leaf_count; j++) {
+            float other = frustum_leaf_distances[j];
+            if (other < leaf_distance || (other == leaf_distance && j < i)) {
+                rank++;
+            }
+        }
+        frustum_levels[0][rank] = frustum_leaves[i];
+    }
+    memoryBarrierShared();
+    barrier();
+
+    for (uint i = index; i < leaf_count; i += group_size) {
+        frustum_leaves[i] = frustum_levels[0][i];
+    }
+    memoryBarrierShared();
+    barrier();
+    tile_frustum_ready = true;
+}
+
+// Find the nearest intersection of a primary ray among the leaves of the frustum, then the CSG object
+float compute_frustum_intersection(vec3 ray_pos, vec3 ray_dir, float time,
+out vec3 intersec_i, out vec3 normal_i,
+out int object_id, out int object_type) {
+    float closest_dist = 1e30f;
+    bool hit_found = false;
+    vec3 inv_ray_dir = 1.0 / ray_dir;
+
+    // The leaves are sorted by distance to the camera, once one is beyond the closest hit the next ones are too. The
+    // lens moves the origin of the ray a little from the camera.
+    float lens_offset = distance(ray_pos, camera.cameraPosition);
+    for (uint i = 0u; i < frustum_leaf_count; i++) {
+        BVHNode node = fetch_bvh_node(frustum_leaves[i]);
+        if (box_distance(camera.cameraPosition, node.aabb_min, node.aabb_max) - lens_offset >= closest_dist) {
+            break;
+        }
+        if (ray_box(ray_pos, inv_ray_dir, node.aabb_min, node.aabb_max, closest_dist) &&
+            intersect_leaf(node, ray_pos, ray_dir, inv_ray_dir, time, closest_dist, intersec_i, normal_i,
+            object_id, object_type)) {
+            hit_found = true;
+        }
+    }
+
+    if (intersect_csg(ray_pos, ray_dir, closest_dist, intersec_i, normal_i, object_id, object_type)) {
+        hit_found = true;
+    }
+
+    if (!hit_found) return -1.0;
+    return closest_dist;
+}
+#endif
+
+// Find the nearest intersection of a primary ray, among the leaves of the frustum of the tile when it is ready
+float compute_primary_intersection(vec3 ray_pos, vec3 ray_dir, float time,
+out vec3 intersec_i, out vec3 normal_i,
+out int object_id, out int object_type) {
+#ifdef TILE_FRUSTUM
+    if (tile_frustum_ready) {
+        return compute_frustum_intersection(ray_pos, ray_dir, time, intersec_i, normal_i, object_id, object_type);
+    }
+#endif
+    return compute_nearest_intersection(ray_pos, ray_dir, time, intersec_i, normal_i, object_id, object_type);
+}
+
+// Secondary rays of a hit, refraction first then reflection; returns how many were created
+int scatter_rays(vec3 direction, vec3 position, vec3 normal, float dist, vec3 mask, float current_ior,
+Material material, out vec3 origins[2], out vec3 directions[2], out vec3 masks[2], out float iors[2]) {
+    int count = 0;
+    float refraction_coef = material.refraction_coef;
+    float reflection_coef = material.reflection_coef;
+    bool has_reflection = reflection_coef > 0.0;
+
+    // Refraction
+    if (refraction_coef > 0.0) {
+        // Compute refraction
+        bool is_entering = dot(direction, normal) > 0.0;
+        vec3 new_normal = normal;
+        if (is_entering) new_normal = -new_normal;
+        float eta_from = current_ior;
+        float eta_to = material.refraction_index;
+        float eta = eta_from / eta_to;
+
+        // Calculate fresnel
+        float fresnel = 0.0;
+        if (lighting.use_fresnel) {
+            float cos_theta = abs(dot(direction, new_normal));
+            float r0 = pow((eta_from - eta_to) / (eta_from + eta_to), 2);
+            fresnel = r0 + (1.0 - r0) * pow(1.0 - cos_theta, 5.0);
+        }
+
+        // Adjust coefficients
+        float prev_refraction_coef = refraction_coef;
+        refraction_coef = refraction_coef - prev_refraction_coef * fresnel;
+        reflection_coef = reflection_coef + prev_refraction_coef * fresnel;
+
+        has_reflection = reflection_coef > 0.0f;
+
+        // Create refraction ray
+        vec3 refracted = refract(direction, new_normal, eta);
+
+        if (length(refracted) > 0.0) { // Valid refraction
+            origins[count] = position - new_normal * 1e-3;
+            directions[count] = refracted;
+            masks[count] = mask * refraction_coef;
+
+            // Handle absorption for inside rays
+            if (!is_entering) {
+                masks[count] *= exp(-material.absorption * dist);
+            }
+
+            iors[count] = eta_to;
+            count++;
+        }
+    }
+
+    // Reflection
+    if (has_reflection) {
+        origins[count] = position + normal * 1e-3;
+        directions[count] = glossy_reflect(direction, normal, material.glossiness);
+        masks[count] = mask * reflection_coef;
+        iors[count] = current_ior;
+        count++;
+    }
+
+    return count;
+}
+
+// Record the primary hit of a pixel; a miss stores a far point along the ray, so the background reprojects too
+void store_primary_hit(ivec2 pixel_coord, vec3 origin, vec3 direction, float dist, vec3 position, vec3 normal,
+                       int object_type, int object_id) {
+    if (dist > 0.0) {
+        Material material = get_material(object_type, object_id, position);
+        imageStore(primaryHitImage, pixel_coord, vec4(position, float(object_type * 65536 + object_id)));
+        imageStore(primaryNormalImage, pixel_coord, vec4(normal, 0.0));
+        imageStore(primaryAlbedoImage, pixel_coord, vec4(clamp(material.diffuse, 0.0, 1.0), 1.0));
+    } else {
+        imageStore(primaryHitImage, pixel_coord, vec4(origin + direction * 1.0e5, -1.0));
+        imageStore(primaryNormalImage, pixel_coord, vec4(0.0));
+        imageStore(primaryAlbedoImage, pixel_coord, vec4(1.0));
+    }
+}
+
+// Ray queue for parallel processing
+struct RayQueue {
+    Ray rays[512];// Increased queue size
+    int count;
+};
+
+// Process ray batches in parallel, stream tells apart the samples a pixel gets in the same frame
+vec3 trace_ray_batch(vec2 pixel_coord, uint stream) {
+    // Initialize the seed for random number generation
+    seed_random(uint(pixel_coord.x) + uint(camera.windowSize.x) * uint(pixel_coord.y), stream);
+
+    vec3 final_color = vec3(0.0);
+    int samples = max(1, lighting.sampleRate);
+
+    for (int s = 0; s < samples*samples; s++) {
+        vec2 sample_uv = compute_sample_uv(pixel_coord, s, samples);
+
+        // Initialize ray queue
+        RayQueue primary_rays;
+        primary_rays.count = 1;
+
+        // Set up primary ray
+        vec3 ray_origin, ray_direction;
+        compute_primary_ray(sample_uv, ray_origin, ray_direction);
+        primary_rays.rays[0] = create_ray(ray_origin, ray_direction);
+
+        // Trace primary rays
+        vec3 sample_color = vec3(0.0);
+
+        // Process all rays in the queue
+        for (int depth = 0; depth <= lighting.recursionDepth; depth++) {
+            // Secondary rays queue
+            RayQueue secondary_rays;
+            secondary_rays.count = 0;
+
+            // Process each ray in the current batch
+            for (int r = 0; r < primary_rays.count; r++) {
+                Ray ray = primary_rays.rays[r];
+
+                if (!ray.is_active) continue;
+
+                // Find intersection, the secondary rays go anywhere and traverse the whole BVH
+                vec3 intersect_point;
+                vec3 normal;
+                int object_id, object_type;
+
+                float dist = depth == 0
+                    ? compute_primary_intersection(ray.origin, ray.direction, 0.0, intersect_point, normal, object_id,
+                        object_type)
+                    : compute_nearest_intersection(ray.origin, ray.direction, 0.0, intersect_point, normal, object_id,
+                        object_type);
+
+                if (depth == 0 && s == 0 && stream == 0u) {
+                    store_primary_hit(ivec2(pixel_coord), ray.origin, ray.direction, dist, intersect_point, normal,
+                        object_type, object_id);
+                }
+
+                if (dist > 0.0) {
+                    // Hit something
+                    Material material = get_material(object_type, object_id, intersect_point);
+                    vec3 view_dir = normalize(ray.origin - intersect_point);
+
+                    // Direct lighting
+                    vec3 direct_light = calculate_lighting(
+                        intersect_point, normal, view_dir, material, lighting.lightColor
+                    );
+
+                    // Add direct lighting contribution
+                    sample_color += ray.mask * direct_light;
+
+                    if (length(ray.mask) < 0.01 || depth >= lighting.recursionDepth) {
+                        continue;
+                    }
+
+                    // Handle reflection and refraction
+                    vec3 origins[2], directions[2], masks[2];
+                    float iors[2];
+                    int spawned = scatter_rays(ray.direction, intersect_point, normal, dist, ray.mask,
+                        ray.current_ior, material, origins, directions, masks, iors);
+
+                    for (int i = 0; i < spawned && secondary_rays.count < 512; i++) {
+                        Ray next_ray = create_ray(origins[i], directions[i]);
+                        next_ray.mask = masks[i];
+                        next_ray.current_ior = iors[i];
+                        next_ray.depth = depth + 1;
+
+                        secondary_rays.rays[secondary_rays.count] = next_ray;
+                        secondary_rays.count++;
+                    }
+                } else {
+                    // Ray hit nothing, add background color
+                    sample_color += ray.mask * BACKGROUND_COLOR;
+                }
+            }
+
+            // If no secondary rays, we're done
+            if (secondary_rays.count == 0) break;
+
+            // Replace primary ray queue with secondary rays
+            primary_rays.count = secondary_rays.count;
+            for (int i = 0; i < secondary_rays.count; i++) {
+                primary_rays.rays[i] = secondary_rays.rays[i];
+            }
+        }
+
+        // Accumulate sample color
+        final_color += sample_color;
+    }
+
+    // Average samples
+    return final_color / float(samples * samples);
+}
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Blend a new sample of a pixel into the running averages of the previous ones
+void accumulate_pixel(ivec2 pixel_coord, vec3 pixel_color) {
+    vec4 previous = vec4(0.0);
+    float mean_square = 0.0;
+    if (accumulated_frames > 0u) {
+        previous = imageLoad(outputImage, pixel_coord);
+        mean_square = imageLoad(momentsImage, pixel_coord).r;
+    }
+
+    // Pixels skipped by the adaptive sampling have fewer samples than frames, the count is kept per pixel
+    float sample_count = previous.a + 1.0;
+    float square = luminance(pixel_color) * luminance(pixel_color);
+    pixel_color = previous.rgb + (pixel_color - previous.rgb) / sample_count;
+    mean_square += (square - mean_square) / sample_count;
+
+    // Store result in output image
+    imageStore(outputImage, pixel_coord, vec4(pixel_color, sample_count));
+    imageStore(momentsImage, pixel_coord, vec4(mean_square));
+}
+
+// Trace and accumulate the samples the allocation pass gave to a pixel for this frame
+void sample_pixel(ivec2 pixel_coord) {
+    uint samples = imageLoad(sampleMap, pixel_coord).r;
+    for (uint s = 0u; s < samples; s++) {
+        accumulate_pixel(pixel_coord, trace_ray_batch(vec2(pixel_coord), s));
+    }
+}
+
+// Standard error of the mean luminance of a pixel, relative to that luminance
+float relative_error(ivec2 pixel_coord) {
+    vec4 mean = imageLoad(outputImage, pixel_coord);
+    float mean_luminance = luminance(mean.rgb);
+    float variance = max(imageLoad(momentsImage, pixel_coord).r - mean_luminance * mean_luminance, 0.0);
+
+    // Dark pixels would need endless samples for a relative precision nobody can see
+    return sqrt(variance / max(mean.a, 1.0)) / (mean_luminance + 0.05);
+}
@@ -0,0 +1,18 @@
+// Tone mapping shared by the output pass, which quantizes to 8 bits, and the display pass
+
+// Exposure curve instead of clipping the HDR color
+uniform bool tone_mapping;
+uniform float exposure;
+
+vec3 map_tone(vec3 hdr_color) {
+    if (!tone_mapping) {
+        return clamp(hdr_color, 0.0, 1.0);
+    }
+
+    // Exposure tone mapping
+    vec3 mapped = vec3(1.0f) - exp(-hdr_color * exposure);
+
+    // Gamma correction
+    const float gamma = 1.0f;
+    return pow(mapped, vec3(1.0 / gamma));
+}
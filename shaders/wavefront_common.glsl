@@ -0,0 +1,117 @@
+// Queues shared by the passes of the wavefront path tracer. Every pass reads the queues written by the previous one,
+// the number of rays lives on the GPU and sizes the next dispatches through indirect dispatch.
+
+// Ray waiting for its closest hit
+struct WavefrontRay {
+    vec3 origin;
+    float current_ior;
+    vec3 direction;
+    uint pixel;// Index of the pixel in the tile
+    vec3 mask;
+    int depth;
+};
+
+// Closest hit of the ray with the same index, distance <= 0 for a miss
+struct WavefrontHit {
+    vec3 position;
+    float distance;
+    vec3 normal;
+    int object_id;
+    int object_type;
+};
+
+// Occlusion test towards a point of the light at a time of the exposure, the contribution is added if nothing blocks it
+struct ShadowRay {
+    vec3 origin;
+    float max_distance;
+    vec3 direction;
+    uint pixel;
+    vec3 contribution;
+    float time;
+};
+
+layout (std430, binding = 8) buffer RayQueueIn {
+    WavefrontRay rays[];
+} rays_in;
+
+layout (std430, binding = 9) buffer RayQueueOut {
+    WavefrontRay rays[];
+} rays_out;
+
+layout (std430, binding = 10) buffer HitQueue {
+    WavefrontHit hits[];
+} hit_queue;
+
+layout (std430, binding = 11) buffer ShadowQueue {
+    ShadowRay rays[];
+} shadow_queue;
+
+// Counters and per-pixel radiance of the tile. The dispatch arguments are read directly by glDispatchComputeIndirect.
+layout (std430, binding = 12) buffer WavefrontState {
+    uvec4 ray_dispatch;// Work groups for rays_in, count in w
+    uvec4 shadow_dispatch;// Work groups for the shadow queue, count in w
+    uint next_ray_count;// Rays appended to rays_out by the shade pass
+    uint shadow_ray_count;// Rays appended to the shadow queue by the shade pass
+    uint padding[2];
+    uint radiance[];// Fixed point RGB sum of every pixel of the tile
+} state;
+
+// Ray binning: rays are sorted by direction octant and origin cell, so the threads of a work group traverse the same
+// nodes. The grid has 4x4x4 cells of half the distance from the camera to its target, repeated over the scene.
+const uint RAY_BIN_CELLS = 4u;
+const uint RAY_BIN_COUNT = 8u * RAY_BIN_CELLS * RAY_BIN_CELLS * RAY_BIN_CELLS;
+
+// Counting sort of a queue into bins, and the ray statistics of the frame, read back by the renderer
+layout (std430, binding = 15) buffer RayBins {
+    uint extended_rays;// Rays given to the extend pass
+    uint shadow_rays;
+    uint bin_changes;// Rays of the extend pass in another bin than the ray before them in the work group
+    uint dropped_rays;// Rays that did not fit in a queue, none as the waves are sized for the deepest bounce
+
+    uint bin_offsets[RAY_BIN_COUNT];// Rays of every bin, then the index of its first ray
+    uint ranks[];// Index of every ray in its bin
+} bins;
+
+// Bin of a ray
+uint ray_bin(vec3 origin, vec3 direction) {
+    uint octant = (direction.x < 0.0 ? 1u : 0u) | (direction.y < 0.0 ? 2u : 0u) | (direction.z < 0.0 ? 4u : 0u);
+    float cell_size = max(distance(camera.cameraPosition, camera.cameraTarget), 0.001) * 0.5;
+    uvec3 cell = uvec3(ivec3(floor(origin / cell_size)) & int(RAY_BIN_CELLS - 1u));
+    return ((octant * RAY_BIN_CELLS + cell.z) * RAY_BIN_CELLS + cell.y) * RAY_BIN_CELLS + cell.x;
+}
+
+// Size of the tile being traced, its first pixel is tile_offset
+uniform ivec2 tile_size;
+
+// Number of rays each queue holds
+uniform uint ray_capacity;
+
+// Threads of a work group of the one-dimensional passes
+const uint WAVEFRONT_GROUP_SIZE = 64u;
+
+// Fixed point scale of the radiance sums, integer atomics work on every GPU
+const float RADIANCE_SCALE = 4096.0;
+
+// Add light to a pixel of the tile
+void add_radiance(uint pixel, vec3 color) {
+    uvec3 fixed_point = uvec3(clamp(color, 0.0, 1024.0) * RADIANCE_SCALE + 0.5);
+    atomicAdd(state.radiance[pixel * 3u], fixed_point.r);
+    atomicAdd(state.radiance[pixel * 3u + 1u], fixed_point.g);
+    atomicAdd(state.radiance[pixel * 3u + 2u], fixed_point.b);
+}
+
+// Seed the random numbers of a ray from the pixel and the ray
+void seed_ray(uint pixel, uint stream) {
+    ivec2 pixel_coord = tile_offset + ivec2(pixel % uint(tile_size.x), pixel / uint(tile_size.x));
+    seed_random(uint(pixel_coord.x) + uint(camera.windowSize.x) * uint(pixel_coord.y), stream);
+}
+
+// Append a ray to the output queue, dropping it if the queue is full
+void push_ray(WavefrontRay ray) {
+    uint index = atomicAdd(state.next_ray_count, 1u);
+    if (index < ray_capacity) {
+        rays_out.rays[index] = ray;
+    } else {
+        atomicAdd(bins.dropped_rays, 1u);
+    }
+}
@@ -11,5 +11,6 @@ void gl3::vbo::unbind() {
 }
 
 gl3::vbo::~vbo() {
+    memory_tracker::release_buffer(ID);
     glDeleteBuffers(1, &ID);
 }
\ No newline at end of file
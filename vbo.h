@@ -6,6 +6,8 @@
 #include <glm/vec4.hpp>
 #include <GL/glew.h>
 
+#include "memory_tracker.h"
+
 
 namespace gl3 {
     class vbo {
@@ -16,12 +18,14 @@ namespace gl3 {
             glGenBuffers(1, &ID);
             glBindBuffer(GL_ARRAY_BUFFER, ID);
             glBufferData(GL_ARRAY_BUFFER, positionsColors.size() * sizeof (glm::vec4 ), positionsColors.data(), GL_STATIC_DRAW);
+            memory_tracker::track_buffer(ID, gpu_memory_category::vertex_buffer, positionsColors.size() * sizeof (glm::vec4 ));
         }
 
         vbo(const std::vector<GLfloat>& data) {
             glGenBuffers(1, &ID);
             glBindBuffer(GL_ARRAY_BUFFER, ID);
             glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof (GLfloat ), data.data(), GL_STATIC_DRAW);
+            memory_tracker::track_buffer(ID, gpu_memory_category::vertex_buffer, data.size() * sizeof (GLfloat ));
         }
 
         vbo(const std::vector<glm::vec4>& positions, const std::vector<glm::vec4>& colors) {
@@ -30,6 +34,7 @@ namespace gl3 {
             const int sp = positions.size() * sizeof(glm::vec4);
             const int sc = colors.size() * sizeof(glm::vec4);
             glBufferData(GL_ARRAY_BUFFER, sp + sc, nullptr, GL_STATIC_DRAW);
+            memory_tracker::track_buffer(ID, gpu_memory_category::vertex_buffer, sp + sc);
             glBufferSubData(GL_ARRAY_BUFFER, 0, sp, positions.data());
             glBufferSubData(GL_ARRAY_BUFFER, sp, sc, colors.data());
         }
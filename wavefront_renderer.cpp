@@ -0,0 +1,302 @@
+#include "wavefront_renderer.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include "memory_tracker.h"
+
+// Size of a queued ray, hit or shadow ray in the std430 layout of the shaders
+constexpr std::size_t WAVEFRONT_ENTRY_SIZE = 48;
+
+// Size of the ray statistics before the bins in RayBins
+constexpr std::size_t WAVEFRONT_STATISTICS_SIZE = 4 * sizeof(GLuint);
+
+// Work groups covering a number of threads
+static GLuint group_count(const std::size_t threads, const std::size_t group_size)
+{
+    return static_cast<GLuint>((threads + group_size - 1) / group_size);
+}
+
+gl3::wavefront_renderer::wavefront_renderer(const std::string& defines)
+{
+    // Load the passes
+    generate_shader = std::make_unique<shader_class>("shaders/wavefront_generate.comp", defines);
+    extend_shader = std::make_unique<shader_class>("shaders/wavefront_extend.comp", defines);
+    shade_shader = std::make_unique<shader_class>("shaders/wavefront_shade.comp", defines);
+    shadow_shader = std::make_unique<shader_class>("shaders/wavefront_shadow.comp", defines);
+    compact_shader = std::make_unique<shader_class>("shaders/wavefront_compact.comp", defines);
+    resolve_shader = std::make_unique<shader_class>("shaders/wavefront_resolve.comp", defines);
+    bin_count_shader = std::make_unique<shader_class>("shaders/wavefront_bin_count.comp", defines);
+    bin_scan_shader = std::make_unique<shader_class>("shaders/wavefront_bin_scan.comp", defines);
+    bin_scatter_shader = std::make_unique<shader_class>("shaders/wavefront_bin_scatter.comp", defines);
+
+    // Create the queues, allocated on the first tile
+    glGenBuffers(2, ray_queues.data());
+    glGenBuffers(1, &hits_buffer);
+    glGenBuffers(1, &shadow_buffer);
+    glGenBuffers(1, &state_buffer);
+    glGenBuffers(1, &bins_buffer);
+    glGenBuffers(1, &sorted_shadow_buffer);
+
+    // Small copies of the statistics the CPU reads once the GPU is done with them
+    glGenBuffers(WAVEFRONT_STATISTICS_READBACKS, statistics_buffers.data());
+    for (const GLuint buffer : statistics_buffers)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, WAVEFRONT_STATISTICS_SIZE, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+gl3::wavefront_renderer::~wavefront_renderer()
+{
+    for (const GLuint buffer : {
+             ray_queues[0], ray_queues[1], hits_buffer, shadow_buffer, state_buffer, bins_buffer, sorted_shadow_buffer
+         })
+    {
+        memory_tracker::release_buffer(buffer);
+        glDeleteBuffers(1, &buffer);
+    }
+    for (int i = 0; i < pending_statistics; i++)
+    {
+        glDeleteSync(statistics_fences[(first_pending_statistics + i) % WAVEFRONT_STATISTICS_READBACKS]);
+    }
+    glDeleteBuffers(WAVEFRONT_STATISTICS_READBACKS, statistics_buffers.data());
+}
+
+void gl3::wavefront_renderer::reserve(const std::size_t rays, const std::size_t pixels)
+{
+    if (rays <= ray_capacity && pixels <= pixel_capacity)
+    {
+        return;
+    }
+    ray_capacity = std::max(rays, ray_capacity);
+    pixel_capacity = std::max(pixels, pixel_capacity);
+
+    // Queues, their content is written before being read
+    const auto queue_bytes = static_cast<GLsizeiptr>(ray_capacity * WAVEFRONT_ENTRY_SIZE);
+    for (const GLuint buffer : {ray_queues[0], ray_queues[1], hits_buffer, shadow_buffer, sorted_shadow_buffer})
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, queue_bytes, nullptr, GL_DYNAMIC_DRAW);
+        memory_tracker::track_buffer(buffer, gpu_memory_category::storage_buffer, queue_bytes);
+    }
+
+    // State, the radiance sums start at zero and the resolve pass clears them after use
+    const auto state_bytes = static_cast<GLsizeiptr>(sizeof(state_header) + pixel_capacity * 3 * sizeof(GLuint));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, state_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, state_bytes, nullptr, GL_DYNAMIC_DRAW);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    memory_tracker::track_buffer(state_buffer, gpu_memory_category::storage_buffer, state_bytes);
+
+    // Bins with a rank per ray, the statistics start over
+    const auto bins_bytes = static_cast<GLsizeiptr>(WAVEFRONT_STATISTICS_SIZE + WAVEFRONT_BIN_COUNT * sizeof(GLuint) +
+        ray_capacity * sizeof(GLuint));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bins_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bins_bytes, nullptr, GL_DYNAMIC_DRAW);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    memory_tracker::track_buffer(bins_buffer, gpu_memory_category::storage_buffer, bins_bytes);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+bool gl3::wavefront_renderer::request_statistics(const unsigned tiles)
+{
+    if (ray_capacity == 0 || pending_statistics == WAVEFRONT_STATISTICS_READBACKS)
+    {
+        return false;
+    }
+
+    // The copy runs after the tiles on the GPU, the fence tells when it is done
+    const int slot = (first_pending_statistics + pending_statistics) % WAVEFRONT_STATISTICS_READBACKS;
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_COPY_READ_BUFFER, bins_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, statistics_buffers[slot]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, WAVEFRONT_STATISTICS_SIZE);
+    glClearBufferSubData(GL_COPY_READ_BUFFER, GL_R32UI, 0, WAVEFRONT_STATISTICS_SIZE, GL_RED_INTEGER,
+                         GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    statistics_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    statistics_tiles[slot] = tiles;
+    pending_statistics++;
+    return true;
+}
+
+std::optional<gl3::wavefront_renderer::ray_statistics> gl3::wavefront_renderer::poll_statistics()
+{
+    if (pending_statistics == 0)
+    {
+        return std::nullopt;
+    }
+
+    // Copies finish in order, only the oldest one needs to be checked
+    const GLsync fence = statistics_fences[first_pending_statistics];
+    const GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+    {
+        return std::nullopt;
+    }
+    glDeleteSync(fence);
+
+    std::array<GLuint, 4> counters{};
+    glBindBuffer(GL_COPY_READ_BUFFER, statistics_buffers[first_pending_statistics]);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(counters), counters.data());
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    const ray_statistics result{
+        counters[0], counters[1], counters[2], counters[3], statistics_tiles[first_pending_statistics]
+    };
+    first_pending_statistics = (first_pending_statistics + 1) % WAVEFRONT_STATISTICS_READBACKS;
+    pending_statistics--;
+    return result;
+}
+
+void gl3::wavefront_renderer::sort_rays(const bool shadow_rays, const glm::ivec2 offset, const glm::ivec2 size,
+                                        const unsigned accumulated_frames) const
+{
+    constexpr GLintptr dispatch_offset[2] = {
+        offsetof(state_header, ray_dispatch), offsetof(state_header, shadow_dispatch)
+    };
+
+    // Empty bins
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bins_buffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, WAVEFRONT_STATISTICS_SIZE,
+                         WAVEFRONT_BIN_COUNT * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Count the rays of every bin, offset the bins by the rays of the bins before, then move every ray
+    use(*bin_count_shader, offset, size, accumulated_frames);
+    glUniform1i(glGetUniformLocation(bin_count_shader->id, "bin_shadow_rays"), shadow_rays);
+    glDispatchComputeIndirect(dispatch_offset[shadow_rays]);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    use(*bin_scan_shader, offset, size, accumulated_frames);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    use(*bin_scatter_shader, offset, size, accumulated_frames);
+    glUniform1i(glGetUniformLocation(bin_scatter_shader->id, "bin_shadow_rays"), shadow_rays);
+    glDispatchComputeIndirect(dispatch_offset[shadow_rays]);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void gl3::wavefront_renderer::use(const shader_class& shader, const glm::ivec2 offset, const glm::ivec2 size,
+                                  const unsigned accumulated_frames) const
+{
+    shader.activate();
+    glUniform2i(glGetUniformLocation(shader.id, "tile_offset"), offset.x, offset.y);
+    glUniform2i(glGetUniformLocation(shader.id, "tile_size"), size.x, size.y);
+    glUniform1ui(glGetUniformLocation(shader.id, "accumulated_frames"), accumulated_frames);
+    glUniform1ui(glGetUniformLocation(shader.id, "ray_capacity"), static_cast<GLuint>(ray_capacity));
+}
+
+void gl3::wavefront_renderer::trace_tile(const glm::ivec2 offset, const glm::ivec2 size,
+                                         const unsigned accumulated_frames, const int sample_rate,
+                                         const unsigned recursion_depth)
+{
+    const int samples = std::max(1, sample_rate);
+    const auto pixels = static_cast<std::size_t>(size.x) * size.y;
+    const std::size_t camera_rays = pixels * samples * samples;
+    reserve(camera_rays * WAVEFRONT_RAYS_PER_SAMPLE, pixels);
+
+    // A bounce at most doubles the rays, the camera rays are split in waves whose last bounce still fits in the queues
+    std::size_t growth = 1;
+    for (unsigned depth = 0; depth < recursion_depth && growth < ray_capacity; depth++)
+    {
+        growth *= 2;
+    }
+    const std::size_t wave_rays = std::max<std::size_t>(ray_capacity / growth, 1);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_HITS_BINDING, hits_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_STATE_BINDING, state_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_BINS_BINDING, bins_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_SORTED_SHADOW_RAYS_BINDING, sorted_shadow_buffer);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, state_buffer);
+
+    // The radiance sums add up over the waves until the resolve pass
+    for (std::size_t first_ray = 0; first_ray < camera_rays; first_ray += wave_rays)
+    {
+        const std::size_t wave_count = std::min(wave_rays, camera_rays - first_ray);
+        trace_wave(offset, size, accumulated_frames, recursion_depth, first_ray, wave_count);
+    }
+
+    // Average the samples of every pixel into the output image
+    use(*resolve_shader, offset, size, accumulated_frames);
+    glDispatchCompute(group_count(size.x, 16), group_count(size.y, 16), 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    shader_class::deactivate();
+}
+
+void gl3::wavefront_renderer::trace_wave(const glm::ivec2 offset, const glm::ivec2 size,
+                                         const unsigned accumulated_frames, const unsigned recursion_depth,
+                                         const std::size_t first_ray, const std::size_t ray_count)
+{
+    // The generate pass appends the camera rays of the pixels that still need samples, its counters are reset here
+    constexpr state_header header{{0, 1, 1, 0}, {0, 1, 1, 0}, 0, 0, {}};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, state_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), &header);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_RAYS_IN_BINDING, ray_queues[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_RAYS_OUT_BINDING, ray_queues[1]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_SHADOW_RAYS_BINDING, shadow_buffer);
+
+    use(*generate_shader, offset, size, accumulated_frames);
+    glUniform1ui(glGetUniformLocation(generate_shader->id, "wave_first_ray"), static_cast<GLuint>(first_ray));
+    glUniform1ui(glGetUniformLocation(generate_shader->id, "wave_ray_count"), static_cast<GLuint>(ray_count));
+    glDispatchCompute(group_count(ray_count, WAVEFRONT_GROUP_SIZE), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Every pass that appends rays is followed by a compact and a swap of the ray queues
+    int output_queue = 1;
+    const auto swap_queues = [&]
+    {
+        use(*compact_shader, offset, size, accumulated_frames);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_RAYS_IN_BINDING, ray_queues[output_queue]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_RAYS_OUT_BINDING, ray_queues[1 - output_queue]);
+        output_queue = 1 - output_queue;
+    };
+    swap_queues();
+
+    // One round of passes per bounce, the number of rays of each pass is only known by the GPU
+    constexpr GLintptr ray_dispatch_offset = offsetof(state_header, ray_dispatch);
+    constexpr GLintptr shadow_dispatch_offset = offsetof(state_header, shadow_dispatch);
+    for (unsigned depth = 0; depth <= recursion_depth; depth++)
+    {
+        use(*extend_shader, offset, size, accumulated_frames);
+        glDispatchComputeIndirect(ray_dispatch_offset);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        use(*shade_shader, offset, size, accumulated_frames);
+        glDispatchComputeIndirect(ray_dispatch_offset);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // The rays spawned by this bounce are the input of the next one. Reflected and refracted rays scatter in
+        // every direction, sorted by bin they go back to coherent work groups; the camera rays already are.
+        swap_queues();
+        if (binning && depth < recursion_depth)
+        {
+            sort_rays(false, offset, size, accumulated_frames);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_RAYS_IN_BINDING, ray_queues[output_queue]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_RAYS_OUT_BINDING, ray_queues[1 - output_queue]);
+            output_queue = 1 - output_queue;
+        }
+
+        // The shadow rays of the hits, sorted into the second shadow queue
+        if (binning)
+        {
+            sort_rays(true, offset, size, accumulated_frames);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_SHADOW_RAYS_BINDING, sorted_shadow_buffer);
+        }
+        use(*shadow_shader, offset, size, accumulated_frames);
+        glDispatchComputeIndirect(shadow_dispatch_offset);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_SHADOW_RAYS_BINDING, shadow_buffer);
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef WAVEFRONT_RENDERER_H
+#define WAVEFRONT_RENDERER_H
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "shader_class.h"
+#include "glm/vec2.hpp"
+
+// Ray queue and state bindings of the wavefront passes
+constexpr int WAVEFRONT_RAYS_IN_BINDING = 8;
+constexpr int WAVEFRONT_RAYS_OUT_BINDING = 9;
+constexpr int WAVEFRONT_HITS_BINDING = 10;
+constexpr int WAVEFRONT_SHADOW_RAYS_BINDING = 11;
+constexpr int WAVEFRONT_STATE_BINDING = 12;
+constexpr int WAVEFRONT_BINS_BINDING = 15;
+constexpr int WAVEFRONT_SORTED_SHADOW_RAYS_BINDING = 16;
+
+// Bins of the ray sort, 8 direction octants times 4x4x4 origin cells as in wavefront_common.glsl
+constexpr int WAVEFRONT_BIN_COUNT = 512;
+
+// Copies of the ray statistics that can wait for the GPU at the same time
+constexpr int WAVEFRONT_STATISTICS_READBACKS = 4;
+
+// Threads of a work group of the one-dimensional passes
+constexpr int WAVEFRONT_GROUP_SIZE = 64;
+
+// Queue capacity per camera sample. Reflection and refraction can both spawn a ray, so a camera ray becomes up to
+// 2^depth rays; deeper tiles are traced in several waves of fewer camera rays.
+constexpr int WAVEFRONT_RAYS_PER_SAMPLE = 2;
+
+namespace gl3
+{
+    // Path tracer split in small kernels that exchange rays through queues in storage buffers: generate camera rays,
+    // extend them to their closest hit, shade the hits, trace the shadow rays, then compact the surviving rays for
+    // the next bounce. Every kernel keeps little state, so more of them run at once than with the megakernel, and
+    // the ray counts stay on the GPU, sizing the dispatches through glDispatchComputeIndirect.
+    class wavefront_renderer
+    {
+    public:
+        // The defines are given to every pass, e.g. to select the BVH traversal
+        explicit wavefront_renderer(const std::string& defines = "");
+        ~wavefront_renderer();
+
+        wavefront_renderer(const wavefront_renderer&) = delete;
+        wavefront_renderer& operator=(const wavefront_renderer&) = delete;
+
+        // Rays traced since the last read back, how many of the extended ones fell in another bin than their
+        // neighbour in the work group, how many did not fit in a queue, and the tiles they were counted on
+        struct ray_statistics
+        {
+            unsigned extended_rays;
+            unsigned shadow_rays;
+            unsigned bin_changes;
+            unsigned dropped_rays;
+            unsigned tiles;
+        };
+
+        // Trace a tile of the image into the output texture bound to image unit 0
+        void trace_tile(glm::ivec2 offset, glm::ivec2 size, unsigned accumulated_frames, int sample_rate,
+                        unsigned recursion_depth);
+
+        // Sort the secondary and shadow rays by bin before tracing them
+        void set_ray_binning(const bool enabled) { binning = enabled; }
+
+        // Copy the ray statistics of the tiles traced since the last request aside and start counting over; returns
+        // false if every copy is still waiting for the GPU, the counting then goes on
+        bool request_statistics(unsigned tiles);
+
+        // Oldest copied statistics the GPU has finished, if any, without waiting for it
+        std::optional<ray_statistics> poll_statistics();
+
+    private:
+        // Layout of WavefrontState before the radiance sums
+        struct state_header
+        {
+            std::array<unsigned, 4> ray_dispatch;
+            std::array<unsigned, 4> shadow_dispatch;
+            unsigned next_ray_count;
+            unsigned shadow_ray_count;
+            std::array<unsigned, 2> padding;
+        };
+
+        // Passes
+        std::unique_ptr<shader_class> generate_shader;
+        std::unique_ptr<shader_class> extend_shader;
+        std::unique_ptr<shader_class> shade_shader;
+        std::unique_ptr<shader_class> shadow_shader;
+        std::unique_ptr<shader_class> compact_shader;
+        std::unique_ptr<shader_class> resolve_shader;
+        std::unique_ptr<shader_class> bin_count_shader;
+        std::unique_ptr<shader_class> bin_scan_shader;
+        std::unique_ptr<shader_class> bin_scatter_shader;
+
+        // Queues, the two ray queues swap roles at every bounce
+        std::array<GLuint, 2> ray_queues{};
+        GLuint hits_buffer{};
+        GLuint shadow_buffer{};
+        GLuint state_buffer{};
+        GLuint bins_buffer{};
+        GLuint sorted_shadow_buffer{};
+        bool binning = true;
+        std::size_t ray_capacity = 0;
+
+        // Copies of the ray statistics, read back in order once their fence is signaled
+        std::array<GLuint, WAVEFRONT_STATISTICS_READBACKS> statistics_buffers{};
+        std::array<GLsync, WAVEFRONT_STATISTICS_READBACKS> statistics_fences{};
+        std::array<unsigned, WAVEFRONT_STATISTICS_READBACKS> statistics_tiles{};
+        int first_pending_statistics = 0; // Oldest copy waiting for the GPU
+        int pending_statistics = 0;
+        std::size_t pixel_capacity = 0;
+
+        // Grow the queues to hold the rays of a tile
+        void reserve(std::size_t rays, std::size_t pixels);
+
+        // Trace the camera rays from first_ray on and their bounces, adding their light to the radiance sums
+        void trace_wave(glm::ivec2 offset, glm::ivec2 size, unsigned accumulated_frames, unsigned recursion_depth,
+                        std::size_t first_ray, std::size_t ray_count);
+
+        // Counting sort of the ray queue into the output queue, or of the shadow queue into the sorted shadow queue
+        void sort_rays(bool shadow_rays, glm::ivec2 offset, glm::ivec2 size, unsigned accumulated_frames) const;
+
+        // Activate a pass and set the uniforms of the tile
+        void use(const shader_class& shader, glm::ivec2 offset, glm::ivec2 size, unsigned accumulated_frames) const;
+    };
+}
+
+
+#endif //WAVEFRONT_RENDERER_H